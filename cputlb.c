@@ -26,6 +26,7 @@
 #include "exec/cputlb.h"
 
 #include "exec/memory-internal.h"
+#include "tlm.h"
 
 //#define DEBUG_TLB
 //#define DEBUG_TLB_CHECK
@@ -33,6 +34,9 @@
 /* statistics */
 int tlb_flush_count;
 
+DEFINE_TLS(MemoryRegion *, tlm_cpu_access_mr);
+DEFINE_TLS(int, tlm_cpu_access_type);
+
 static const CPUTLBEntry s_cputlb_empty_entry = {
     .addr_read  = -1,
     .addr_write = -1,
@@ -130,6 +134,7 @@ void tlb_protect_code(ram_addr_t ram_addr)
     cpu_physical_memory_reset_dirty(ram_addr,
                                     ram_addr + TARGET_PAGE_SIZE,
                                     CODE_DIRTY_FLAG);
+    tlm_code_page_protect(ram_addr);
 }
 
 /* update the TLB so that writes in physical page 'phys_addr' are no longer
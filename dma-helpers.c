@@ -272,6 +272,95 @@ uint64_t dma_buf_write(uint8_t *ptr, int32_t len, QEMUSGList *sg)
     return dma_buf_rw(ptr, len, sg, DMA_DIRECTION_TO_DEVICE);
 }
 
+DMAAsyncRWFunc *dma_async_rw_func;
+
+typedef struct DMABufAIOCB {
+    int pending;
+    int ret;
+    BlockDriverCompletionFunc *cb;
+    void *opaque;
+    QEMUBH *bh;
+} DMABufAIOCB;
+
+static void dma_buf_async_bh(void *opaque)
+{
+    DMABufAIOCB *dbs = opaque;
+
+    qemu_bh_delete(dbs->bh);
+    if (dbs->cb) {
+        dbs->cb(dbs->opaque, dbs->ret);
+    }
+    g_free(dbs);
+}
+
+static void dma_buf_async_put(DMABufAIOCB *dbs)
+{
+    if (--dbs->pending == 0) {
+        dbs->bh = qemu_bh_new(dma_buf_async_bh, dbs);
+        qemu_bh_schedule(dbs->bh);
+    }
+}
+
+static void dma_buf_async_cb(void *opaque, int ret)
+{
+    DMABufAIOCB *dbs = opaque;
+
+    if (ret < 0) {
+        dbs->ret = ret;
+    }
+    dma_buf_async_put(dbs);
+}
+
+static uint64_t dma_buf_rw_async(uint8_t *ptr, int32_t len, QEMUSGList *sg,
+                                 DMADirection dir,
+                                 BlockDriverCompletionFunc *cb, void *opaque)
+{
+    DMABufAIOCB *dbs = g_malloc0(sizeof *dbs);
+    uint64_t resid;
+    int sg_cur_index;
+
+    dbs->cb = cb;
+    dbs->opaque = opaque;
+    /* Hold a reference until all parts are submitted.  */
+    dbs->pending = 1;
+
+    resid = sg->size;
+    sg_cur_index = 0;
+    len = MIN(len, resid);
+    while (len > 0) {
+        ScatterGatherEntry entry = sg->sg[sg_cur_index++];
+        int32_t xfer = MIN(len, entry.len);
+
+        dbs->pending++;
+        if (!dma_async_rw_func || dma_has_iommu(sg->dma)
+            || dma_async_rw_func(entry.base, ptr, xfer, dir,
+                                 dma_buf_async_cb, dbs)) {
+            dma_memory_rw(sg->dma, entry.base, ptr, xfer, dir);
+            dbs->pending--;
+        }
+        ptr += xfer;
+        len -= xfer;
+        resid -= xfer;
+    }
+
+    dma_buf_async_put(dbs);
+    return resid;
+}
+
+uint64_t dma_buf_read_async(uint8_t *ptr, int32_t len, QEMUSGList *sg,
+                            BlockDriverCompletionFunc *cb, void *opaque)
+{
+    return dma_buf_rw_async(ptr, len, sg, DMA_DIRECTION_FROM_DEVICE,
+                            cb, opaque);
+}
+
+uint64_t dma_buf_write_async(uint8_t *ptr, int32_t len, QEMUSGList *sg,
+                             BlockDriverCompletionFunc *cb, void *opaque)
+{
+    return dma_buf_rw_async(ptr, len, sg, DMA_DIRECTION_TO_DEVICE,
+                            cb, opaque);
+}
+
 void dma_acct_start(BlockDriverState *bs, BlockAcctCookie *cookie,
                     QEMUSGList *sg, enum BlockAcctType type)
 {
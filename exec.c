@@ -97,6 +97,7 @@ static unsigned phys_map_nodes_nb, phys_map_nodes_nb_alloc;
 
 static void io_mem_init(void);
 static void memory_map_init(void);
+static void tlm_phys_cache_init(void);
 static void *qemu_safe_ram_ptr(ram_addr_t addr);
 
 static MemoryRegion io_mem_watch;
@@ -214,6 +215,7 @@ void cpu_exec_init_all(void)
 {
 #if !defined(CONFIG_USER_ONLY)
     qemu_mutex_init(&ram_list.mutex);
+    tlm_phys_cache_init();
     memory_map_init();
     io_mem_init();
 #endif
@@ -1713,8 +1715,12 @@ static void mem_begin(MemoryListener *listener)
     d->phys_map.ptr = PHYS_MAP_NODE_NIL;
 }
 
+static void tlm_phys_cache_begin(void);
+static void tlm_phys_cache_commit(void);
+
 static void core_begin(MemoryListener *listener)
 {
+    tlm_phys_cache_begin();
     phys_sections_clear();
     phys_section_unassigned = dummy_section(&io_mem_unassigned);
     phys_section_notdirty = dummy_section(&io_mem_notdirty);
@@ -1734,6 +1740,11 @@ static void tcg_commit(MemoryListener *listener)
     }
 }
 
+static void core_commit(MemoryListener *listener)
+{
+    tlm_phys_cache_commit();
+}
+
 static void core_log_global_start(MemoryListener *listener)
 {
     cpu_physical_memory_set_dirty_tracking(1);
@@ -1764,6 +1775,7 @@ static void io_region_del(MemoryListener *listener,
 
 static MemoryListener core_memory_listener = {
     .begin = core_begin,
+    .commit = core_commit,
     .log_global_start = core_log_global_start,
     .log_global_stop = core_log_global_stop,
     .priority = 1,
@@ -1916,7 +1928,12 @@ static int address_space_rw_internal(AddressSpace *as, hwaddr addr, uint8_t *buf
                 addr1 = memory_region_section_addr(section, addr);
                 /* XXX: could force cpu_single_env to NULL to avoid
                    potential bugs */
-                if (l >= 4 && ((addr1 & 3) == 0)) {
+                if (l >= 8 && ((addr1 & 7) == 0)
+                    && section->mr->ops->impl.max_access_size >= 8) {
+                    /* 64 bit write access */
+                    io_mem_write(section->mr, addr1, ldq_p(buf), 8);
+                    l = 8;
+                } else if (l >= 4 && ((addr1 & 3) == 0)) {
                     /* 32 bit write access */
                     val = ldl_p(buf);
                     io_mem_write(section->mr, addr1, val, 4);
@@ -1941,6 +1958,7 @@ static int address_space_rw_internal(AddressSpace *as, hwaddr addr, uint8_t *buf
                 memcpy(ptr, buf, l);
                 invalidate_and_set_dirty(addr1, l);
                 qemu_put_ram_ptr(ptr);
+                is_ram = 1;
             }
         } else {
             if (!(memory_region_is_ram(section->mr) ||
@@ -1949,7 +1967,12 @@ static int address_space_rw_internal(AddressSpace *as, hwaddr addr, uint8_t *buf
                 hwaddr addr1;
                 /* I/O case */
                 addr1 = memory_region_section_addr(section, addr);
-                if (l >= 4 && ((addr1 & 3) == 0)) {
+                if (l >= 8 && ((addr1 & 7) == 0)
+                    && section->mr->ops->impl.max_access_size >= 8) {
+                    /* 64 bit read access */
+                    stq_p(buf, io_mem_read(section->mr, addr1, 8));
+                    l = 8;
+                } else if (l >= 4 && ((addr1 & 3) == 0)) {
                     /* 32 bit read access */
                     val = io_mem_read(section->mr, addr1, 4);
                     stl_p(buf, val);
@@ -1972,6 +1995,7 @@ static int address_space_rw_internal(AddressSpace *as, hwaddr addr, uint8_t *buf
                                                                     addr));
                 memcpy(buf, ptr, l);
                 qemu_put_ram_ptr(ptr);
+                is_ram = 1;
             }
         }
         len -= l;
@@ -1982,46 +2006,79 @@ static int address_space_rw_internal(AddressSpace *as, hwaddr addr, uint8_t *buf
     return is_ram;
 }
 
-static void *qemu_get_ram_base_ptr(ram_addr_t addr)
+/*
+ * RAMBlocks sorted by offset for the TLM helpers, rebuilt when
+ * ram_list.version changes.
+ */
+static struct {
+    RAMBlock **blocks;
+    int nb_blocks;
+    uint32_t version;
+    bool valid;
+} ram_index;
+
+static void ram_index_rebuild(void)
 {
     RAMBlock *block;
+    int i, j, n = 0;
 
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        if (addr - block->offset < block->length) {
-            /* Move this entry to to start of the list.  */
-            if (block != QTAILQ_FIRST(&ram_list.blocks)) {
-                QTAILQ_REMOVE(&ram_list.blocks, block, next);
-                QTAILQ_INSERT_HEAD(&ram_list.blocks, block, next);
-            }
-           return block->host;
-        }
+        n++;
     }
+    ram_index.blocks = g_renew(RAMBlock *, ram_index.blocks, n);
+    ram_index.nb_blocks = n;
 
-    fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
-    abort();
-
-    return NULL;
+    i = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        /* Insertion sort, there are only a few blocks.  */
+        for (j = i; j > 0 && ram_index.blocks[j - 1]->offset > block->offset;
+             j--) {
+            ram_index.blocks[j] = ram_index.blocks[j - 1];
+        }
+        ram_index.blocks[j] = block;
+        i++;
+    }
+    ram_index.version = ram_list.version;
+    ram_index.valid = true;
 }
 
-static int qemu_get_ram_len(ram_addr_t addr)
+static RAMBlock *qemu_ram_block_lookup(ram_addr_t addr)
 {
-    RAMBlock *block;
+    RAMBlock *block = ram_list.mru_block;
+    int lo, hi;
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+    if (block && addr - block->offset < block->length) {
+        return block;
+    }
+
+    if (!ram_index.valid || ram_index.version != ram_list.version) {
+        ram_index_rebuild();
+    }
+
+    /* Find the last block starting at or below addr.  */
+    lo = 0;
+    hi = ram_index.nb_blocks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (ram_index.blocks[mid]->offset <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0) {
+        block = ram_index.blocks[lo - 1];
         if (addr - block->offset < block->length) {
-            /* Move this entry to to start of the list.  */
-            if (block != QTAILQ_FIRST(&ram_list.blocks)) {
-                QTAILQ_REMOVE(&ram_list.blocks, block, next);
-                QTAILQ_INSERT_HEAD(&ram_list.blocks, block, next);
-            }
-            return block->length;
+            ram_list.mru_block = block;
+            return block;
         }
     }
 
     fprintf(stderr, "Bad ram offset %" PRIx64 "\n", (uint64_t)addr);
     abort();
 
-    return -1;
+    return NULL;
 }
 
 /* TLM helper to map phys address into ram host ptr.  */
@@ -2037,14 +2094,14 @@ void *qemu_map_paddr_to_host(hwaddr *paddr_p, int *len)
     }
 
     if(memory_region_is_ram(section->mr) && !memory_region_is_tlmu_ramd(section->mr)){
-        /* FIXME: Simplify!!!  */
-        const hwaddr ram_addr = memory_region_get_ram_addr(section->mr) + section->offset_within_region;
+        const ram_addr_t ram_addr = memory_region_get_ram_addr(section->mr)
+                                    + memory_region_section_addr(section, paddr);
+        RAMBlock *const block = qemu_ram_block_lookup(ram_addr);
 
-        char *const host = qemu_get_ram_ptr(ram_addr) + (paddr & ~TARGET_PAGE_MASK);
-        host_base = qemu_get_ram_base_ptr(ram_addr);
-        offset = host - host_base;
+        host_base = (char *) block->host;
+        offset = ram_addr - block->offset;
         *paddr_p = paddr - offset;
-        *len = qemu_get_ram_len(ram_addr);
+        *len = block->length;
     }
     return host_base;
 }
@@ -2061,6 +2118,111 @@ int cpu_physical_memory_rw(hwaddr addr, uint8_t *buf,
     return address_space_rw_internal(&address_space_memory, addr, buf, len, is_write, 0);
 }
 
+/*
+ * Accesses made by the main emulator into our RAM. A small direct mapped
+ * cache remembers the host pointer of recently accessed pages, it is
+ * flushed whenever the memory topology changes.
+ *
+ * The main emulator calls in from its own thread, concurrently with the
+ * QEMU thread. The lock covers the lookup, the refill and the copy, so an
+ * entry is never seen half written nor used while it is flushed. Between
+ * the begin and commit of a topology change the cache is off.
+ */
+#define TLM_PHYS_CACHE_BITS 6
+#define TLM_PHYS_CACHE_SIZE (1 << TLM_PHYS_CACHE_BITS)
+
+typedef struct TLMPhysCacheEntry {
+    hwaddr page;
+    uint8_t *host;
+    ram_addr_t ram_addr;
+    bool readonly;
+    bool valid;
+} TLMPhysCacheEntry;
+
+static TLMPhysCacheEntry tlm_phys_cache[TLM_PHYS_CACHE_SIZE];
+static QemuMutex tlm_phys_cache_lock;
+static bool tlm_phys_cache_updating;
+
+static void tlm_phys_cache_init(void)
+{
+    qemu_mutex_init(&tlm_phys_cache_lock);
+}
+
+static void tlm_phys_cache_begin(void)
+{
+    int i;
+
+    qemu_mutex_lock(&tlm_phys_cache_lock);
+    for (i = 0; i < TLM_PHYS_CACHE_SIZE; i++) {
+        tlm_phys_cache[i].valid = false;
+    }
+    tlm_phys_cache_updating = true;
+    qemu_mutex_unlock(&tlm_phys_cache_lock);
+}
+
+static void tlm_phys_cache_commit(void)
+{
+    qemu_mutex_lock(&tlm_phys_cache_lock);
+    tlm_phys_cache_updating = false;
+    qemu_mutex_unlock(&tlm_phys_cache_lock);
+}
+
+static TLMPhysCacheEntry *tlm_phys_cache_lookup(hwaddr page)
+{
+    TLMPhysCacheEntry *e;
+    MemoryRegionSection *section;
+
+    e = &tlm_phys_cache[(page >> TARGET_PAGE_BITS)
+                        & (TLM_PHYS_CACHE_SIZE - 1)];
+    if (e->valid && e->page == page) {
+        return e;
+    }
+
+    section = phys_page_find(address_space_memory.dispatch,
+                             page >> TARGET_PAGE_BITS);
+    if (!memory_region_is_ram(section->mr)
+        || memory_region_is_tlmu_ramd(section->mr)) {
+        return NULL;
+    }
+    e->ram_addr = memory_region_get_ram_addr(section->mr)
+                  + memory_region_section_addr(section, page);
+    e->host = qemu_get_ram_ptr(e->ram_addr);
+    e->readonly = section->readonly;
+    e->page = page;
+    e->valid = true;
+    return e;
+}
+
+int cpu_physical_memory_rw_cached(hwaddr addr, uint8_t *buf,
+                                  int len, int is_write)
+{
+    const hwaddr page = addr & TARGET_PAGE_MASK;
+    TLMPhysCacheEntry *e;
+    hwaddr offset;
+
+    /* Page crossers and the rest take the slow path.  */
+    if (xen_enabled() || addr + len > page + TARGET_PAGE_SIZE) {
+        return cpu_physical_memory_rw(addr, buf, len, is_write);
+    }
+
+    qemu_mutex_lock(&tlm_phys_cache_lock);
+    e = tlm_phys_cache_updating ? NULL : tlm_phys_cache_lookup(page);
+    if (!e || (is_write && e->readonly)) {
+        qemu_mutex_unlock(&tlm_phys_cache_lock);
+        return cpu_physical_memory_rw(addr, buf, len, is_write);
+    }
+
+    offset = addr - page;
+    if (is_write) {
+        memcpy(e->host + offset, buf, len);
+        invalidate_and_set_dirty(e->ram_addr + offset, len);
+    } else {
+        memcpy(buf, e->host + offset, len);
+    }
+    qemu_mutex_unlock(&tlm_phys_cache_lock);
+    return 1;
+}
+
 void cpu_physical_memory_rw_debug(hwaddr addr, uint8_t *buf,
                                   int len, int is_write)
 {
@@ -2140,6 +2302,16 @@ void cpu_physical_memory_write_rom(hwaddr addr,
     }
 }
 
+/* Drop the code translated from a RAM region whose contents changed
+   behind the back of the softmmu, e.g. RAM backed by device storage.  */
+void memory_region_invalidate_code(MemoryRegion *mr, hwaddr addr,
+                                   hwaddr size)
+{
+    ram_addr_t start = memory_region_get_ram_addr(mr) + addr;
+
+    tb_invalidate_phys_range(start, start + size, 0);
+}
+
 typedef struct {
     void *buffer;
     hwaddr addr;
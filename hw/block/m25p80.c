@@ -25,6 +25,10 @@
 #include "sysemu/blockdev.h"
 #include "hw/ssi.h"
 #include "qemu/config-file.h"
+#include "qemu/bitmap.h"
+#include "qemu/timer.h"
+
+#include <sys/mman.h>
 
 #ifndef M25P80_ERR_DEBUG
 #define M25P80_ERR_DEBUG 0
@@ -47,6 +51,11 @@
  */
 #define WR_1 0x100
 
+/* Dirty sectors are written back this long after the first write, or when
+ * the flash gets deselected.
+ */
+#define M25P80_SYNC_DELAY_MS 100
+
 typedef struct FlashPartInfo {
     const char *part_name;
     /* jedec code. (jedec >> 16) & 0xff is the 1st byte, >> 8 the 2nd etc */
@@ -245,7 +254,12 @@ typedef struct Flash {
     uint64_t cur_addr;
     bool write_enable;
 
-    int64_t dirty_page;
+    /* Sectors not written back yet, NULL when storage is mapped from the
+       raw backing file.  */
+    unsigned long *dirty;
+    QEMUTimer *sync_timer;
+    /* Bumped on every modification of storage.  */
+    uint32_t generation;
 
     const FlashPartInfo *pi;
 
@@ -266,44 +280,65 @@ typedef struct M25P80Class {
 
 static void bdrv_sync_complete(void *opaque, int ret)
 {
-    /* do nothing. Masters do not directly interact with the backing store,
-     * only the working copy so no mutexing required.
+    QEMUIOVector *iov = opaque;
+
+    /* Masters do not directly interact with the backing store, only the
+     * working copy so no mutexing required.
      */
+    qemu_iovec_destroy(iov);
+    g_free(iov);
+}
+
+static void flash_sync_area(Flash *s, int64_t start, int64_t nb_sectors)
+{
+    QEMUIOVector *iov = g_new(QEMUIOVector, 1);
+
+    qemu_iovec_init(iov, 1);
+    qemu_iovec_add(iov, s->storage + start * BDRV_SECTOR_SIZE,
+                   nb_sectors * BDRV_SECTOR_SIZE);
+    bdrv_aio_writev(s->bdrv, start, iov, nb_sectors, bdrv_sync_complete, iov);
 }
 
-static void flash_sync_page(Flash *s, int page)
+/* Write back the dirty sectors, one request per contiguous run.  */
+static void flash_sync_dirty(Flash *s)
 {
-    if (s->bdrv) {
-        int bdrv_sector, nb_sectors;
-        QEMUIOVector iov;
-
-        bdrv_sector = (page * s->pi->page_size) / BDRV_SECTOR_SIZE;
-        nb_sectors = DIV_ROUND_UP(s->pi->page_size, BDRV_SECTOR_SIZE);
-        qemu_iovec_init(&iov, 1);
-        qemu_iovec_add(&iov, s->storage + bdrv_sector * BDRV_SECTOR_SIZE,
-                                                nb_sectors * BDRV_SECTOR_SIZE);
-        bdrv_aio_writev(s->bdrv, bdrv_sector, &iov, nb_sectors,
-                                                bdrv_sync_complete, NULL);
+    unsigned long nb_sectors = DIV_ROUND_UP(s->size, BDRV_SECTOR_SIZE);
+    unsigned long start, end;
+
+    if (!s->dirty) {
+        return;
+    }
+
+    qemu_del_timer(s->sync_timer);
+    start = find_first_bit(s->dirty, nb_sectors);
+    while (start < nb_sectors) {
+        end = find_next_zero_bit(s->dirty, nb_sectors, start);
+        bitmap_clear(s->dirty, start, end - start);
+        DB_PRINT_L(0, "sync sectors %lu-%lu\n", start, end - 1);
+        flash_sync_area(s, start, end - start);
+        start = find_next_bit(s->dirty, nb_sectors, end);
     }
 }
 
-static inline void flash_sync_area(Flash *s, int64_t off, int64_t len)
+static void flash_sync_timer(void *opaque)
 {
-    int64_t start, end, nb_sectors;
-    QEMUIOVector iov;
+    flash_sync_dirty(opaque);
+}
+
+static void flash_mark_dirty(Flash *s, int64_t off, int64_t len)
+{
+    int64_t first = off / BDRV_SECTOR_SIZE;
+    int64_t last = (off + len - 1) / BDRV_SECTOR_SIZE;
 
-    if (!s->bdrv) {
+    if (!s->dirty) {
         return;
     }
 
-    assert(!(len % BDRV_SECTOR_SIZE));
-    start = off / BDRV_SECTOR_SIZE;
-    end = (off + len) / BDRV_SECTOR_SIZE;
-    nb_sectors = end - start;
-    qemu_iovec_init(&iov, 1);
-    qemu_iovec_add(&iov, s->storage + (start * BDRV_SECTOR_SIZE),
-                                        nb_sectors * BDRV_SECTOR_SIZE);
-    bdrv_aio_writev(s->bdrv, start, &iov, nb_sectors, bdrv_sync_complete, NULL);
+    bitmap_set(s->dirty, first, last - first + 1);
+    if (!qemu_timer_pending(s->sync_timer)) {
+        qemu_mod_timer(s->sync_timer,
+                       qemu_get_clock_ms(rt_clock) + M25P80_SYNC_DELAY_MS);
+    }
 }
 
 static void flash_erase(Flash *s, int offset, FlashCMD cmd)
@@ -341,21 +376,13 @@ static void flash_erase(Flash *s, int offset, FlashCMD cmd)
         return;
     }
     memset(s->storage + offset, 0xff, len);
-    flash_sync_area(s, offset, len);
-}
-
-static inline void flash_sync_dirty(Flash *s, int64_t newpage)
-{
-    if (s->dirty_page >= 0 && s->dirty_page != newpage) {
-        flash_sync_page(s, s->dirty_page);
-        s->dirty_page = newpage;
-    }
+    s->generation++;
+    flash_mark_dirty(s, offset, len);
 }
 
 static inline
 void flash_write8(Flash *s, uint64_t addr, uint8_t data)
 {
-    int64_t page = addr / s->pi->page_size;
     uint8_t prev = s->storage[s->cur_addr];
 
     if (!s->write_enable) {
@@ -372,9 +399,8 @@ void flash_write8(Flash *s, uint64_t addr, uint8_t data)
     } else {
         s->storage[s->cur_addr] &= data;
     }
-
-    flash_sync_dirty(s, page);
-    s->dirty_page = page;
+    s->generation++;
+    flash_mark_dirty(s, s->cur_addr, 1);
 }
 
 static void complete_collecting_data(Flash *s)
@@ -414,6 +440,41 @@ static void complete_collecting_data(Flash *s)
     }
 }
 
+/* Address, mode and dummy bytes following a read command, -1 if cmd is not
+ * a read.
+ */
+static int flash_read_hdr_bytes(Flash *s, uint8_t cmd)
+{
+    switch (cmd) {
+    case READ:
+        return 3;
+    case FAST_READ:
+    case DOR:
+    case QOR:
+        return 4;
+    case DIOR:
+        switch ((s->pi->jedec >> 16) & 0xFF) {
+        case JEDEC_WINBOND:
+        case JEDEC_SPANSION:
+            return 4;
+        case JEDEC_NUMONYX:
+        default:
+            return 5;
+        }
+    case QIOR:
+        switch ((s->pi->jedec >> 16) & 0xFF) {
+        case JEDEC_WINBOND:
+        case JEDEC_SPANSION:
+            return 6;
+        case JEDEC_NUMONYX:
+        default:
+            return 8;
+        }
+    default:
+        return -1;
+    }
+}
+
 static void decode_new_cmd(Flash *s, uint32_t value)
 {
     s->cmd_in_progress = value;
@@ -444,30 +505,8 @@ static void decode_new_cmd(Flash *s, uint32_t value)
         break;
 
     case DIOR:
-        switch ((s->pi->jedec >> 16) & 0xFF) {
-        case JEDEC_WINBOND:
-        case JEDEC_SPANSION:
-            s->needed_bytes = 4;
-            break;
-        case JEDEC_NUMONYX:
-        default:
-            s->needed_bytes = 5;
-        }
-        s->pos = 0;
-        s->len = 0;
-        s->state = STATE_COLLECTING_DATA;
-        break;
-
     case QIOR:
-        switch ((s->pi->jedec >> 16) & 0xFF) {
-        case JEDEC_WINBOND:
-        case JEDEC_SPANSION:
-            s->needed_bytes = 6;
-            break;
-        case JEDEC_NUMONYX:
-        default:
-            s->needed_bytes = 8;
-        }
+        s->needed_bytes = flash_read_hdr_bytes(s, value);
         s->pos = 0;
         s->len = 0;
         s->state = STATE_COLLECTING_DATA;
@@ -537,7 +576,7 @@ static int m25p80_cs(SSISlave *ss, bool select)
         s->len = 0;
         s->pos = 0;
         s->state = STATE_IDLE;
-        flash_sync_dirty(s, -1);
+        flash_sync_dirty(s);
     }
 
     DB_PRINT_L(0, "%sselect\n", select ? "de" : "");
@@ -593,6 +632,108 @@ static uint32_t m25p80_transfer8(SSISlave *ss, uint32_t tx)
     return r;
 }
 
+static uint8_t *m25p80_get_xip_storage(SSISlave *ss, uint8_t cmd,
+                                       int hdr_bytes, uint64_t *size,
+                                       uint32_t *gen)
+{
+    Flash *s = FROM_SSI_SLAVE(Flash, ss);
+
+    if (flash_read_hdr_bytes(s, cmd) != hdr_bytes) {
+        return NULL;
+    }
+    *size = s->size;
+    *gen = s->generation;
+    return s->storage;
+}
+
+/* Data phases of reads and page programs are done in blocks, everything
+ * else goes byte by byte through m25p80_transfer8().
+ */
+static void m25p80_transfer_bulk(SSISlave *ss, const uint8_t *tx,
+                                 uint8_t *rx, int len)
+{
+    Flash *s = FROM_SSI_SLAVE(Flash, ss);
+    int64_t page;
+    int i, n;
+
+    while (len) {
+        switch (s->state) {
+        case STATE_READ:
+            n = MIN(len, s->size - s->cur_addr);
+            memcpy(rx, s->storage + s->cur_addr, n);
+            s->cur_addr = (s->cur_addr + n) % s->size;
+            break;
+
+        case STATE_PAGE_PROGRAM:
+            if (s->cur_addr >= s->size) {
+                rx[0] = m25p80_transfer8(ss, tx[0]);
+                n = 1;
+                break;
+            }
+            /* One page at a time. Like the byte path, the address keeps
+               going into the next page rather than wrapping.  */
+            page = s->cur_addr / s->pi->page_size;
+            n = MIN(len, (page + 1) * s->pi->page_size - s->cur_addr);
+            if (!s->write_enable) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "M25P80: write with write protect!\n");
+            }
+            if (s->pi->flags & WR_1) {
+                memcpy(s->storage + s->cur_addr, tx, n);
+            } else {
+                for (i = 0; i < n; i++) {
+                    s->storage[s->cur_addr + i] &= tx[i];
+                }
+            }
+            s->generation++;
+            flash_mark_dirty(s, s->cur_addr, n);
+            s->cur_addr += n;
+            memset(rx, 0, n);
+            break;
+
+        default:
+            rx[0] = m25p80_transfer8(ss, tx[0]);
+            n = 1;
+            break;
+        }
+        tx += n;
+        rx += n;
+        len -= n;
+    }
+}
+
+/* Map the backing file directly if the drive is a plain raw file, writes
+ * then need no block layer requests at all.
+ */
+static uint8_t *flash_map_storage(Flash *s, DriveInfo *dinfo)
+{
+    const char *format = bdrv_get_format_name(s->bdrv);
+    const char *filename = qemu_opt_get(dinfo->opts, "file");
+    bool ro = bdrv_is_read_only(s->bdrv);
+    struct stat st;
+    void *p;
+    int fd;
+
+    if (!format || strcmp(format, "raw") || !filename) {
+        return NULL;
+    }
+    fd = qemu_open(filename, ro ? O_RDONLY : O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < s->size) {
+        qemu_close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, s->size, PROT_READ | PROT_WRITE,
+             ro ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    qemu_close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    return p;
+}
+
 static int m25p80_init(SSISlave *ss)
 {
     DriveInfo *dinfo;
@@ -603,22 +744,29 @@ static int m25p80_init(SSISlave *ss)
     s->pi = mc->pi;
 
     s->size = s->pi->sector_size * s->pi->n_sectors;
-    s->dirty_page = -1;
-    s->storage = qemu_blockalign(s->bdrv, s->size);
 
     dinfo = drive_get_next(IF_MTD);
 
     if (dinfo && dinfo->bdrv) {
         DB_PRINT_L(0, "Binding to IF_MTD drive\n");
         s->bdrv = dinfo->bdrv;
-        /* FIXME: Move to late init */
-        if (bdrv_read(s->bdrv, 0, s->storage, DIV_ROUND_UP(s->size,
-                                                    BDRV_SECTOR_SIZE))) {
-            fprintf(stderr, "Failed to initialize SPI flash!\n");
-            return 1;
+        s->storage = flash_map_storage(s, dinfo);
+        if (s->storage) {
+            DB_PRINT_L(0, "Mapped the backing file\n");
+        } else {
+            s->storage = qemu_blockalign(s->bdrv, s->size);
+            /* FIXME: Move to late init */
+            if (bdrv_read(s->bdrv, 0, s->storage, DIV_ROUND_UP(s->size,
+                                                        BDRV_SECTOR_SIZE))) {
+                fprintf(stderr, "Failed to initialize SPI flash!\n");
+                return 1;
+            }
+            s->dirty = bitmap_new(DIV_ROUND_UP(s->size, BDRV_SECTOR_SIZE));
+            s->sync_timer = qemu_new_timer_ms(rt_clock, flash_sync_timer, s);
         }
     } else {
         DB_PRINT_L(0, "No BDRV - binding to RAM\n");
+        s->storage = qemu_blockalign(NULL, s->size);
         memset(s->storage, 0xFF, s->size);
     }
 
@@ -635,7 +783,7 @@ static int m25p80_init(SSISlave *ss)
 
 static void m25p80_pre_save(void *opaque)
 {
-    flash_sync_dirty((Flash *)opaque, -1);
+    flash_sync_dirty((Flash *)opaque);
 }
 
 static const VMStateDescription vmstate_m25p80 = {
@@ -665,7 +813,9 @@ static void m25p80_class_init(ObjectClass *klass, void *data)
 
     k->init = m25p80_init;
     k->transfer = m25p80_transfer8;
+    k->transfer_bulk = m25p80_transfer_bulk;
     k->set_cs = m25p80_cs;
+    k->get_xip_storage = m25p80_get_xip_storage;
     k->cs_polarity = SSI_CS_LOW;
     dc->vmsd = &vmstate_m25p80;
     mc->pi = data;
@@ -19,6 +19,7 @@
 #include "hw/sysbus.h"
 #include "sysemu/char.h"
 #include "qemu/timer.h"
+#include "qemu/fifo8.h"
 
 #ifdef CADENCE_UART_ERR_DEBUG
 #define DB_PRINT(...) do { \
@@ -110,9 +111,7 @@ typedef struct {
     SysBusDevice busdev;
     MemoryRegion iomem;
     uint32_t r[R_MAX];
-    uint8_t r_fifo[RX_FIFO_SIZE];
-    uint32_t rx_wpos;
-    uint32_t rx_count;
+    Fifo8 rx_fifo;
     uint64_t char_tx_time;
     CharDriverState *chr;
     qemu_irq irq;
@@ -155,8 +154,7 @@ static void uart_tx_write(void *opaque)
 
 static void uart_rx_reset(UartState *s)
 {
-    s->rx_wpos = 0;
-    s->rx_count = 0;
+    fifo8_reset(&s->rx_fifo);
     if (s->chr) {
         qemu_chr_accept_input(s->chr);
     }
@@ -234,7 +232,7 @@ static int uart_can_receive(void *opaque)
 {
     UartState *s = (UartState *)opaque;
 
-    return RX_FIFO_SIZE - s->rx_count;
+    return fifo8_num_free(&s->rx_fifo);
 }
 
 static void uart_ctrl_update(UartState *s)
@@ -262,7 +260,6 @@ static void uart_write_rx_fifo(void *opaque, const uint8_t *buf, int size)
 {
     UartState *s = (UartState *)opaque;
     uint64_t new_rx_time = qemu_get_clock_ns(vm_clock);
-    int i;
 
     if ((s->r[R_CR] & UART_CR_RX_DIS) || !(s->r[R_CR] & UART_CR_RX_EN)) {
         return;
@@ -270,22 +267,17 @@ static void uart_write_rx_fifo(void *opaque, const uint8_t *buf, int size)
 
     s->r[R_SR] &= ~UART_SR_INTR_REMPTY;
 
-    if (s->rx_count == RX_FIFO_SIZE) {
+    if (fifo8_is_full(&s->rx_fifo)) {
         s->r[R_CISR] |= UART_INTR_ROVR;
     } else {
-        for (i = 0; i < size; i++) {
-            s->r_fifo[s->rx_wpos] = buf[i];
-            s->rx_wpos = (s->rx_wpos + 1) % RX_FIFO_SIZE;
-            s->rx_count++;
-
-            if (s->rx_count == RX_FIFO_SIZE) {
-                s->r[R_SR] |= UART_SR_INTR_RFUL;
-                break;
-            }
-
-            if (s->rx_count >= s->r[R_RTRIG]) {
-                s->r[R_SR] |= UART_SR_INTR_RTRIG;
-            }
+        fifo8_push_all(&s->rx_fifo, buf,
+                       MIN(size, fifo8_num_free(&s->rx_fifo)));
+
+        if (fifo8_is_full(&s->rx_fifo)) {
+            s->r[R_SR] |= UART_SR_INTR_RFUL;
+        }
+        if (fifo8_num_used(&s->rx_fifo) >= s->r[R_RTRIG]) {
+            s->r[R_SR] |= UART_SR_INTR_RTRIG;
         }
         qemu_mod_timer(s->fifo_trigger_handle, new_rx_time +
                                                 (s->char_tx_time * 4));
@@ -335,13 +327,10 @@ static void uart_read_rx_fifo(UartState *s, uint32_t *c)
 
     s->r[R_SR] &= ~UART_SR_INTR_RFUL;
 
-    if (s->rx_count) {
-        uint32_t rx_rpos =
-                (RX_FIFO_SIZE + s->rx_wpos - s->rx_count) % RX_FIFO_SIZE;
-        *c = s->r_fifo[rx_rpos];
-        s->rx_count--;
+    if (!fifo8_is_empty(&s->rx_fifo)) {
+        *c = fifo8_pop(&s->rx_fifo);
 
-        if (!s->rx_count) {
+        if (fifo8_is_empty(&s->rx_fifo)) {
             s->r[R_SR] |= UART_SR_INTR_REMPTY;
         }
         qemu_chr_accept_input(s->chr);
@@ -350,7 +339,7 @@ static void uart_read_rx_fifo(UartState *s, uint32_t *c)
         s->r[R_SR] |= UART_SR_INTR_REMPTY;
     }
 
-    if (s->rx_count < s->r[R_RTRIG]) {
+    if (fifo8_num_used(&s->rx_fifo) < s->r[R_RTRIG]) {
         s->r[R_SR] &= ~UART_SR_INTR_RTRIG;
     }
     uart_update_status(s);
@@ -436,9 +425,6 @@ static void cadence_uart_reset(UartState *s)
 
     uart_rx_reset(s);
     uart_tx_reset(s);
-
-    s->rx_count = 0;
-    s->rx_wpos = 0;
 }
 
 static int cadence_uart_init(SysBusDevice *dev)
@@ -457,6 +443,8 @@ static int cadence_uart_init(SysBusDevice *dev)
 
     s->char_tx_time = (get_ticks_per_sec() / 9600) * 10;
 
+    fifo8_create(&s->rx_fifo, RX_FIFO_SIZE);
+
     s->chr = qemu_char_get_next_serial();
 
     cadence_uart_reset(s);
@@ -480,15 +468,13 @@ static int cadence_uart_post_load(void *opaque, int version_id)
 
 static const VMStateDescription vmstate_cadence_uart = {
     .name = "cadence_uart",
-    .version_id = 1,
-    .minimum_version_id = 1,
-    .minimum_version_id_old = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
     .post_load = cadence_uart_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT32_ARRAY(r, UartState, R_MAX),
-        VMSTATE_UINT8_ARRAY(r_fifo, UartState, RX_FIFO_SIZE),
-        VMSTATE_UINT32(rx_count, UartState),
-        VMSTATE_UINT32(rx_wpos, UartState),
+        VMSTATE_FIFO8(rx_fifo, UartState),
         VMSTATE_TIMER(fifo_trigger_handle, UartState),
         VMSTATE_TIMER(tx_time_handle, UartState),
         VMSTATE_END_OF_LIST()
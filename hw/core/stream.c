@@ -4,10 +4,40 @@ size_t
 stream_push(StreamSlave *sink, uint8_t *buf, size_t len, uint32_t attr)
 {
     StreamSlaveClass *k =  STREAM_SLAVE_GET_CLASS(sink);
+    struct iovec iov;
 
+    if (!k->push) {
+        iov.iov_base = buf;
+        iov.iov_len = len;
+        return k->push_iov(sink, &iov, 1, attr);
+    }
     return k->push(sink, buf, len, attr);
 }
 
+size_t
+stream_push_iov(StreamSlave *sink, const struct iovec *iov, int iovcnt,
+                uint32_t attr)
+{
+    StreamSlaveClass *k =  STREAM_SLAVE_GET_CLASS(sink);
+    size_t ret, done = 0;
+    int i;
+
+    if (k->push_iov) {
+        return k->push_iov(sink, iov, iovcnt, attr);
+    }
+
+    /* One push per entry, the attributes go with the last one.  */
+    for (i = 0; i < iovcnt; i++) {
+        ret = k->push(sink, iov[i].iov_base, iov[i].iov_len,
+                      i == iovcnt - 1 ? attr : 0);
+        done += ret;
+        if (ret < iov[i].iov_len) {
+            break;
+        }
+    }
+    return done;
+}
+
 bool
 stream_can_push(StreamSlave *sink, StreamCanPushNotifyFn notify,
                 void *notify_opaque)
@@ -17,6 +47,33 @@ stream_can_push(StreamSlave *sink, StreamCanPushNotifyFn notify,
     return k->can_push ? k->can_push(sink, notify, notify_opaque) : true;
 }
 
+void
+stream_can_push_cancel(StreamSlave *sink)
+{
+    StreamSlaveClass *k =  STREAM_SLAVE_GET_CLASS(sink);
+
+    if (k->can_push) {
+        k->can_push(sink, NULL, NULL);
+    }
+}
+
+void stream_ready_wait(StreamReadyNotifier *n, StreamCanPushNotifyFn notify,
+                       void *notify_opaque)
+{
+    n->notify = notify;
+    n->opaque = notify_opaque;
+}
+
+void stream_ready(StreamReadyNotifier *n)
+{
+    StreamCanPushNotifyFn notify = n->notify;
+
+    if (notify) {
+        n->notify = NULL;
+        notify(n->opaque);
+    }
+}
+
 static const TypeInfo stream_slave_info = {
     .name          = TYPE_STREAM_SLAVE,
     .parent        = TYPE_INTERFACE,
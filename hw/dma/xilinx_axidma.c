@@ -29,6 +29,8 @@
 #include "qapi/qmp/qerror.h"
 
 #include "hw/stream.h"
+#include "sysemu/dma.h"
+#include "qemu/iov.h"
 
 #define D(x)
 
@@ -98,6 +100,7 @@ enum {
 };
 
 struct Stream {
+    XilinxAXIDMA *dma;
     QEMUBH *bh;
     ptimer_state *ptimer;
     qemu_irq irq;
@@ -105,10 +108,27 @@ struct Stream {
     int nr;
 
     struct SDesc desc;
-    int pos;
     unsigned int complete_cnt;
     uint32_t regs[R_MAX];
     uint8_t app[20];
+
+    /* MM2S frame being gathered. The buffers are only read and the
+       descriptors written back once the EOF descriptor shows up. If the
+       sink takes only part of it, txpos bytes have been pushed and the
+       channel is stalled on the EOF descriptor.  */
+    QEMUSGList sg;
+    size_t txpos;
+    bool tx_stalled;
+    /* S2MM got part of a packet, pushes continue it without SOF.  */
+    bool rx_in_packet;
+    hwaddr *sg_desc;
+    int sg_desc_alloc;
+    struct iovec *iov;
+    struct iovec *txiov;
+    int iov_alloc;
+    /* Copy of frames not entirely in RAM.  */
+    uint8_t *txbuf;
+    size_t txbuf_size;
 };
 
 struct XilinxAXIDMAStreamSlave {
@@ -128,8 +148,7 @@ struct XilinxAXIDMA {
 
     struct Stream streams[2];
 
-    StreamCanPushNotifyFn notify;
-    void *notify_opaque;
+    StreamReadyNotifier rx_ready;
 };
 
 /*
@@ -166,10 +185,23 @@ static inline int stream_idle(struct Stream *s)
     return !!(s->regs[R_DMASR] & DMASR_IDLE);
 }
 
+static void stream_frame_reset(struct Stream *s)
+{
+    s->sg.nsg = 0;
+    s->sg.size = 0;
+    s->txpos = 0;
+}
+
 static void stream_reset(struct Stream *s)
 {
     s->regs[R_DMASR] = DMASR_HALTED;  /* starts up halted.  */
     s->regs[R_DMACR] = 1 << 16; /* Starts with one in compl threshold.  */
+    if (s->tx_stalled && s->dma->tx_data_dev) {
+        stream_can_push_cancel(s->dma->tx_data_dev);
+    }
+    s->tx_stalled = false;
+    s->rx_in_packet = false;
+    stream_frame_reset(s);
 }
 
 /* Map an offset addr into a channel index.  */
@@ -192,11 +224,12 @@ static void stream_desc_show(struct SDesc *d)
 }
 #endif
 
+/* The app words are only needed at MM2S SOF, see stream_desc_load_app().  */
 static void stream_desc_load(struct Stream *s, hwaddr addr)
 {
     struct SDesc *d = &s->desc;
 
-    cpu_physical_memory_read(addr, d, sizeof *d);
+    dma_memory_read(&dma_context_memory, addr, d, offsetof(struct SDesc, app));
 
     /* Convert from LE into host endianness.  */
     d->buffer_address = le64_to_cpu(d->buffer_address);
@@ -205,16 +238,31 @@ static void stream_desc_load(struct Stream *s, hwaddr addr)
     d->status = le32_to_cpu(d->status);
 }
 
-static void stream_desc_store(struct Stream *s, hwaddr addr)
+static void stream_desc_load_app(struct Stream *s, hwaddr addr)
 {
-    struct SDesc *d = &s->desc;
+    dma_memory_read(&dma_context_memory, addr + offsetof(struct SDesc, app),
+                    s->desc.app, sizeof s->desc.app);
+}
 
-    /* Convert from host endianness into LE.  */
-    d->buffer_address = cpu_to_le64(d->buffer_address);
-    d->nxtdesc = cpu_to_le64(d->nxtdesc);
-    d->control = cpu_to_le32(d->control);
-    d->status = cpu_to_le32(d->status);
-    cpu_physical_memory_write(addr, d, sizeof *d);
+/*
+ * The engine only ever modifies the status word and, at S2MM EOF, the app
+ * words that follow it. Write back just those.
+ */
+static void stream_desc_store(hwaddr addr, uint32_t status, uint8_t *app)
+{
+    struct {
+        uint32_t status;
+        uint8_t app[CONTROL_PAYLOAD_SIZE];
+    } QEMU_PACKED wb;
+    size_t len = sizeof wb.status;
+
+    wb.status = cpu_to_le32(status);
+    if (app) {
+        memcpy(wb.app, app, sizeof wb.app);
+        len = sizeof wb;
+    }
+    dma_memory_write(&dma_context_memory,
+                     addr + offsetof(struct SDesc, status), &wb, len);
 }
 
 static void stream_update_irq(struct Stream *s)
@@ -265,11 +313,145 @@ static void stream_complete(struct Stream *s)
     }
 }
 
+static void stream_frame_add(struct Stream *s, hwaddr desc, hwaddr buf,
+                             unsigned int len)
+{
+    if (s->sg.nsg == s->sg_desc_alloc) {
+        s->sg_desc_alloc = MAX(8, s->sg_desc_alloc * 2);
+        s->sg_desc = g_renew(hwaddr, s->sg_desc, s->sg_desc_alloc);
+    }
+    s->sg_desc[s->sg.nsg] = desc;
+    qemu_sglist_add(&s->sg, buf, len);
+}
+
+/* Mark all the descriptors of the gathered frame as completed.  */
+static void stream_frame_writeback(struct Stream *s)
+{
+    int i;
+
+    for (i = 0; i < s->sg.nsg; i++) {
+        stream_desc_store(s->sg_desc[i],
+                          s->sg.sg[i].len | SDESC_STATUS_COMPLETE, NULL);
+    }
+    stream_frame_reset(s);
+}
+
+/*
+ * Map the buffers of the gathered frame into s->iov. Returns the number of
+ * mapped entries, which is less than s->sg.nsg if some buffer is not
+ * entirely backed by RAM.
+ */
+static int stream_frame_map(struct Stream *s)
+{
+    QEMUSGList *sg = &s->sg;
+    dma_addr_t len;
+    int i;
+
+    if (s->iov_alloc < sg->nsg) {
+        s->iov_alloc = sg->nalloc;
+        s->iov = g_renew(struct iovec, s->iov, s->iov_alloc);
+        s->txiov = g_renew(struct iovec, s->txiov, s->iov_alloc);
+    }
+
+    for (i = 0; i < sg->nsg; i++) {
+        len = sg->sg[i].len;
+        s->iov[i].iov_base = NULL;
+        s->iov[i].iov_len = len;
+        if (!len) {
+            continue;
+        }
+
+        s->iov[i].iov_base = dma_memory_map(sg->dma, sg->sg[i].base, &len,
+                                            DMA_DIRECTION_TO_DEVICE);
+        if (!s->iov[i].iov_base) {
+            break;
+        }
+        if (len < sg->sg[i].len) {
+            dma_memory_unmap(sg->dma, s->iov[i].iov_base, len,
+                             DMA_DIRECTION_TO_DEVICE, 0);
+            break;
+        }
+    }
+    return i;
+}
+
+static void stream_frame_unmap(struct Stream *s, int nr)
+{
+    int i;
+
+    for (i = 0; i < nr; i++) {
+        if (s->iov[i].iov_base) {
+            dma_memory_unmap(s->sg.dma, s->iov[i].iov_base, s->iov[i].iov_len,
+                             DMA_DIRECTION_TO_DEVICE, s->iov[i].iov_len);
+        }
+    }
+}
+
+static void stream_mm2s_ready(void *opaque);
+
+/* Push what is left of the gathered frame, returns true once all of it is
+   gone. A sink that stops taking data without arming a ready notification
+   gets the rest of the frame dropped, it would otherwise stall the channel
+   for good.  */
+static bool stream_push_frame(struct Stream *s, StreamSlave *tx_data_dev)
+{
+    size_t size = s->sg.size;
+    struct iovec txbuf_iov;
+    struct iovec *iov = s->iov;
+    struct iovec *txiov;
+    int iovcnt, txiovcnt, mapped;
+    size_t pushed;
+    bool done = true;
+
+    mapped = stream_frame_map(s);
+    iovcnt = mapped;
+    if (mapped < s->sg.nsg) {
+        stream_frame_unmap(s, mapped);
+        mapped = 0;
+
+        if (s->txbuf_size < size) {
+            s->txbuf_size = size;
+            s->txbuf = g_realloc(s->txbuf, size);
+        }
+        dma_buf_write(s->txbuf, size, &s->sg);
+        txbuf_iov.iov_base = s->txbuf;
+        txbuf_iov.iov_len = size;
+        iov = &txbuf_iov;
+        iovcnt = 1;
+    }
+
+    while (s->txpos < size) {
+        txiov = iov;
+        txiovcnt = iovcnt;
+        if (s->txpos) {
+            txiovcnt = iov_copy(s->txiov, s->iov_alloc, iov, iovcnt,
+                                s->txpos, size - s->txpos);
+            txiov = s->txiov;
+        }
+        pushed = stream_push_iov(tx_data_dev, txiov, txiovcnt,
+                                 STREAM_ATTR_EOP);
+        s->txpos += pushed;
+        if (s->txpos == size) {
+            break;
+        }
+
+        if (!stream_can_push(tx_data_dev, stream_mm2s_ready, s)) {
+            /* Resume once the sink has room.  */
+            done = false;
+            break;
+        }
+        if (!pushed) {
+            s->txpos = size;
+        }
+    }
+    stream_frame_unmap(s, mapped);
+    return done;
+}
+
 static void stream_process_mem2s(struct Stream *s, StreamSlave *tx_data_dev,
                                  StreamSlave *tx_control_dev)
 {
     uint32_t prev_d;
-    unsigned char txbuf[16 * 1024];
     unsigned int txlen;
 
     if (!stream_running(s) || stream_idle(s)) {
@@ -277,39 +459,36 @@ static void stream_process_mem2s(struct Stream *s, StreamSlave *tx_data_dev,
     }
 
     while (1) {
-        stream_desc_load(s, s->regs[R_CURDESC]);
+        if (!s->tx_stalled) {
+            stream_desc_load(s, s->regs[R_CURDESC]);
 
-        if (s->desc.status & SDESC_STATUS_COMPLETE) {
-            s->regs[R_DMASR] |= DMASR_HALTED;
-            break;
-        }
+            if (s->desc.status & SDESC_STATUS_COMPLETE) {
+                s->regs[R_DMASR] |= DMASR_HALTED;
+                break;
+            }
 
-        if (stream_desc_sof(&s->desc)) {
-            s->pos = 0;
-            stream_push(tx_control_dev, s->desc.app, sizeof(s->desc.app),
-                        STREAM_ATTR_EOP);
-        }
+            if (stream_desc_sof(&s->desc)) {
+                /* Drop whatever was gathered without an EOF.  */
+                stream_frame_writeback(s);
+                stream_desc_load_app(s, s->regs[R_CURDESC]);
+                stream_push(tx_control_dev, s->desc.app, sizeof(s->desc.app),
+                            STREAM_ATTR_EOP);
+            }
 
-        txlen = s->desc.control & SDESC_CTRL_LEN_MASK;
-        if ((txlen + s->pos) > sizeof txbuf) {
-            hw_error("%s: too small internal txbuf! %d\n", __func__,
-                     txlen + s->pos);
+            txlen = s->desc.control & SDESC_CTRL_LEN_MASK;
+            stream_frame_add(s, s->regs[R_CURDESC], s->desc.buffer_address,
+                             txlen);
         }
 
-        cpu_physical_memory_read(s->desc.buffer_address,
-                                 txbuf + s->pos, txlen);
-        s->pos += txlen;
-
         if (stream_desc_eof(&s->desc)) {
-            stream_push(tx_data_dev, txbuf, s->pos, STREAM_ATTR_EOP);
-            s->pos = 0;
+            s->tx_stalled = !stream_push_frame(s, tx_data_dev);
+            if (s->tx_stalled) {
+                break;
+            }
+            stream_frame_writeback(s);
             stream_complete(s);
         }
 
-        /* Update the descriptor.  */
-        s->desc.status = txlen | SDESC_STATUS_COMPLETE;
-        stream_desc_store(s, s->regs[R_CURDESC]);
-
         /* Advance.  */
         prev_d = s->regs[R_CURDESC];
         s->regs[R_CURDESC] = s->desc.nxtdesc;
@@ -320,13 +499,67 @@ static void stream_process_mem2s(struct Stream *s, StreamSlave *tx_data_dev,
     }
 }
 
-static size_t stream_process_s2mem(struct Stream *s, unsigned char *buf,
-                                   size_t len, uint32_t attr)
+static void stream_mm2s_ready(void *opaque)
+{
+    struct Stream *s = opaque;
+
+    stream_process_mem2s(s, s->dma->tx_data_dev, s->dma->tx_control_dev);
+    stream_update_irq(s);
+}
+
+static void stream_write_done(void *opaque, int ret)
+{
+    g_free(opaque);
+}
+
+/*
+ * Write a received buffer into memory. RAM is written directly, other
+ * memories without waiting for them. The descriptor write back goes through
+ * the normal path and is ordered after the data.
+ */
+static void stream_write_buffer(hwaddr addr, const struct iovec *iov,
+                                int iovcnt, size_t offset, unsigned int len)
+{
+    dma_addr_t maplen = len;
+    ram_addr_t ram_addr;
+    uint8_t *data;
+    QEMUSGList sg;
+
+    if (!len) {
+        return;
+    }
+
+    data = dma_memory_map(&dma_context_memory, addr, &maplen,
+                          DMA_DIRECTION_FROM_DEVICE);
+    if (data) {
+        if (maplen == len && !qemu_ram_addr_from_host(data, &ram_addr)) {
+            iov_to_buf(iov, iovcnt, offset, data, len);
+            dma_memory_unmap(&dma_context_memory, data, maplen,
+                             DMA_DIRECTION_FROM_DEVICE, len);
+            return;
+        }
+        /* Short or bounced, nothing written.  */
+        dma_memory_unmap(&dma_context_memory, data, maplen,
+                         DMA_DIRECTION_FROM_DEVICE, 0);
+    }
+
+    data = g_malloc(len);
+    iov_to_buf(iov, iovcnt, offset, data, len);
+
+    qemu_sglist_init(&sg, 1, &dma_context_memory);
+    qemu_sglist_add(&sg, addr, len);
+    dma_buf_read_async(data, len, &sg, stream_write_done, data);
+    qemu_sglist_destroy(&sg);
+}
+
+static size_t stream_process_s2mem(struct Stream *s, const struct iovec *iov,
+                                   int iovcnt, uint32_t attr)
 {
+    size_t len = iov_size(iov, iovcnt);
     uint32_t prev_d;
     unsigned int rxlen;
     size_t pos = 0;
-    int sof = 1;
+    bool eof;
 
     if (!stream_running(s) || stream_idle(s)) {
         return 0;
@@ -346,21 +579,22 @@ static size_t stream_process_s2mem(struct Stream *s, unsigned char *buf,
             rxlen = len;
         }
 
-        cpu_physical_memory_write(s->desc.buffer_address, buf + pos, rxlen);
+        stream_write_buffer(s->desc.buffer_address, iov, iovcnt, pos, rxlen);
         len -= rxlen;
         pos += rxlen;
 
         /* Update the descriptor.  */
-        if (!len && stream_attr_has_eop(attr)) {
+        eof = !len && stream_attr_has_eop(attr);
+        if (eof) {
             stream_complete(s);
-            memcpy(s->desc.app, s->app, sizeof(s->desc.app));
             s->desc.status |= SDESC_STATUS_EOF;
         }
 
-        s->desc.status |= sof << SDESC_STATUS_SOF_BIT;
+        s->desc.status |= !s->rx_in_packet << SDESC_STATUS_SOF_BIT;
         s->desc.status |= SDESC_STATUS_COMPLETE;
-        stream_desc_store(s, s->regs[R_CURDESC]);
-        sof = 0;
+        stream_desc_store(s->regs[R_CURDESC], s->desc.status,
+                          eof ? s->app : NULL);
+        s->rx_in_packet = !eof;
 
         /* Advance.  */
         prev_d = s->regs[R_CURDESC];
@@ -409,8 +643,7 @@ xilinx_axidma_data_stream_can_push(StreamSlave *obj,
     struct Stream *s = &ds->dma->streams[1];
 
     if (!stream_running(s) || stream_idle(s)) {
-        ds->dma->notify = notify;
-        ds->dma->notify_opaque = notify_opaque;
+        stream_ready_wait(&ds->dma->rx_ready, notify, notify_opaque);
         return false;
     }
 
@@ -418,14 +651,14 @@ xilinx_axidma_data_stream_can_push(StreamSlave *obj,
 }
 
 static size_t
-xilinx_axidma_data_stream_push(StreamSlave *obj, unsigned char *buf, size_t len,
-                               uint32_t attr)
+xilinx_axidma_data_stream_push_iov(StreamSlave *obj, const struct iovec *iov,
+                                   int iovcnt, uint32_t attr)
 {
     XilinxAXIDMAStreamSlave *ds = XILINX_AXI_DMA_DATA_STREAM(obj);
     struct Stream *s = &ds->dma->streams[1];
     size_t ret;
 
-    ret = stream_process_s2mem(s, buf, len, attr);
+    ret = stream_process_s2mem(s, iov, iovcnt, attr);
     stream_update_irq(s);
     return ret;
 }
@@ -515,10 +748,8 @@ static void axidma_write(void *opaque, hwaddr addr,
             s->regs[addr] = value;
             break;
     }
-    if (sid == 1 && d->notify) {
-        StreamCanPushNotifyFn notifytmp = d->notify;
-        d->notify = NULL;
-        notifytmp(d->notify_opaque);
+    if (sid == 1) {
+        stream_ready(&d->rx_ready);
     }
     stream_update_irq(s);
 }
@@ -554,6 +785,8 @@ static void xilinx_axidma_realize(DeviceState *dev, Error **errp)
 
     for (i = 0; i < 2; i++) {
         s->streams[i].nr = i;
+        s->streams[i].dma = s;
+        qemu_sglist_init(&s->streams[i].sg, 8, &dma_context_memory);
         s->streams[i].bh = qemu_bh_new(timer_hit, &s->streams[i]);
         s->streams[i].ptimer = ptimer_init(s->streams[i].bh);
         ptimer_set_freq(s->streams[i].ptimer, s->freqhz);
@@ -612,7 +845,7 @@ static void axidma_class_init(ObjectClass *klass, void *data)
 }
 
 static StreamSlaveClass xilinx_axidma_data_stream_class = {
-    .push = xilinx_axidma_data_stream_push,
+    .push_iov = xilinx_axidma_data_stream_push_iov,
     .can_push = xilinx_axidma_data_stream_can_push,
 };
 
@@ -625,6 +858,7 @@ static void xilinx_axidma_stream_class_init(ObjectClass *klass, void *data)
     StreamSlaveClass *ssc = STREAM_SLAVE_CLASS(klass);
 
     ssc->push = ((StreamSlaveClass *)data)->push;
+    ssc->push_iov = ((StreamSlaveClass *)data)->push_iov;
     ssc->can_push = ((StreamSlaveClass *)data)->can_push;
 }
 
@@ -26,11 +26,10 @@
 #include "sysemu/dma.h"
 #include "hw/sysbus.h"
 #include "hw/ptimer.h"
+#include "hw/xilinx.h"
 #include "qemu/bitops.h"
 #include "exec/register.h"
-#include "qemu/bitops.h"
-
-#define TYPE_XILINX_DEVCFG "xlnx.ps7-dev-cfg"
+#include "sysemu/char.h"
 
 #define XILINX_DEVCFG(obj) \
     OBJECT_CHECK(XilinxDevcfg, (obj), TYPE_XILINX_DEVCFG)
@@ -43,7 +42,7 @@
 #define CYCLES_BTT_MAX 10000 /*approximate 10k cycles per delay interval */
 
 #ifndef XILINX_DEVCFG_ERR_DEBUG
-#define XILINX_DEVCFG_ERR_DEBUG 1
+#define XILINX_DEVCFG_ERR_DEBUG 0
 #endif
 #define DB_PRINT(...) do { \
     if (XILINX_DEVCFG_ERR_DEBUG) { \
@@ -181,6 +180,13 @@ typedef struct XilinxDevcfg {
     QEMUBH *timer_bh;
     ptimer_state *timer;
 
+    /* Complete DMA commands immediately instead of pacing them.  */
+    bool fast_dma;
+    /* Receivers of the data written to the PL through PCAP.  */
+    CharDriverState *chr;
+    XilinxDevcfgSink *sink;
+    void *sink_opaque;
+
     XilinxDevcfgDMACommand dma_command_fifo[DMA_COMMAND_FIFO_LEN];
     uint8_t dma_command_fifo_num;
 
@@ -220,43 +226,103 @@ static void xilinx_devcfg_reset(DeviceState *dev)
     }
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
-
-static void xilinx_devcfg_dma_go(void *opaque)
+/* Data leaving through PCAP, i.e towards the PL, when not looped back.  */
+static void xilinx_devcfg_pcap_write(XilinxDevcfg *s, const uint8_t *buf,
+                                     int len)
 {
-    XilinxDevcfg *s = opaque;
-    uint8_t buf[BTT_MAX];
-    XilinxDevcfgDMACommand *dmah = s->dma_command_fifo;
-    uint32_t btt = BTT_MAX;
+    if (s->chr) {
+        qemu_chr_fe_write_all(s->chr, buf, len);
+    }
+    if (s->sink) {
+        s->sink(s->sink_opaque, buf, len);
+    }
+}
 
-    btt = min(btt, dmah->src_len);
+static void xilinx_devcfg_dma_put(XilinxDevcfg *s,
+                                  XilinxDevcfgDMACommand *dmah,
+                                  const uint8_t *buf, uint32_t len)
+{
     if (s->regs[R_MCTRL] & INT_PCAP_LPBK) {
-        btt = min(btt, dmah->dest_len);
+        DB_PRINT("writing %x bytes to %x\n", len, dmah->dest_addr);
+        dma_memory_write(&dma_context_memory, dmah->dest_addr, buf, len);
+        dmah->dest_addr += len;
+    } else {
+        xilinx_devcfg_pcap_write(s, buf, len);
     }
+    dmah->dest_len -= MIN(len, dmah->dest_len);
+    dmah->src_addr += len;
+    dmah->src_len -= len;
+}
+
+/*
+ * Move btt bytes of the head command. The source is mapped and handed
+ * over directly, only memory that can't be mapped goes through a bounce
+ * buffer.
+ */
+static void xilinx_devcfg_dma_xfer(XilinxDevcfg *s,
+                                   XilinxDevcfgDMACommand *dmah, uint32_t btt)
+{
     DB_PRINT("reading %x bytes from %x\n", btt, dmah->src_addr);
-    dma_memory_read(&dma_context_memory, dmah->src_addr, buf, btt);
-    dmah->src_len -= btt;
-    dmah->src_addr += btt;
-    if (s->regs[R_MCTRL] & INT_PCAP_LPBK) {
-        DB_PRINT("writing %x bytes from %x\n", btt, dmah->dest_addr);
-        dma_memory_write(&dma_context_memory, dmah->dest_addr, buf, btt);
-        dmah->dest_len -= btt;
-        dmah->dest_addr += btt;
+    while (btt) {
+        dma_addr_t len = btt;
+        void *p;
+
+        p = dma_memory_map(&dma_context_memory, dmah->src_addr, &len,
+                           DMA_DIRECTION_TO_DEVICE);
+        if (p) {
+            xilinx_devcfg_dma_put(s, dmah, p, len);
+            dma_memory_unmap(&dma_context_memory, p, len,
+                             DMA_DIRECTION_TO_DEVICE, len);
+        } else {
+            uint8_t buf[BTT_MAX];
+
+            len = MIN(btt, BTT_MAX);
+            dma_memory_read(&dma_context_memory, dmah->src_addr, buf, len);
+            xilinx_devcfg_dma_put(s, dmah, buf, len);
+        }
+        btt -= len;
     }
-    if (!dmah->src_len && !dmah->dest_len) {
+}
+
+static void xilinx_devcfg_dma_go(void *opaque)
+{
+    XilinxDevcfg *s = opaque;
+
+    while (s->dma_command_fifo_num) {
+        XilinxDevcfgDMACommand *dmah = s->dma_command_fifo;
+        bool lpbk = s->regs[R_MCTRL] & INT_PCAP_LPBK;
+        uint32_t btt = dmah->src_len;
+
+        if (!s->fast_dma) {
+            btt = MIN(btt, BTT_MAX);
+        }
+        if (lpbk) {
+            btt = MIN(btt, dmah->dest_len);
+        }
+        xilinx_devcfg_dma_xfer(s, dmah, btt);
+
+        if (dmah->src_len && !(lpbk && !dmah->dest_len)) {
+            /* there is still work to do */
+            DB_PRINT("dma work remains, setting up callback ptimer\n");
+            ptimer_set_freq(s->timer, FREQ_HZ);
+            ptimer_set_count(s->timer, CYCLES_BTT_MAX);
+            ptimer_run(s->timer, 1);
+            break;
+        }
+
         DB_PRINT("dma operation finished\n");
         s->regs[R_INT_STS] |= DMA_DONE_INT | DMA_P_DONE_INT;
-        s->dma_command_fifo_num = s->dma_command_fifo_num - 1;
-        memcpy(s->dma_command_fifo, &s->dma_command_fifo[1],
-               sizeof(*s->dma_command_fifo) * DMA_COMMAND_FIFO_LEN - 1);
+        s->dma_command_fifo_num--;
+        memmove(s->dma_command_fifo, &s->dma_command_fifo[1],
+                sizeof(*s->dma_command_fifo) * s->dma_command_fifo_num);
+        if (!s->fast_dma && s->dma_command_fifo_num) {
+            ptimer_set_freq(s->timer, FREQ_HZ);
+            ptimer_set_count(s->timer, CYCLES_BTT_MAX);
+            ptimer_run(s->timer, 1);
+            break;
+        }
     }
     xilinx_devcfg_update_ixr(s);
-    if (s->dma_command_fifo_num) { /* there is still work to do */
-        DB_PRINT("dma work remains, setting up callback ptimer\n");
-        ptimer_set_freq(s->timer, FREQ_HZ);
-        ptimer_set_count(s->timer, CYCLES_BTT_MAX);
-        ptimer_run(s->timer, 1);
-    }
 }
 
 static void r_ixr_post_write(RegisterInfo *reg, uint64_t val)
@@ -326,7 +392,7 @@ static void r_dma_dst_len_post_write(RegisterInfo *reg, uint64_t val)
 }
 
 static const RegisterAccessInfo xilinx_devcfg_regs_info[] = {
-    [R_CTRL] = { .name = "CTRL",
+    { .name = "CTRL", .addr = R_CTRL * 4,
         .reset = PCAP_PR | PCAP_MODE | 0x3 << 13,
         /* flag this wo bit as ro to handle it separately */
         .ro = 0x107f6000,
@@ -348,8 +414,8 @@ static const RegisterAccessInfo xilinx_devcfg_regs_info[] = {
         .pre_write = r_ctrl_prewrite,
         .post_write = r_ctrl_post_write,
     },
-    [R_LOCK] = { .name = "LOCK", .ro = ~ONES(5), .nw0 = ~0 },
-    [R_CFG] = { .name = "CFG",
+    { .name = "LOCK", .addr = R_LOCK * 4, .ro = ~ONES(5), .nw0 = ~0 },
+    { .name = "CFG", .addr = R_CFG * 4,
         .reset = 1 << RFIFO_TH_SHIFT | 1 << WFIFO_TH_SHIFT | 0x8,
         .ge1 = (RegisterAccessError[]) {
             { .mask = 0x7, .reason = "Reserved - do not modify" },
@@ -361,18 +427,18 @@ static const RegisterAccessInfo xilinx_devcfg_regs_info[] = {
         },
         .ro = 0x00f | ~ONES(12),
     },
-    [R_INT_STS] = { .name = "INT_STS",
+    { .name = "INT_STS", .addr = R_INT_STS * 4,
         .w1c = ~R_INT_STS_RSVD,
         .reset = PSS_GTS_USR_B_INT | PSS_CFG_RESET_B_INT | WR_FIFO_LVL_INT,
         .ro = R_INT_STS_RSVD,
         .post_write = r_ixr_post_write,
     },
-    [R_INT_MASK] = { .name = "INT_MASK",
+    { .name = "INT_MASK", .addr = R_INT_MASK * 4,
         .reset = ~0,
         .ro = R_INT_STS_RSVD,
         .post_write = r_ixr_post_write,
     },
-    [R_STATUS] = { .name = "STATUS",
+    { .name = "STATUS", .addr = R_STATUS * 4,
         .reset = DMA_CMD_Q_E | PSS_GTS_USR_B | PSS_CFG_RESET_B,
         .ro = ~0,
         .ge1 = (RegisterAccessError[])  {
@@ -380,24 +446,24 @@ static const RegisterAccessInfo xilinx_devcfg_regs_info[] = {
             {},
         },
     },
-    [R_DMA_SRC_ADDR] = { .name = "DMA_SRC_ADDR" },
-    [R_DMA_DST_ADDR] = { .name = "DMA_DST_ADDR" },
-    [R_DMA_SRC_LEN] = { .name = "DMA_SRC_LEN", .ro = ~ONES(27) },
-    [R_DMA_DST_LEN] = { .name = "DMA_DST_LEN",
+    { .name = "DMA_SRC_ADDR", .addr = R_DMA_SRC_ADDR * 4 },
+    { .name = "DMA_DST_ADDR", .addr = R_DMA_DST_ADDR * 4 },
+    { .name = "DMA_SRC_LEN", .addr = R_DMA_SRC_LEN * 4, .ro = ~ONES(27) },
+    { .name = "DMA_DST_LEN", .addr = R_DMA_DST_LEN * 4,
         .ro = ~ONES(27),
         .post_write = r_dma_dst_len_post_write,
     },
-    [R_ROM_SHADOW] = { .name = "ROM_SHADOW",
+    { .name = "ROM_SHADOW", .addr = R_ROM_SHADOW * 4,
         .ge1 = (RegisterAccessError[])  {
             {.mask = ~0, .reason = "Reserved - do not modify" },
             {},
         },
     },
-    [R_SW_ID] = { .name = "SW_ID" },
-    [R_UNLOCK] = { .name = "UNLOCK",
+    { .name = "SW_ID", .addr = R_SW_ID * 4 },
+    { .name = "UNLOCK", .addr = R_UNLOCK * 4,
         .post_write = r_unlock_post_write,
     },
-    [R_MCTRL] = { .name = "MCTRL",
+    { .name = "MCTRL", .addr = R_MCTRL * 4,
         /* Silicon 3.0 for version field, and the mysterious reserved bit 23 */
         .reset = 0x2 << PS_VERSION_SHIFT | 1 << 23,
         /* some reserved bits are rw while others are ro */
@@ -412,12 +478,11 @@ static const RegisterAccessInfo xilinx_devcfg_regs_info[] = {
             {}
         },
     },
-    [R_MAX] = {}
 };
 
 static const MemoryRegionOps devcfg_reg_ops = {
-    .read = register_read_memory_le,
-    .write = register_write_memory_le,
+    .read = register_block_read_memory_le,
+    .write = register_block_write_memory_le,
     .endianness = DEVICE_LITTLE_ENDIAN,
     .valid = {
         .min_access_size = 4,
@@ -425,29 +490,27 @@ static const MemoryRegionOps devcfg_reg_ops = {
     }
 };
 
-static void xilinx_devcfg_realize(DeviceState *dev, Error **errp)
+void xilinx_devcfg_set_sink(DeviceState *dev, XilinxDevcfgSink *sink,
+                            void *opaque)
 {
     XilinxDevcfg *s = XILINX_DEVCFG(dev);
-    const char *prefix = object_get_canonical_path(OBJECT(dev));
-    int i;
 
-    for (i = 0; i < R_MAX; ++i) {
-        RegisterInfo *r = &s->regs_info[i];
+    s->sink = sink;
+    s->sink_opaque = opaque;
+}
 
-        *r = (RegisterInfo) {
-            .data = (uint8_t *)&s->regs[i],
-            .data_size = sizeof(uint32_t),
-#if defined(HOST_WORDS_BIGENDIAN)
-            .data_big_endian = true,
-#endif
-            .access = &xilinx_devcfg_regs_info[i],
-            .debug = XILINX_DEVCFG_ERR_DEBUG,
-            .prefix = prefix,
-            .opaque = s,
-        };
-        memory_region_init_io(&r->mem, &devcfg_reg_ops, r, "devcfg-regs", 4);
-        memory_region_add_subregion(&s->iomem, i * 4, &r->mem);
-    }
+static void xilinx_devcfg_realize(DeviceState *dev, Error **errp)
+{
+    XilinxDevcfg *s = XILINX_DEVCFG(dev);
+    const char *prefix = object_get_canonical_path(OBJECT(dev));
+    RegisterInfoArray *reg_array;
+
+    reg_array = register_init_block32(xilinx_devcfg_regs_info,
+                                      ARRAY_SIZE(xilinx_devcfg_regs_info),
+                                      s->regs_info, s->regs, &devcfg_reg_ops,
+                                      XILINX_DEVCFG_ERR_DEBUG, prefix, s,
+                                      R_MAX * 4);
+    memory_region_add_subregion(&s->iomem, 0, &reg_array->mem);
 }
 
 static void xilinx_devcfg_init(Object *obj)
@@ -464,6 +527,12 @@ static void xilinx_devcfg_init(Object *obj)
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
+static Property xilinx_devcfg_properties[] = {
+    DEFINE_PROP_BOOL("fast-dma", XilinxDevcfg, fast_dma, false),
+    DEFINE_PROP_CHR("chardev", XilinxDevcfg, chr),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void xilinx_devcfg_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -471,6 +540,7 @@ static void xilinx_devcfg_class_init(ObjectClass *klass, void *data)
     dc->reset = xilinx_devcfg_reset;
     dc->vmsd = &vmstate_xilinx_devcfg;
     dc->realize = xilinx_devcfg_realize;
+    dc->props = xilinx_devcfg_properties;
 }
 
 static const TypeInfo xilinx_devcfg_info = {
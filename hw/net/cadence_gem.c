@@ -28,6 +28,9 @@
 #include "net/net.h"
 #include "net/checksum.h"
 #include "qemu/bitops.h"
+#include "qemu/iov.h"
+#include "sysemu/dma.h"
+#include "exec/address-spaces.h"
 
 #ifdef CADENCE_GEM_ERR_DEBUG
 #define DB_PRINT(...) do { \
@@ -158,6 +161,7 @@
 #define GEM_NWCFG_MCAST_HASH   0x00000040 /* accept multicast if hash match */
 #define GEM_NWCFG_BCAST_REJ    0x00000020 /* Reject broadcast packets */
 #define GEM_NWCFG_PROMISC      0x00000010 /* Accept all packets */
+#define GEM_NWCFG_JUMBO_FRAME  0x00000008 /* Jumbo frames */
 
 #define GEM_DMACFG_RBUFSZ_M    0x007F0000 /* DMA RX Buffer Size mask */
 #define GEM_DMACFG_RBUFSZ_S    16         /* DMA RX Buffer Size shift */
@@ -235,6 +239,8 @@
 
 #define DESC_1_USED 0x80000000
 #define DESC_1_LENGTH 0x00001FFF
+/* RX frame length when jumbo frames are enabled, and TX buffer length.  */
+#define DESC_1_LENGTH_JUMBO 0x00003FFF
 
 #define DESC_1_TX_WRAP 0x40000000
 #define DESC_1_TX_LAST 0x00008000
@@ -279,7 +285,7 @@ static inline unsigned tx_desc_get_last(unsigned *desc)
 
 static inline unsigned tx_desc_get_length(unsigned *desc)
 {
-    return desc[1] & DESC_1_LENGTH;
+    return desc[1] & DESC_1_LENGTH_JUMBO;
 }
 
 static inline void print_gem_tx_desc(unsigned *desc)
@@ -322,10 +328,13 @@ static inline void rx_desc_set_eof(unsigned *desc)
     desc[1] |= DESC_1_RX_EOF;
 }
 
-static inline void rx_desc_set_length(unsigned *desc, unsigned len)
+static inline void rx_desc_set_length(unsigned *desc, unsigned len,
+                                      bool jumbo)
 {
-    desc[1] &= ~DESC_1_LENGTH;
-    desc[1] |= len;
+    unsigned mask = jumbo ? DESC_1_LENGTH_JUMBO : DESC_1_LENGTH;
+
+    desc[1] &= ~mask;
+    desc[1] |= len & mask;
 }
 
 static inline void rx_desc_set_broadcast(unsigned *desc)
@@ -350,6 +359,21 @@ static inline void rx_desc_set_sar(unsigned *desc, int sar_idx)
     desc[1] |= R_DESC_1_RX_SAR_MATCH;
 }
 
+/* How much of a descriptor ring is mapped, from its base on.  */
+#define GEM_RING_MAP_SIZE 0x10000
+
+/*
+ * A descriptor ring in RAM, mapped on first use after its base register was
+ * written. host is NULL if the ring is not in plain RAM.
+ */
+typedef struct GemRing {
+    int base_reg;
+    bool mapped;
+    hwaddr base;
+    uint8_t *host;
+    hwaddr len;
+} GemRing;
+
 typedef struct {
     SysBusDevice busdev;
     MemoryRegion iomem;
@@ -382,11 +406,89 @@ typedef struct {
     unsigned rx_desc[2];
 
     bool sar_active[4];
+
+    GemRing rx_ring;
+    GemRing tx_ring;
+    /* Drops the ring mappings when the memory map changes.  */
+    MemoryListener ring_listener;
+
+    /* Fragments of the packet being transmitted. Fragments that could not
+       be mapped have a NULL iov_base and are read from tx_frag_addr.  */
+    struct iovec *tx_iov;
+    hwaddr *tx_frag_addr;
+    int tx_frag_alloc;
+    /* Linear copy for checksum offload, loopback and unmapped fragments.  */
+    uint8_t *tx_packet;
+    unsigned tx_packet_size;
 } GemState;
 
 /* The broadcast MAC address: 0xFFFFFFFFFFFF */
 const uint8_t broadcast_addr[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
+/*
+ * gem_ring_map:
+ * Look up the host pointer of a descriptor ring. Only plain RAM is mapped,
+ * rings in TLMu RAMD or I/O regions go through the slow path.
+ */
+static void gem_ring_map(GemState *s, GemRing *r)
+{
+    MemoryRegionSection section;
+
+    r->base = s->regs[r->base_reg];
+    r->host = NULL;
+    r->len = 0;
+    r->mapped = true;
+
+    section = memory_region_find(get_system_memory(), r->base,
+                                 GEM_RING_MAP_SIZE);
+    if (section.mr && section.offset_within_address_space == r->base
+        && memory_region_is_ram(section.mr)
+        && !memory_region_is_tlmu_ramd(section.mr)) {
+        r->host = memory_region_get_ram_ptr(section.mr)
+                  + section.offset_within_region;
+        r->len = section.size;
+    }
+    DB_PRINT("ring at 0x%x: %p len 0x%x\n", (unsigned)r->base, r->host,
+             (unsigned)r->len);
+}
+
+static inline void gem_ring_invalidate(GemRing *r)
+{
+    r->mapped = false;
+}
+
+static void gem_ring_listener_begin(MemoryListener *listener)
+{
+    GemState *s = container_of(listener, GemState, ring_listener);
+
+    gem_ring_invalidate(&s->rx_ring);
+    gem_ring_invalidate(&s->tx_ring);
+}
+
+/*
+ * Descriptors of a mapped ring are read straight from RAM. Write backs go
+ * through the normal path so that dirty tracking and translated code stay
+ * right, the mapping sees them as it points to the same RAM.
+ */
+static inline void gem_desc_read(GemState *s, GemRing *r, hwaddr addr,
+                                 unsigned *desc)
+{
+    if (!r->mapped) {
+        gem_ring_map(s, r);
+    }
+    if (r->host && addr >= r->base
+        && addr - r->base + sizeof(unsigned) * 2 <= r->len) {
+        memcpy(desc, r->host + (addr - r->base), sizeof(unsigned) * 2);
+        return;
+    }
+    cpu_physical_memory_read(addr, (uint8_t *)desc, sizeof(unsigned) * 2);
+}
+
+static inline void gem_desc_write(hwaddr addr, unsigned *desc)
+{
+    cpu_physical_memory_write(addr, (uint8_t *)desc, sizeof(unsigned) * 2);
+}
+
 /*
  * gem_init_register_masks:
  * One time initialization.
@@ -460,6 +562,12 @@ static int gem_can_receive(NetClientState *nc)
         return 0;
     }
 
+    if (rx_desc_get_ownership(s->rx_desc) == 1) {
+        /* Software hands descriptors back without telling us, look again
+           so the net layer can keep delivering queued packets.  */
+        gem_desc_read(s, &s->rx_ring, s->rx_desc_addr, s->rx_desc);
+    }
+
     if (rx_desc_get_ownership(s->rx_desc) == 1) {
         if (s->can_rx_state != 2) {
             s->can_rx_state = 2;
@@ -637,8 +745,7 @@ static void gem_get_rx_desc(GemState *s)
 {
     DB_PRINT("read descriptor 0x%x\n", (unsigned)s->rx_desc_addr);
     /* read current descriptor */
-    cpu_physical_memory_read(s->rx_desc_addr,
-                             (uint8_t *)s->rx_desc, sizeof(s->rx_desc));
+    gem_desc_read(s, &s->rx_ring, s->rx_desc_addr, s->rx_desc);
 
     /* Descriptor owned by software ? */
     if (rx_desc_get_ownership(s->rx_desc) == 1) {
@@ -651,6 +758,47 @@ static void gem_get_rx_desc(GemState *s)
     }
 }
 
+static void gem_write_rx_buffer_done(void *opaque, int ret)
+{
+    g_free(opaque);
+}
+
+/*
+ * gem_write_rx_buffer:
+ * Copy len bytes at offset of the packet into an RX buffer, directly if
+ * the buffer is in RAM. Other memories are written without waiting for
+ * them, the descriptor write back is ordered after the data.
+ */
+static void gem_write_rx_buffer(hwaddr addr, const struct iovec *iov,
+                                int iovcnt, size_t offset, unsigned len)
+{
+    dma_addr_t maplen = len;
+    ram_addr_t ram_addr;
+    QEMUSGList sg;
+    uint8_t *p;
+
+    p = dma_memory_map(&dma_context_memory, addr, &maplen,
+                       DMA_DIRECTION_FROM_DEVICE);
+    if (p && maplen == len && !qemu_ram_addr_from_host(p, &ram_addr)) {
+        iov_to_buf(iov, iovcnt, offset, p, len);
+        dma_memory_unmap(&dma_context_memory, p, maplen,
+                         DMA_DIRECTION_FROM_DEVICE, len);
+        return;
+    }
+    if (p) {
+        dma_memory_unmap(&dma_context_memory, p, maplen,
+                         DMA_DIRECTION_FROM_DEVICE, 0);
+    }
+
+    p = g_malloc(len);
+    iov_to_buf(iov, iovcnt, offset, p, len);
+
+    qemu_sglist_init(&sg, 1, &dma_context_memory);
+    qemu_sglist_add(&sg, addr, len);
+    dma_buf_read_async(p, len, &sg, gem_write_rx_buffer_done, p);
+    qemu_sglist_destroy(&sg);
+}
+
 /*
  * gem_receive:
  * Fit a packet handed to us by QEMU into the receive descriptor ring.
@@ -658,10 +806,13 @@ static void gem_get_rx_desc(GemState *s)
 static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     GemState *s;
-    unsigned   rxbufsize, bytes_to_copy;
+    static const uint8_t pad[60];
+    unsigned   rxbufsize, bytes_to_copy, chunk;
     unsigned   rxbuf_offset;
-    uint8_t    rxbuf[2048];
-    uint8_t   *rxbuf_ptr;
+    struct iovec iov[3];
+    int        iovcnt = 1;
+    uint32_t   crc_val;
+    size_t     offset = 0;
     bool first_desc = true;
     int maf;
 
@@ -701,6 +852,12 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
                  GEM_DMACFG_RBUFSZ_S) * GEM_DMACFG_RBUFSZ_MUL;
     bytes_to_copy = size;
 
+    /* The packet is copied straight from buf, the padding and FCS come
+     * from separate iovec entries.
+     */
+    iov[0].iov_base = (uint8_t *)buf;
+    iov[0].iov_len = size;
+
     /* Pad to minimum length. Assume FCS field is stripped, logic
      * below will increment it to the real minimum of 64 when
      * not FCS stripping
@@ -710,29 +867,24 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
     }
 
     /* Strip of FCS field ? (usually yes) */
-    if (s->regs[GEM_NWCFG] & GEM_NWCFG_STRIP_FCS) {
-        rxbuf_ptr = (void *)buf;
-    } else {
-        unsigned crc_val;
-        int      crc_offset;
-
+    if (!(s->regs[GEM_NWCFG] & GEM_NWCFG_STRIP_FCS)) {
         /* The application wants the FCS field, which QEMU does not provide.
          * We must try and caclculate one.
          */
-
-        memcpy(rxbuf, buf, size);
-        memset(rxbuf + size, 0, sizeof(rxbuf) - size);
-        rxbuf_ptr = rxbuf;
-        crc_val = cpu_to_le32(crc32(0, rxbuf, MAX(size, 60)));
-        if (size < 60) {
-            crc_offset = 60;
-        } else {
-            crc_offset = size;
+        crc_val = crc32(0, buf, bytes_to_copy);
+        if (bytes_to_copy < size) {
+            iov[iovcnt].iov_base = (uint8_t *)pad;
+            iov[iovcnt].iov_len = size - bytes_to_copy;
+            crc_val = crc32(crc_val, pad, size - bytes_to_copy);
+            iovcnt++;
         }
-        memcpy(rxbuf + crc_offset, &crc_val, sizeof(crc_val));
+        crc_val = cpu_to_le32(crc_val);
+        iov[iovcnt].iov_base = &crc_val;
+        iov[iovcnt].iov_len = sizeof(crc_val);
+        iovcnt++;
 
-        bytes_to_copy += 4;
         size += 4;
+        bytes_to_copy = size;
     }
 
     DB_PRINT("config bufsize: %d packet size: %ld\n", rxbufsize, size);
@@ -744,14 +896,15 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
             return -1;
         }
 
-        DB_PRINT("copy %d bytes to 0x%x\n", MIN(bytes_to_copy, rxbufsize),
+        chunk = MIN(bytes_to_copy, rxbufsize);
+        DB_PRINT("copy %d bytes to 0x%x\n", chunk,
                 rx_desc_get_buffer(s->rx_desc));
 
         /* Copy packet data to emulated DMA buffer */
-        cpu_physical_memory_write(rx_desc_get_buffer(s->rx_desc) + rxbuf_offset,
-                                  rxbuf_ptr, MIN(bytes_to_copy, rxbufsize));
-        rxbuf_ptr += MIN(bytes_to_copy, rxbufsize);
-        bytes_to_copy -= MIN(bytes_to_copy, rxbufsize);
+        gem_write_rx_buffer(rx_desc_get_buffer(s->rx_desc) + rxbuf_offset,
+                            iov, iovcnt, offset, chunk);
+        offset += chunk;
+        bytes_to_copy -= chunk;
 
         /* Update the descriptor.  */
         if (first_desc) {
@@ -760,7 +913,8 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         }
         if (bytes_to_copy == 0) {
             rx_desc_set_eof(s->rx_desc);
-            rx_desc_set_length(s->rx_desc, size);
+            rx_desc_set_length(s->rx_desc, size,
+                               s->regs[GEM_NWCFG] & GEM_NWCFG_JUMBO_FRAME);
         }
         rx_desc_set_ownership(s->rx_desc);
 
@@ -783,8 +937,7 @@ static ssize_t gem_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         }
 
         /* Descriptor write-back.  */
-        cpu_physical_memory_write(s->rx_desc_addr,
-                                  (uint8_t *)s->rx_desc, sizeof(s->rx_desc));
+        gem_desc_write(s->rx_desc_addr, s->rx_desc);
 
         /* Next descriptor */
         if (rx_desc_get_wrap(s->rx_desc)) {
@@ -855,6 +1008,73 @@ static void gem_transmit_updatestats(GemState *s, const uint8_t *packet,
     }
 }
 
+/*
+ * gem_tx_add_frag:
+ * Map a fragment of the packet being transmitted.
+ */
+static void gem_tx_add_frag(GemState *s, int nr, hwaddr addr, unsigned len)
+{
+    dma_addr_t maplen = len;
+    void *p;
+
+    if (nr == s->tx_frag_alloc) {
+        s->tx_frag_alloc = MAX(8, s->tx_frag_alloc * 2);
+        s->tx_iov = g_renew(struct iovec, s->tx_iov, s->tx_frag_alloc);
+        s->tx_frag_addr = g_renew(hwaddr, s->tx_frag_addr, s->tx_frag_alloc);
+    }
+
+    p = dma_memory_map(&dma_context_memory, addr, &maplen,
+                       DMA_DIRECTION_TO_DEVICE);
+    if (p && maplen < len) {
+        dma_memory_unmap(&dma_context_memory, p, maplen,
+                         DMA_DIRECTION_TO_DEVICE, 0);
+        p = NULL;
+    }
+    s->tx_iov[nr].iov_base = p;
+    s->tx_iov[nr].iov_len = len;
+    s->tx_frag_addr[nr] = addr;
+}
+
+/*
+ * gem_tx_linearize:
+ * Gather the fragments into the contiguous tx_packet buffer.
+ */
+static uint8_t *gem_tx_linearize(GemState *s, int nr_frags, unsigned size)
+{
+    uint8_t *p;
+    int i;
+
+    if (s->tx_packet_size < size) {
+        s->tx_packet_size = size;
+        s->tx_packet = g_realloc(s->tx_packet, size);
+    }
+
+    p = s->tx_packet;
+    for (i = 0; i < nr_frags; i++) {
+        if (s->tx_iov[i].iov_base) {
+            memcpy(p, s->tx_iov[i].iov_base, s->tx_iov[i].iov_len);
+        } else {
+            cpu_physical_memory_read(s->tx_frag_addr[i], p,
+                                     s->tx_iov[i].iov_len);
+        }
+        p += s->tx_iov[i].iov_len;
+    }
+    return s->tx_packet;
+}
+
+static void gem_tx_unmap(GemState *s, int nr_frags)
+{
+    int i;
+
+    for (i = 0; i < nr_frags; i++) {
+        if (s->tx_iov[i].iov_base) {
+            dma_memory_unmap(&dma_context_memory, s->tx_iov[i].iov_base,
+                             s->tx_iov[i].iov_len, DMA_DIRECTION_TO_DEVICE,
+                             s->tx_iov[i].iov_len);
+        }
+    }
+}
+
 /*
  * gem_transmit:
  * Fish packets out of the descriptor ring and feed them to QEMU
@@ -863,9 +1083,9 @@ static void gem_transmit(GemState *s)
 {
     unsigned    desc[2];
     hwaddr packet_desc_addr;
-    uint8_t     tx_packet[2048];
-    uint8_t     *p;
     unsigned    total_bytes;
+    int         nr_frags;
+    bool        linear;
 
     /* Do nothing if transmit is not enabled. */
     if (!(s->regs[GEM_NWCTRL] & GEM_NWCTRL_TXENA)) {
@@ -875,23 +1095,25 @@ static void gem_transmit(GemState *s)
     DB_PRINT("\n");
 
     /* The packet we will hand off to qemu.
-     * Packets scattered across multiple descriptors are gathered to this
-     * one contiguous buffer first.
+     * Packets scattered across multiple descriptors are handed over as
+     * an iovec of the mapped fragments. They are only gathered into one
+     * contiguous buffer when something needs to look at or modify them.
      */
-    p = tx_packet;
+    nr_frags = 0;
     total_bytes = 0;
+    linear = false;
 
     /* read current descriptor */
     packet_desc_addr = s->tx_desc_addr;
 
     DB_PRINT("Reading descriptor from %x\n", (unsigned)packet_desc_addr);
-    cpu_physical_memory_read(packet_desc_addr,
-                             (uint8_t *)&desc[0], sizeof(desc));
+    gem_desc_read(s, &s->tx_ring, packet_desc_addr, desc);
     /* Handle all descriptors owned by hardware */
     while (tx_desc_get_used(desc) == 0) {
 
         /* Do nothing if transmit is not enabled. */
         if (!(s->regs[GEM_NWCTRL] & GEM_NWCTRL_TXENA)) {
+            gem_tx_unmap(s, nr_frags);
             return;
         }
         print_gem_tx_desc(desc);
@@ -906,26 +1128,57 @@ static void gem_transmit(GemState *s)
             break;
         }
 
-        /* Gather this fragment of the packet from "dma memory" to our contig.
-         * buffer.
-         */
-        cpu_physical_memory_read(tx_desc_get_buffer(desc), p,
-                                 tx_desc_get_length(desc));
-        p += tx_desc_get_length(desc);
+        /* Add this fragment of the packet.  */
+        gem_tx_add_frag(s, nr_frags, tx_desc_get_buffer(desc),
+                        tx_desc_get_length(desc));
+        if (!s->tx_iov[nr_frags].iov_base) {
+            linear = true;
+        }
+        nr_frags++;
         total_bytes += tx_desc_get_length(desc);
 
         /* Last descriptor for this packet; hand the whole thing off */
         if (tx_desc_get_last(desc)) {
             unsigned    desc_first[2];
+            uint8_t     hdr[6] = { 0 };
+            uint8_t     *packet = NULL;
+
+            if (linear || (s->regs[GEM_DMACFG] & GEM_DMACFG_TXCSUM_OFFL) ||
+                s->phy_loop || (s->regs[GEM_NWCTRL] & GEM_NWCTRL_LOCALLOOP)) {
+                packet = gem_tx_linearize(s, nr_frags, total_bytes);
+            }
+
+            /* Is checksum offload enabled? */
+            if (s->regs[GEM_DMACFG] & GEM_DMACFG_TXCSUM_OFFL) {
+                net_checksum_calculate(packet, total_bytes);
+            }
+
+            /* Update MAC statistics */
+            if (packet) {
+                gem_transmit_updatestats(s, packet, total_bytes);
+            } else {
+                iov_to_buf(s->tx_iov, nr_frags, 0, hdr, sizeof(hdr));
+                gem_transmit_updatestats(s, hdr, total_bytes);
+            }
+
+            /* Send the packet somewhere */
+            if (s->phy_loop || (s->regs[GEM_NWCTRL] & GEM_NWCTRL_LOCALLOOP)) {
+                gem_receive(qemu_get_queue(s->nic), packet, total_bytes);
+            } else if (packet) {
+                qemu_send_packet(qemu_get_queue(s->nic), packet,
+                                 total_bytes);
+            } else {
+                qemu_sendv_packet(qemu_get_queue(s->nic), s->tx_iov,
+                                  nr_frags);
+            }
+            gem_tx_unmap(s, nr_frags);
 
             /* Modify the 1st descriptor of this packet to be owned by
              * the processor.
              */
-            cpu_physical_memory_read(s->tx_desc_addr,
-                                     (uint8_t *)&desc_first[0], sizeof(desc));
+            gem_desc_read(s, &s->tx_ring, s->tx_desc_addr, desc_first);
             tx_desc_set_used(desc_first);
-            cpu_physical_memory_write(s->tx_desc_addr,
-                                      (uint8_t *)&desc_first[0], sizeof(desc));
+            gem_desc_write(s->tx_desc_addr, desc_first);
             /* Advance the hardare current descriptor past this packet */
             if (tx_desc_get_wrap(desc)) {
                 s->tx_desc_addr = s->regs[GEM_TXQBASE];
@@ -940,25 +1193,10 @@ static void gem_transmit(GemState *s)
             /* Handle interrupt consequences */
             gem_update_int_status(s);
 
-            /* Is checksum offload enabled? */
-            if (s->regs[GEM_DMACFG] & GEM_DMACFG_TXCSUM_OFFL) {
-                net_checksum_calculate(tx_packet, total_bytes);
-            }
-
-            /* Update MAC statistics */
-            gem_transmit_updatestats(s, tx_packet, total_bytes);
-
-            /* Send the packet somewhere */
-            if (s->phy_loop || (s->regs[GEM_NWCTRL] & GEM_NWCTRL_LOCALLOOP)) {
-                gem_receive(qemu_get_queue(s->nic), tx_packet, total_bytes);
-            } else {
-                qemu_send_packet(qemu_get_queue(s->nic), tx_packet,
-                                 total_bytes);
-            }
-
             /* Prepare for next packet */
-            p = tx_packet;
+            nr_frags = 0;
             total_bytes = 0;
+            linear = false;
         }
 
         /* read next descriptor */
@@ -968,9 +1206,9 @@ static void gem_transmit(GemState *s)
             packet_desc_addr += 8;
         }
         DB_PRINT("Reading descriptor from %x\n", (unsigned)packet_desc_addr);
-        cpu_physical_memory_read(packet_desc_addr,
-                                 (uint8_t *)&desc[0], sizeof(desc));
+        gem_desc_read(s, &s->tx_ring, packet_desc_addr, desc);
     }
+    gem_tx_unmap(s, nr_frags);
 
     if (tx_desc_get_used(desc)) {
         s->regs[GEM_TXSTATUS] |= GEM_TXSTATUS_USED;
@@ -1030,6 +1268,9 @@ static void gem_reset(DeviceState *d)
         s->sar_active[i] = false;
     }
 
+    gem_ring_invalidate(&s->rx_ring);
+    gem_ring_invalidate(&s->tx_ring);
+
     gem_phy_reset(s);
 
     gem_update_int_status(s);
@@ -1163,9 +1404,11 @@ static void gem_write(void *opaque, hwaddr offset, uint64_t val,
         break;
     case GEM_RXQBASE:
         s->rx_desc_addr = val;
+        gem_ring_invalidate(&s->rx_ring);
         break;
     case GEM_TXQBASE:
         s->tx_desc_addr = val;
+        gem_ring_invalidate(&s->tx_ring);
         break;
     case GEM_RXSTATUS:
         gem_update_int_status(s);
@@ -1251,6 +1494,13 @@ static int gem_init(SysBusDevice *dev)
     s->nic = qemu_new_nic(&net_gem_info, &s->conf,
             object_get_typename(OBJECT(dev)), dev->qdev.id, s);
 
+    s->rx_ring.base_reg = GEM_RXQBASE;
+    s->tx_ring.base_reg = GEM_TXQBASE;
+    s->ring_listener = (MemoryListener) {
+        .begin = gem_ring_listener_begin,
+    };
+    memory_listener_register(&s->ring_listener, &address_space_memory);
+
     return 0;
 }
 
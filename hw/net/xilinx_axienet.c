@@ -26,6 +26,7 @@
 #include "qemu/log.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "qemu/iov.h"
 #include "qapi/qmp/qerror.h"
 
 #include "hw/stream.h"
@@ -714,6 +715,10 @@ static ssize_t eth_rx(NetClientState *nc, const uint8_t *buf, size_t size)
     static const unsigned char sa_bcast[6] = {0xff, 0xff, 0xff,
                                               0xff, 0xff, 0xff};
     static const unsigned char sa_ipmcast[3] = {0x01, 0x00, 0x52};
+    static const uint8_t fcs[4];
+    struct iovec iov[2];
+    int iovcnt = 1;
+    size_t pushed = 0;
     uint32_t app[CONTROL_PAYLOAD_WORDS] = {0};
     int promisc = s->fmi & (1 << 31);
     int unicast, broadcast, multicast, ip_multicast = 0;
@@ -816,15 +821,19 @@ static ssize_t eth_rx(NetClientState *nc, const uint8_t *buf, size_t size)
         size = s->c_rxmem - 4;
     }
 
-    memcpy(s->rxmem, buf, size);
-    memset(s->rxmem + size, 0, 4); /* Clear the FCS.  */
+    iov[0].iov_base = (uint8_t *)buf;
+    iov[0].iov_len = size;
+    csum32 = net_checksum_add(size - 14, (uint8_t *)buf + 14);
 
     if (s->rcw[1] & RCW1_FCS) {
-        size += 4; /* fcs is inband.  */
+        /* fcs is inband, and cleared.  */
+        iov[1].iov_base = (uint8_t *)fcs;
+        iov[1].iov_len = sizeof fcs;
+        iovcnt = 2;
+        size += sizeof fcs;
     }
 
     app[0] = 5 << 28;
-    csum32 = net_checksum_add(size - 14, (uint8_t *)s->rxmem + 14);
     /* Fold it once.  */
     csum32 = (csum32 & 0xffff) + (csum32 >> 16);
     /* And twice to get rid of possible carries.  */
@@ -845,8 +854,6 @@ static ssize_t eth_rx(NetClientState *nc, const uint8_t *buf, size_t size)
     /* Good frame.  */
     app[2] |= 1 << 6;
 
-    s->rxsize = size;
-    s->rxpos = 0;
     for (i = 0; i < ARRAY_SIZE(app); ++i) {
         app[i] = cpu_to_le32(app[i]);
     }
@@ -854,6 +861,21 @@ static ssize_t eth_rx(NetClientState *nc, const uint8_t *buf, size_t size)
     memcpy(s->rxapp, app, s->rxappsize);
     axienet_eth_rx_notify(s);
 
+    /* Hand the frame to the DMA straight from buf, only what it does not
+       take right away is kept in rxmem.  */
+    if (!s->rxappsize && stream_can_push(s->tx_data_dev,
+                                         axienet_eth_rx_notify, s)) {
+        pushed = stream_push_iov(s->tx_data_dev, iov, iovcnt, STREAM_ATTR_EOP);
+    }
+    s->rxsize = size - pushed;
+    s->rxpos = 0;
+    iov_to_buf(iov, iovcnt, pushed, s->rxmem, s->rxsize);
+    if (s->rxsize) {
+        axienet_eth_rx_notify(s);
+    } else {
+        s->regs[R_IS] |= IS_RX_COMPLETE;
+    }
+
     enet_update_irq(s);
     return size;
 }
@@ -888,11 +910,14 @@ xilinx_axienet_control_stream_push(StreamSlave *obj, uint8_t *buf, size_t len,
 }
 
 static size_t
-xilinx_axienet_data_stream_push(StreamSlave *obj, uint8_t *buf, size_t size,
-                                uint32_t attr)
+xilinx_axienet_data_stream_push_iov(StreamSlave *obj, const struct iovec *iov,
+                                    int iovcnt, uint32_t attr)
 {
     XilinxAXIEnetStreamSlave *ds = XILINX_AXI_ENET_DATA_STREAM(obj);
     XilinxAXIEnet *s = ds->enet;
+    size_t size = iov_size(iov, iovcnt);
+    struct iovec *txiov = NULL;
+    uint8_t csum[2];
 
     /* FIXME. buffer if not EOP. Or add a better scatter-gathering +
        zero copying flow to the stream if.  */
@@ -916,22 +941,34 @@ xilinx_axienet_data_stream_push(StreamSlave *obj, uint8_t *buf, size_t size,
         unsigned int start_off = s->hdr[1] >> 16;
         unsigned int write_off = s->hdr[1] & 0xffff;
         uint32_t tmp_csum;
-        uint16_t csum;
+        int n;
 
-        tmp_csum = net_checksum_add(size - start_off,
-                                    (uint8_t *)buf + start_off);
+        tmp_csum = net_checksum_add_iov(iov, iovcnt, start_off,
+                                        size - start_off);
         /* Accumulate the seed.  */
         tmp_csum += s->hdr[2] & 0xffff;
 
         /* Fold the 32bit partial checksum.  */
-        csum = net_checksum_finish(tmp_csum);
-
-        /* Writeback.  */
-        buf[write_off] = csum >> 8;
-        buf[write_off + 1] = csum & 0xff;
+        stw_be_p(csum, net_checksum_finish(tmp_csum));
+
+        /* The frame may be the guests TX buffers, splice the checksum in
+           rather than writing it back.  */
+        if (write_off + sizeof csum <= size) {
+            txiov = g_new(struct iovec, 2 * iovcnt + 1);
+            n = iov_copy(txiov, iovcnt, iov, iovcnt, 0, write_off);
+            txiov[n].iov_base = csum;
+            txiov[n].iov_len = sizeof csum;
+            n++;
+            n += iov_copy(txiov + n, iovcnt, iov, iovcnt,
+                          write_off + sizeof csum,
+                          size - write_off - sizeof csum);
+            iov = txiov;
+            iovcnt = n;
+        }
     }
 
-    qemu_send_packet(qemu_get_queue(s->nic), buf, size);
+    qemu_sendv_packet(qemu_get_queue(s->nic), iov, iovcnt);
+    g_free(txiov);
 
     s->stats.tx_bytes += size;
     s->regs[R_IS] |= IS_TX_COMPLETE;
@@ -1034,11 +1071,20 @@ static void xilinx_enet_class_init(ObjectClass *klass, void *data)
     dc->reset = xilinx_axienet_reset;
 }
 
+static StreamSlaveClass xilinx_enet_data_stream_class = {
+    .push_iov = xilinx_axienet_data_stream_push_iov,
+};
+
+static StreamSlaveClass xilinx_enet_control_stream_class = {
+    .push = xilinx_axienet_control_stream_push,
+};
+
 static void xilinx_enet_stream_class_init(ObjectClass *klass, void *data)
 {
     StreamSlaveClass *ssc = STREAM_SLAVE_CLASS(klass);
 
-    ssc->push = data;
+    ssc->push = ((StreamSlaveClass *)data)->push;
+    ssc->push_iov = ((StreamSlaveClass *)data)->push_iov;
 }
 
 static const TypeInfo xilinx_enet_info = {
@@ -1054,7 +1100,7 @@ static const TypeInfo xilinx_enet_data_stream_info = {
     .parent        = TYPE_OBJECT,
     .instance_size = sizeof(struct XilinxAXIEnetStreamSlave),
     .class_init    = xilinx_enet_stream_class_init,
-    .class_data    = xilinx_axienet_data_stream_push,
+    .class_data    = &xilinx_enet_data_stream_class,
     .interfaces = (InterfaceInfo[]) {
             { TYPE_STREAM_SLAVE },
             { }
@@ -1066,7 +1112,7 @@ static const TypeInfo xilinx_enet_control_stream_info = {
     .parent        = TYPE_OBJECT,
     .instance_size = sizeof(struct XilinxAXIEnetStreamSlave),
     .class_init    = xilinx_enet_stream_class_init,
-    .class_data    = xilinx_axienet_control_stream_push,
+    .class_data    = &xilinx_enet_control_stream_class,
     .interfaces = (InterfaceInfo[]) {
             { TYPE_STREAM_SLAVE },
             { }
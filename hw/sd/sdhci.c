@@ -581,6 +581,42 @@ typedef struct ADMADescr {
     uint8_t incr;
 } ADMADescr;
 
+static void sdhci_adma_write_done(void *opaque, int ret)
+{
+    g_free(opaque);
+}
+
+/*
+ * Card data is written to RAM directly, other memories are written without
+ * waiting for them. Accesses made after this one are ordered after it.
+ */
+static void sdhci_adma_write(hwaddr addr, const uint8_t *buf, unsigned len)
+{
+    dma_addr_t maplen = len;
+    ram_addr_t ram_addr;
+    QEMUSGList sg;
+    uint8_t *data;
+
+    data = dma_memory_map(&dma_context_memory, addr, &maplen,
+                          DMA_DIRECTION_FROM_DEVICE);
+    if (data) {
+        if (maplen == len && !qemu_ram_addr_from_host(data, &ram_addr)) {
+            memcpy(data, buf, len);
+            dma_memory_unmap(&dma_context_memory, data, maplen,
+                             DMA_DIRECTION_FROM_DEVICE, len);
+            return;
+        }
+        dma_memory_unmap(&dma_context_memory, data, maplen,
+                         DMA_DIRECTION_FROM_DEVICE, 0);
+    }
+
+    data = g_memdup(buf, len);
+    qemu_sglist_init(&sg, 1, &dma_context_memory);
+    qemu_sglist_add(&sg, addr, len);
+    dma_buf_read_async(data, len, &sg, sdhci_adma_write_done, data);
+    qemu_sglist_destroy(&sg);
+}
+
 static void get_adma_description(SDHCIState *s, ADMADescr *dscr)
 {
     uint32_t adma1 = 0;
@@ -678,8 +714,7 @@ static void sdhci_do_adma(SDHCIState *s)
                         s->data_count = block_size;
                         length -= block_size - begin;
                     }
-                    dma_memory_write(&dma_context_memory, dscr.addr,
-                                     &s->fifo_buffer[begin],
+                    sdhci_adma_write(dscr.addr, &s->fifo_buffer[begin],
                                      s->data_count - begin);
                     dscr.addr += s->data_count - begin;
                     if (s->data_count == block_size) {
@@ -41,13 +41,18 @@ static void ssi_cs_default(void *opaque, int n, int level)
     s->cs = cs;
 }
 
+static bool ssi_slave_selected(SSISlave *dev, SSISlaveClass *ssc)
+{
+    return (dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
+           (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
+           ssc->cs_polarity == SSI_CS_NONE;
+}
+
 static uint32_t ssi_transfer_raw_default(SSISlave *dev, uint32_t val)
 {
     SSISlaveClass *ssc = SSI_SLAVE_GET_CLASS(dev);
 
-    if ((dev->cs && ssc->cs_polarity == SSI_CS_HIGH) ||
-            (!dev->cs && ssc->cs_polarity == SSI_CS_LOW) ||
-            ssc->cs_polarity == SSI_CS_NONE) {
+    if (ssi_slave_selected(dev, ssc)) {
         return ssc->transfer(dev, val);
     }
     return 0;
@@ -121,6 +126,58 @@ uint32_t ssi_transfer(SSIBus *bus, uint32_t val)
     return r;
 }
 
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx, int len)
+{
+    BusChild *kid;
+    SSISlaveClass *ssc;
+    uint8_t buf[256];
+    int i, done, n;
+
+    memset(rx, 0, len);
+    QTAILQ_FOREACH(kid, &bus->qbus.children, sibling) {
+        SSISlave *slave = SSI_SLAVE(kid->child);
+        ssc = SSI_SLAVE_GET_CLASS(slave);
+
+        if (!ssc->transfer_bulk
+            || ssc->transfer_raw != ssi_transfer_raw_default) {
+            for (i = 0; i < len; i++) {
+                rx[i] |= ssc->transfer_raw(slave, tx[i]);
+            }
+            continue;
+        }
+        if (!ssi_slave_selected(slave, ssc)) {
+            continue;
+        }
+        for (done = 0; done < len; done += n) {
+            n = MIN(len - done, sizeof buf);
+            ssc->transfer_bulk(slave, tx + done, buf, n);
+            for (i = 0; i < n; i++) {
+                rx[done + i] |= buf[i];
+            }
+        }
+    }
+}
+
+uint8_t *ssi_get_xip_storage(SSIBus *bus, uint8_t cmd, int hdr_bytes,
+                             uint64_t *size, uint32_t *gen)
+{
+    BusChild *kid;
+    SSISlave *slave;
+    SSISlaveClass *ssc;
+
+    kid = QTAILQ_FIRST(&bus->qbus.children);
+    /* With more slaves, the data depends on which one is selected.  */
+    if (!kid || QTAILQ_NEXT(kid, sibling)) {
+        return NULL;
+    }
+    slave = SSI_SLAVE(kid->child);
+    ssc = SSI_SLAVE_GET_CLASS(slave);
+    if (!ssc->get_xip_storage) {
+        return NULL;
+    }
+    return ssc->get_xip_storage(slave, cmd, hdr_bytes, size, gen);
+}
+
 const VMStateDescription vmstate_ssi_slave = {
     .name = "SSISlave",
     .version_id = 1,
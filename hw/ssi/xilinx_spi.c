@@ -164,32 +164,37 @@ static inline int spi_master_enabled(XilinxSPI *s)
 
 static void spi_flush_txfifo(XilinxSPI *s)
 {
-    uint32_t tx;
-    uint32_t rx;
+    uint8_t rx[FIFO_CAPACITY];
+    const uint8_t *tx;
+    uint32_t n, room;
+
+    if (fifo8_is_empty(&s->tx_fifo)) {
+        return;
+    }
 
     while (!fifo8_is_empty(&s->tx_fifo)) {
-        tx = (uint32_t)fifo8_pop(&s->tx_fifo);
-        DB_PRINT("data tx:%x\n", tx);
-        rx = ssi_transfer(s->spi, tx);
-        DB_PRINT("data rx:%x\n", rx);
-        if (fifo8_is_full(&s->rx_fifo)) {
-            s->regs[R_IPISR] |= IRQ_DRR_OVERRUN;
-        } else {
-            fifo8_push(&s->rx_fifo, (uint8_t)rx);
+        tx = fifo8_pop_buf(&s->tx_fifo, fifo8_num_used(&s->tx_fifo), &n);
+        ssi_transfer_bulk(s->spi, tx, rx, n);
+
+        room = MIN(n, fifo8_num_free(&s->rx_fifo));
+        if (room) {
+            fifo8_push_all(&s->rx_fifo, rx, room);
             if (fifo8_is_full(&s->rx_fifo)) {
                 s->regs[R_SPISR] |= SR_RX_FULL;
                 s->regs[R_IPISR] |= IRQ_DRR_FULL;
             }
         }
-
-        s->regs[R_SPISR] &= ~SR_RX_EMPTY;
-        s->regs[R_SPISR] &= ~SR_TX_FULL;
-        s->regs[R_SPISR] |= SR_TX_EMPTY;
-
-        s->regs[R_IPISR] |= IRQ_DTR_EMPTY;
-        s->regs[R_IPISR] |= IRQ_DRR_NOT_EMPTY;
+        if (room < n) {
+            s->regs[R_IPISR] |= IRQ_DRR_OVERRUN;
+        }
     }
 
+    s->regs[R_SPISR] &= ~SR_RX_EMPTY;
+    s->regs[R_SPISR] &= ~SR_TX_FULL;
+    s->regs[R_SPISR] |= SR_TX_EMPTY;
+
+    s->regs[R_IPISR] |= IRQ_DTR_EMPTY;
+    s->regs[R_IPISR] |= IRQ_DRR_NOT_EMPTY;
 }
 
 static uint64_t
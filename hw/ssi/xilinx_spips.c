@@ -163,6 +163,19 @@ typedef struct {
 
     uint8_t lqspi_buf[LQSPI_CACHE_SIZE];
     hwaddr lqspi_cached_addr;
+
+    /* Execute in place, flash storage mapped over the linear window.  */
+    bool xip_tried;
+    MemoryRegion *xip_mapped[2];
+    MemoryRegion xip[2];
+    bool xip_init[2];
+    /* Flash generation the code translated from xip[] was read at.  */
+    uint32_t xip_gen[2];
+    /* Dual parallel flashes, unstriped.  */
+    MemoryRegion xip_dual;
+    uint8_t *xip_shadow;
+    bool xip_shadow_valid;
+    uint32_t xip_shadow_gen[2];
 } XilinxQSPIPS;
 
 typedef struct XilinxSPIPSClass {
@@ -306,6 +319,74 @@ static inline void stripe8(uint8_t *x, int num, bool dir)
     memcpy(x, r, sizeof(uint8_t) * num);
 }
 
+/* Max number of bytes per bus moved by one bulk transfer.  */
+#define SPIPS_BULK_LEN 64
+
+/*
+ * Data phase, the snoop state doesn't change anymore so whole blocks can go
+ * to the slaves at once. Returns the number of bytes taken from the TX FIFO.
+ */
+static int xilinx_spips_flush_txfifo_bulk(XilinxSPIPS *s)
+{
+    int nb = num_effective_busses(s);
+    uint8_t rx[nb][SPIPS_BULK_LEN];
+    const uint8_t *tx_buf;
+    uint32_t n, room;
+    int i, j;
+
+    if (s->snoop_state == SNOOP_STRIPING) {
+        uint8_t tx[nb][SPIPS_BULK_LEN];
+        uint8_t tx_rx[nb];
+
+        n = MIN(fifo8_num_used(&s->tx_fifo) / nb, SPIPS_BULK_LEN);
+        for (j = 0; j < n; ++j) {
+            for (i = 0; i < nb; ++i) {
+                tx_rx[i] = fifo8_pop(&s->tx_fifo);
+            }
+            stripe8(tx_rx, nb, false);
+            for (i = 0; i < nb; ++i) {
+                tx[i][j] = tx_rx[i];
+            }
+        }
+
+        for (i = 0; i < nb; ++i) {
+            ssi_transfer_bulk(s->spi[i], tx[i], rx[i], n);
+        }
+
+        for (j = 0; j < n; ++j) {
+            if (fifo8_num_free(&s->rx_fifo) < nb) {
+                s->regs[R_INTR_STATUS] |= IXR_RX_FIFO_OVERFLOW;
+                DB_PRINT_L(0, "rx FIFO overflow");
+                continue;
+            }
+            for (i = 0; i < nb; ++i) {
+                tx_rx[i] = rx[i][j];
+            }
+            stripe8(tx_rx, nb, true);
+            fifo8_push_all(&s->rx_fifo, tx_rx, nb);
+        }
+        return n * nb;
+    }
+
+    /* Every bus gets the same data, the data read back comes from bus 0.  */
+    tx_buf = fifo8_pop_buf(&s->tx_fifo,
+                           MIN(fifo8_num_used(&s->tx_fifo), SPIPS_BULK_LEN),
+                           &n);
+    for (i = 0; i < nb; ++i) {
+        ssi_transfer_bulk(s->spi[i], tx_buf, rx[i], n);
+    }
+
+    room = MIN(n, fifo8_num_free(&s->rx_fifo));
+    if (room) {
+        fifo8_push_all(&s->rx_fifo, rx[0], room);
+    }
+    if (room < n) {
+        s->regs[R_INTR_STATUS] |= IXR_RX_FIFO_OVERFLOW;
+        DB_PRINT_L(0, "rx FIFO overflow");
+    }
+    return n;
+}
+
 static void xilinx_spips_flush_txfifo(XilinxSPIPS *s)
 {
     int debug_level = 0;
@@ -321,6 +402,10 @@ static void xilinx_spips_flush_txfifo(XilinxSPIPS *s)
             }
             xilinx_spips_update_ixr(s);
             return;
+        } else if ((s->snoop_state == SNOOP_STRIPING ||
+                    s->snoop_state == SNOOP_NONE) &&
+                   xilinx_spips_flush_txfifo_bulk(s)) {
+            continue;
         } else if (s->snoop_state == SNOOP_STRIPING) {
             for (i = 0; i < num_effective_busses(s); ++i) {
                 tx_rx[i] = fifo8_pop(&s->tx_fifo);
@@ -393,13 +478,18 @@ static void xilinx_spips_flush_txfifo(XilinxSPIPS *s)
 
 static inline int rx_data_bytes(XilinxSPIPS *s, uint8_t *value, int max)
 {
-    int i;
-
-    for (i = 0; i < max && !fifo8_is_empty(&s->rx_fifo); ++i) {
-        value[i] = fifo8_pop(&s->rx_fifo);
+    const uint8_t *buf;
+    uint32_t n;
+
+    while (max && !fifo8_is_empty(&s->rx_fifo)) {
+        buf = fifo8_pop_buf(&s->rx_fifo,
+                            MIN(max, fifo8_num_used(&s->rx_fifo)), &n);
+        memcpy(value, buf, n);
+        value += n;
+        max -= n;
     }
 
-    return max - i;
+    return max;
 }
 
 static uint64_t xilinx_spips_read(void *opaque, hwaddr addr,
@@ -459,16 +549,22 @@ static uint64_t xilinx_spips_read(void *opaque, hwaddr addr,
 
 static inline void tx_data_bytes(XilinxSPIPS *s, uint32_t value, int num)
 {
+    uint8_t buf[4];
     int i;
-    for (i = 0; i < num && !fifo8_is_full(&s->tx_fifo); ++i) {
+
+    num = MIN(num, fifo8_num_free(&s->tx_fifo));
+    for (i = 0; i < num; ++i) {
         if (s->regs[R_CONFIG] & ENDIAN) {
-            fifo8_push(&s->tx_fifo, (uint8_t)(value >> 24));
+            buf[i] = value >> 24;
             value <<= 8;
         } else {
-            fifo8_push(&s->tx_fifo, (uint8_t)value);
+            buf[i] = value;
             value >>= 8;
         }
     }
+    if (num > 0) {
+        fifo8_push_all(&s->tx_fifo, buf, num);
+    }
 }
 
 static void xilinx_spips_write(void *opaque, hwaddr addr,
@@ -540,6 +636,130 @@ static const MemoryRegionOps spips_ops = {
     .endianness = DEVICE_LITTLE_ENDIAN,
 };
 
+static void lqspi_xip_disable(XilinxQSPIPS *q)
+{
+    XilinxSPIPS *s = XILINX_SPIPS(q);
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(q->xip_mapped); i++) {
+        if (q->xip_mapped[i]) {
+            memory_region_del_subregion(&s->mmlqspi, q->xip_mapped[i]);
+            q->xip_mapped[i] = NULL;
+        }
+    }
+    q->xip_tried = false;
+}
+
+static void lqspi_xip_map(XilinxQSPIPS *q, int i, MemoryRegion *mr,
+                          hwaddr offset)
+{
+    XilinxSPIPS *s = XILINX_SPIPS(q);
+
+    memory_region_add_subregion_overlap(&s->mmlqspi, offset, mr, 1);
+    q->xip_mapped[i] = mr;
+}
+
+/* Unstripe two dual parallel flashes, like lqspi_read() would.  */
+static void lqspi_xip_fill_dual(XilinxQSPIPS *q, const uint8_t *f0,
+                                const uint8_t *f1, uint64_t len)
+{
+    uint8_t lut[2][256][2];
+    uint8_t *p = q->xip_shadow;
+    uint64_t i;
+    int v;
+
+    /* stripe8() moves every bit on its own, so per flash tables combine
+       with a plain OR.  */
+    for (v = 0; v < 256; v++) {
+        lut[0][v][0] = v;
+        lut[0][v][1] = 0;
+        stripe8(lut[0][v], 2, true);
+        lut[1][v][0] = 0;
+        lut[1][v][1] = v;
+        stripe8(lut[1][v], 2, true);
+    }
+    for (i = 0; i < len; i++) {
+        *p++ = lut[0][f0[i]][0] | lut[1][f1[i]][0];
+        *p++ = lut[0][f0[i]][1] | lut[1][f1[i]][1];
+    }
+}
+
+/*
+ * In linear mode with a plain read command, back the linear window by the
+ * flash storage so that code executes in place. Parts of the window not
+ * covered by a flash still go through lqspi_read(). The flash can only be
+ * reprogrammed with the window unmapped, code translated from it is dropped
+ * here if the flash generation moved on in the meantime.
+ */
+static void lqspi_xip_enable(XilinxQSPIPS *q)
+{
+    XilinxSPIPS *s = XILINX_SPIPS(q);
+    uint32_t cfg = s->regs[R_LQSPI_CFG];
+    uint8_t cmd = cfg & LQSPI_CFG_INST_CODE;
+    uint8_t *storage[2] = { NULL, NULL };
+    uint64_t size[2], len;
+    uint32_t gen[2];
+    int hdr_bytes;
+    int i;
+
+    q->xip_tried = true;
+    if (!(cfg & LQSPI_CFG_LQ_MODE)) {
+        return;
+    }
+
+    hdr_bytes = 3 + !!(cfg & LQSPI_CFG_MODE_EN)
+                + extract32(cfg, LQSPI_CFG_DUMMY_SHIFT, LQSPI_CFG_DUMMY_WIDTH);
+    for (i = 0; i < MIN(s->num_busses, 2); i++) {
+        storage[i] = ssi_get_xip_storage(s->spi[i], cmd, hdr_bytes,
+                                         &size[i], &gen[i]);
+    }
+
+    if (num_effective_busses(s) == 2) {
+        if (!storage[0] || !storage[1] || size[0] != size[1]) {
+            return;
+        }
+        len = MIN(size[0], 1ULL << LQSPI_ADDRESS_BITS);
+        if (!q->xip_shadow) {
+            q->xip_shadow = g_malloc(len * 2);
+            memory_region_init_ram_ptr(&q->xip_dual, "lqspi.xip", len * 2,
+                                       q->xip_shadow);
+            memory_region_set_readonly(&q->xip_dual, true);
+        }
+        if (!q->xip_shadow_valid || q->xip_shadow_gen[0] != gen[0]
+            || q->xip_shadow_gen[1] != gen[1]) {
+            DB_PRINT_L(0, "unstriping %" PRIx64 " bytes\n", len);
+            lqspi_xip_fill_dual(q, storage[0], storage[1], len);
+            if (q->xip_shadow_valid) {
+                memory_region_invalidate_code(&q->xip_dual, 0, len * 2);
+            }
+            q->xip_shadow_gen[0] = gen[0];
+            q->xip_shadow_gen[1] = gen[1];
+            q->xip_shadow_valid = true;
+        }
+        lqspi_xip_map(q, 0, &q->xip_dual, 0);
+        return;
+    }
+
+    /* One flash, or two stacked ones selected by the upper page.  */
+    for (i = 0; i < (cfg & LQSPI_CFG_TWO_MEM ? 2 : 1); i++) {
+        if (!storage[i]) {
+            continue;
+        }
+        if (!q->xip_init[i]) {
+            memory_region_init_ram_ptr(&q->xip[i], "lqspi.xip",
+                                       MIN(size[i], 1ULL << LQSPI_ADDRESS_BITS),
+                                       storage[i]);
+            memory_region_set_readonly(&q->xip[i], true);
+            q->xip_init[i] = true;
+        } else if (q->xip_gen[i] != gen[i]) {
+            memory_region_invalidate_code(&q->xip[i], 0,
+                                          memory_region_size(&q->xip[i]));
+        }
+        q->xip_gen[i] = gen[i];
+        lqspi_xip_map(q, i, &q->xip[i], (hwaddr)i << LQSPI_ADDRESS_BITS);
+    }
+}
+
 static void xilinx_qspips_write(void *opaque, hwaddr addr,
                                 uint64_t value, unsigned size)
 {
@@ -548,11 +768,29 @@ static void xilinx_qspips_write(void *opaque, hwaddr addr,
     xilinx_spips_write(opaque, addr, value, size);
     addr >>= 2;
 
-    if (addr == R_LQSPI_CFG) {
+    switch (addr) {
+    case R_LQSPI_CFG:
         q->lqspi_cached_addr = ~0ULL;
+        /* fall through */
+    case R_CONFIG:
+    case R_EN:
+    case R_TX_DATA:
+    case R_TXD1:
+    case R_TXD2:
+    case R_TXD3:
+        /* The flash may leave its read mode, the next linear read sees if
+           the window can be mapped again.  */
+        lqspi_xip_disable(q);
+        break;
     }
 }
 
+static void xilinx_qspips_reset(DeviceState *d)
+{
+    xilinx_spips_reset(d);
+    lqspi_xip_disable(XILINX_QSPIPS(d));
+}
+
 static const MemoryRegionOps qspips_ops = {
     .read = xilinx_spips_read,
     .write = xilinx_qspips_write,
@@ -569,6 +807,11 @@ lqspi_read(void *opaque, hwaddr addr, unsigned int size)
     XilinxSPIPS *s = opaque;
     uint32_t ret;
 
+    if (!q->xip_tried) {
+        /* Takes effect from the next access on.  */
+        lqspi_xip_enable(q);
+    }
+
     if (addr >= q->lqspi_cached_addr &&
             addr <= q->lqspi_cached_addr + LQSPI_CACHE_SIZE - 4) {
         uint8_t *retp = &q->lqspi_buf[addr - q->lqspi_cached_addr];
@@ -580,6 +823,7 @@ lqspi_read(void *opaque, hwaddr addr, unsigned int size)
         int flash_addr = (addr / num_effective_busses(s));
         int slave = flash_addr >> LQSPI_ADDRESS_BITS;
         int cache_entry = 0;
+        hwaddr cache_addr = flash_addr * num_effective_busses(s);
         uint32_t u_page_save = s->regs[R_LQSPI_STS] & ~LQSPI_CFG_U_PAGE;
 
         s->regs[R_LQSPI_STS] &= ~LQSPI_CFG_U_PAGE;
@@ -619,12 +863,17 @@ lqspi_read(void *opaque, hwaddr addr, unsigned int size)
         DB_PRINT_L(0, "starting QSPI data read\n");
 
         while (cache_entry < LQSPI_CACHE_SIZE) {
-            for (i = 0; i < 64; ++i) {
-                tx_data_bytes(s, 0, 1);
-            }
+            static const uint8_t dummy[64];
+            uint32_t n = MIN(sizeof(dummy), fifo8_num_free(&s->tx_fifo));
+            int got;
+
+            n = MIN(n, LQSPI_CACHE_SIZE - cache_entry);
+            fifo8_push_all(&s->tx_fifo, dummy, n);
             xilinx_spips_flush_txfifo(s);
-            for (i = 0; i < 64; ++i) {
-                rx_data_bytes(s, &q->lqspi_buf[cache_entry++], 1);
+            got = n - rx_data_bytes(s, &q->lqspi_buf[cache_entry], n);
+            cache_entry += got;
+            if (got < n) {
+                break;
             }
         }
 
@@ -632,7 +881,17 @@ lqspi_read(void *opaque, hwaddr addr, unsigned int size)
         s->regs[R_LQSPI_STS] |= u_page_save;
         xilinx_spips_update_cs_lines(s);
 
-        q->lqspi_cached_addr = flash_addr * num_effective_busses(s);
+        if (cache_entry < LQSPI_CACHE_SIZE) {
+            /* The flash came up short, answer this access with what we
+               got and leave the cache invalid.  */
+            DB_PRINT_L(0, "short QSPI data read: %d bytes\n", cache_entry);
+            memset(&q->lqspi_buf[cache_entry], 0,
+                   LQSPI_CACHE_SIZE - cache_entry);
+            q->lqspi_cached_addr = ~0ULL;
+            ret = cpu_to_le32(*(uint32_t *)&q->lqspi_buf[addr - cache_addr]);
+            return ret;
+        }
+        q->lqspi_cached_addr = cache_addr;
         return lqspi_read(opaque, addr, size);
     }
 }
@@ -705,6 +964,9 @@ static int xilinx_spips_post_load(void *opaque, int version_id)
 {
     xilinx_spips_update_ixr((XilinxSPIPS *)opaque);
     xilinx_spips_update_cs_lines((XilinxSPIPS *)opaque);
+    if (object_dynamic_cast(OBJECT(opaque), TYPE_XILINX_QSPIPS)) {
+        lqspi_xip_disable(XILINX_QSPIPS(opaque));
+    }
     return 0;
 }
 
@@ -736,6 +998,7 @@ static void xilinx_qspips_class_init(ObjectClass *klass, void * data)
     XilinxSPIPSClass *xsc = XILINX_SPIPS_CLASS(klass);
 
     dc->realize = xilinx_qspips_realize;
+    dc->reset = xilinx_qspips_reset;
     xsc->reg_ops = &qspips_ops;
     xsc->rx_fifo_size = RXFF_A_Q;
     xsc->tx_fifo_size = TXFF_A_Q;
@@ -99,10 +99,15 @@ void tlm_mach_init_common (ram_addr_t ram_size,
                        const char *kernel_filename, const char *kernel_cmdline,
                        const char *initrd_filename, const char *cpu_model)
 {
-    CPUArchState *env_;
-    qemu_irq *cpu_irq;
+    CPUArchState *env_ = NULL;
+    CPUArchState *env;
+    qemu_irq *cpu_irq = NULL;
+    qemu_irq *irqs = NULL;
+    int32_t *irq_vector = NULL;
+    unsigned int nr_irq = 0; /* per CPU */
     int kernel_size;
     int is_bigendian = 0; /* arm, mips, cris are little endian */
+    int n;
 
     /* init CPUs */
     if (cpu_model == NULL) {
@@ -110,37 +115,45 @@ void tlm_mach_init_common (ram_addr_t ram_size,
         exit(1);
     }
 
-    env_ = cpu_init(cpu_model);
+    /* All CPUs share the TB cache and the tlm,memory device. IRQ line i
+       of CPU n is line n * nr_irq + i of the device.  */
+    for (n = 0; n < smp_cpus; n++) {
+        env = cpu_init(cpu_model);
 
-    if (!env_) {
-        fprintf(stderr, "FATAL: Unable to create cpu %s env=%p\n", cpu_model, env_);
-        exit(1);
-    }
-    qemu_register_reset(main_cpu_reset, env_);
+        if (!env) {
+            fprintf(stderr, "FATAL: Unable to create cpu %s env=%p\n", cpu_model, env);
+            exit(1);
+        }
+        if (!env_) {
+            env_ = env;
+        }
+        qemu_register_reset(main_cpu_reset, env);
 
-    configure_cpu(env_);
+        configure_cpu(env);
 #ifdef TARGET_CRIS
-    cpu_irq = cris_pic_init_cpu(env_);
-    tlm_map(env_, 0x0ULL, 0xffffffffULL,
-            tlm_sync_period_ns, cpu_irq, 1, &env_->interrupt_vector);
+        irqs = cris_pic_init_cpu(env);
+        nr_irq = 1;
+        irq_vector = &env_->interrupt_vector;
 #elif defined(TARGET_MIPS)
-    cpu_irq = NULL;
-    cpu_mips_irq_init_cpu(env_);
-    cpu_mips_clock_init(env_);
-    tlm_map(env_, 0x0ULL, 0xffffffffULL,
-            tlm_sync_period_ns, cpu_irq, 0, NULL);
+        cpu_mips_irq_init_cpu(env);
+        cpu_mips_clock_init(env);
 #elif defined(TARGET_ARM)
-    cpu_irq = arm_pic_init_cpu(arm_env_get_cpu(env_));
-    tlm_map(env_, 0x0ULL, 0xffffffffULL,
-            tlm_sync_period_ns, cpu_irq, 2, NULL);
+        irqs = arm_pic_init_cpu(arm_env_get_cpu(env));
+        nr_irq = 2;
 #elif defined(TARGET_OPENRISC)
-    cpu_irq = cpu_openrisc_pic_init(openrisc_env_get_cpu(env_));
-    cpu_openrisc_clock_init(openrisc_env_get_cpu(env_));
-    tlm_map(env_, 0x0ULL, 0xffffffffULL,
-            tlm_sync_period_ns, cpu_irq, NR_IRQS, NULL);
-    is_bigendian = 1;
-
+        irqs = cpu_openrisc_pic_init(openrisc_env_get_cpu(env));
+        cpu_openrisc_clock_init(openrisc_env_get_cpu(env));
+        nr_irq = NR_IRQS;
+        is_bigendian = 1;
 #endif
+        if (nr_irq) {
+            cpu_irq = g_renew(qemu_irq, cpu_irq, (n + 1) * nr_irq);
+            memcpy(&cpu_irq[n * nr_irq], irqs, nr_irq * sizeof *irqs);
+        }
+    }
+
+    tlm_map(env_, 0x0ULL, 0xffffffffULL,
+            tlm_sync_period_ns, cpu_irq, smp_cpus * nr_irq, irq_vector);
 
     tlm_register_rams();
 
@@ -191,6 +204,7 @@ static QEMUMachine tlm_mach_machine = {
     .name = "tlm-mach",
     .desc = "TLM Machine",
     .init = tlm_mach_init,
+    .max_cpus = 16,
 };
 
 static void tlm_mach_machine_init(void)
@@ -25,8 +25,15 @@
 #include "hw/sysbus.h"
 #include "sysemu/sysemu.h"
 #include "hw/ptimer.h"
+#include "qemu/thread.h"
+#include "qemu/hbitmap.h"
+#include "qemu/log.h"
 
 #include "exec/gdbstub.h"
+#include "exec/memory-internal.h"
+#include "exec/address-spaces.h"
+#include "sysemu/dma.h"
+#include "translate-all.h"
 #include "tlm.h"
 
 #define D(x)
@@ -40,7 +47,25 @@ struct TLMMemory_base{
     MemoryRegion iomem;
     struct tlmu_dmi dmi;
     int is_ram;
+    uint32_t flags;
     const char *name;
+
+    /* Per page masks of instances with translated code, shared with the
+       other TLMu instances mapping the same DMI window.  */
+    uint64_t *code_pages;
+    uint64_t code_pages_base;
+    uint64_t code_pages_size;
+
+    /* Written pages, indexed by offset into the area.  */
+    HBitmap *dirty;
+    int dirty_log;
+};
+
+/* Code invalidation requests from other instances.  */
+struct TLMCodeInvalidate {
+    uint64_t addr;
+    uint64_t len;
+    struct TLMCodeInvalidate *next;
 };
 
 
@@ -61,6 +86,10 @@ typedef struct TLMMemory {
     uint32_t pending_irq[16]; /* max 512 irqs.  */
     uint32_t nr_irq;
     void *irq_vector;
+
+    QEMUBH *code_bh;
+    QemuMutex code_lock;
+    struct TLMCodeInvalidate *code_pending;
 } TLMMemory;
 
 #define TYPE_TLM_MEMORY "tlm,memory"
@@ -71,14 +100,11 @@ typedef struct TLMMemory {
 struct TLMRegisterRamEntry {
     struct TLMMemory_base info;
     struct TLMRegisterRamEntry *next;
-    int try_turbo_mode;
 };
 
 static struct TLMRegisterRamEntry *tlm_register_ram_entries = NULL;
 struct TLMMemory *main_tlmdev = NULL;
 
-void notdirty_mem_wr(hwaddr ram_addr, int len);
-
 static void tlm_write_irq(struct tlmu_irq *qirq)
 {
     assert(main_tlmdev);
@@ -96,7 +122,7 @@ static void tlm_write_irq(struct tlmu_irq *qirq)
 
 int tlm_bus_access(int rw, uint64_t addr, void *data, int len)
 {
-    const int r = cpu_physical_memory_rw(addr, data, len, rw);
+    const int r = cpu_physical_memory_rw_cached(addr, data, len, rw);
     return r;
 }
 
@@ -136,6 +162,7 @@ static void tlm_check_invalidate_dmi(struct TLMMemory_base *info,
     if (start > info->base_addr && start < (info->base_addr + info->size)) {
         info->dmi.ptr = NULL;
         info->dmi.prot = 0;
+        info->code_pages = NULL;
     }
 }
 
@@ -169,6 +196,96 @@ static void tlm_try_dmi(struct TLMMemory_base *info, uint64_t addr, int len)
                 info->dmi.prot |= TLMU_DMI_PROT_FAST;
             }
         }
+        /* Track code in writable windows shared with other instances.  */
+        if (info->dmi.ptr && (info->dmi.prot & TLMU_DMI_PROT_WRITE)
+            && tlm_dmi_pages_map && tlm_instance_id >= 0) {
+            info->code_pages_base = info->dmi.base;
+            info->code_pages_size = info->dmi.size;
+            info->code_pages = tlm_dmi_pages_map(tlm_dmi_pages_opaque,
+                                                 &info->code_pages_base,
+                                                 &info->code_pages_size);
+        }
+        if (info->dmi.ptr && (info->dmi.prot & TLMU_DMI_PROT_WRITE)
+            && !info->dirty) {
+            info->dirty = hbitmap_alloc(info->size, TLMU_DMI_PAGE_BITS);
+        }
+    }
+}
+
+static uint64_t *tlm_code_page(struct TLMMemory_base *info, uint64_t addr)
+{
+    uint64_t offset;
+
+    if (!info->code_pages || addr < info->code_pages_base) {
+        return NULL;
+    }
+    offset = addr - info->code_pages_base;
+    if (offset >= info->code_pages_size) {
+        return NULL;
+    }
+    return &info->code_pages[offset >> TLMU_DMI_PAGE_BITS];
+}
+
+/* Called when the first TB is created on a RAM page.  */
+void tlm_code_page_protect(uint64_t ram_addr)
+{
+    struct TLMRegisterRamEntry *ram;
+    uint64_t *mask;
+    uint64_t offset;
+
+    if (tlm_instance_id < 0) {
+        return;
+    }
+
+    for (ram = tlm_register_ram_entries; ram; ram = ram->next) {
+        if (!ram->info.code_pages
+            || !memory_region_is_tlmu_ramd(&ram->info.iomem)) {
+            continue;
+        }
+        offset = ram_addr - memory_region_get_ram_addr(&ram->info.iomem);
+        if (offset >= ram->info.size) {
+            continue;
+        }
+        mask = tlm_code_page(&ram->info, ram->info.base_addr + offset);
+        if (mask) {
+            __sync_fetch_and_or(mask, 1ULL << tlm_instance_id);
+        }
+        return;
+    }
+}
+
+/*
+ * Writes to RAM shadowed by a tlm region bypass the notdirty tracking of
+ * the softmmu, drop our own TBs on the page like notdirty_mem_write does.
+ */
+static void tlm_invalidate_local_code(struct TLMMemory_base *info,
+                                      hwaddr addr, unsigned int len)
+{
+    ram_addr_t ram_addr;
+    int dirty_flags;
+
+    if (!memory_region_is_tlmu_ramd(&info->iomem)) {
+        return;
+    }
+
+    ram_addr = memory_region_get_ram_addr(&info->iomem) + addr;
+    dirty_flags = cpu_physical_memory_get_dirty_flags(ram_addr);
+    if (!(dirty_flags & CODE_DIRTY_FLAG)) {
+        tb_invalidate_phys_page_fast(ram_addr, len);
+        dirty_flags = cpu_physical_memory_get_dirty_flags(ram_addr);
+    }
+    dirty_flags |= (0xff & ~CODE_DIRTY_FLAG);
+    cpu_physical_memory_set_dirty_flags(ram_addr, dirty_flags);
+}
+
+/* Tell the other instances running code from the page about the write.  */
+static void tlm_invalidate_remote_code(struct TLMMemory_base *info,
+                                       uint64_t eaddr, unsigned int len)
+{
+    uint64_t *mask = tlm_code_page(info, eaddr);
+
+    if (mask && (*mask & ~(1ULL << tlm_instance_id))) {
+        tlm_dmi_pages_written(tlm_dmi_pages_opaque, eaddr, len);
     }
 }
 
@@ -184,48 +301,126 @@ int dmi_is_allowed(struct TLMMemory_base *info, int flags, uint64_t addr, int le
     return 0;
 }
 
-static inline hwaddr adjust_address_for_endianness(hwaddr orig_addr, unsigned int len){
-#if defined(TARGET_WORDS_BIGENDIAN) == defined(HOST_WORDS_BIGENDIAN)
-    return orig_addr;
+/*
+ * Data on the bus and in DMI areas is kept in target byte order, the way
+ * the guest sees memory. The memory API hands us numbers
+ * (DEVICE_NATIVE_ENDIAN), they get converted once here. Any size up to 8
+ * bytes and any alignment goes out as a single access.
+ */
+static inline uint64_t tlm_ld_data(const void *p, unsigned int len)
+{
+    uint8_t buf[8];
+
+    switch (len) {
+    case 1:
+        return ldub_p(p);
+    case 2:
+        return lduw_p(p);
+    case 4:
+        return (uint32_t) ldl_p(p);
+    case 8:
+        return ldq_p(p);
+    }
+    /* Odd sizes, go through an 8 byte buffer.  */
+    assert(len < 8);
+#if defined(TARGET_WORDS_BIGENDIAN)
+    memset(buf, 0, 8 - len);
+    memcpy(buf + 8 - len, p, len);
 #else
-#if TARGET_LONG_SIZE == 4 /* FIXME:TARGET_LONG_SIZE is word size ? FIXME:only word == 32bit is implemented */
-    assert(!(orig_addr % len)); /* FIXME:only aligned access is implemented */
-    switch(len & 0x3){
-        case 0: /* word access */
-            return orig_addr;
-        case 1:return orig_addr ^ 0x3;
-        case 2:return orig_addr ^ 0x2;
-        case 3:assert(!"length 3 is not supported");
-    }
-    assert(!"Never comes here");
+    memcpy(buf, p, len);
+    memset(buf + len, 0, 8 - len);
 #endif
+    return ldq_p(buf);
+}
+
+static inline void tlm_st_data(void *p, uint64_t v, unsigned int len)
+{
+    uint8_t buf[8];
+
+    switch (len) {
+    case 1:
+        stb_p(p, v);
+        return;
+    case 2:
+        stw_p(p, v);
+        return;
+    case 4:
+        stl_p(p, v);
+        return;
+    case 8:
+        stq_p(p, v);
+        return;
+    }
+    assert(len < 8);
+    stq_p(buf, v);
+#if defined(TARGET_WORDS_BIGENDIAN)
+    memcpy(p, buf + 8 - len, len);
+#else
+    memcpy(p, buf, len);
 #endif
 }
 
+/*
+ * Who is accessing the region. Only accesses the softmmu of this thread is
+ * dispatching to the region come from the CPU, anything else (device DMA,
+ * also when run from the CPU thread) is TLMU_ACCESS_DMA with no core.
+ */
+static int tlm_access_initiator(struct TLMMemory_base *info, int *cpu)
+{
+    if (tlm_cpu_access_mr == &info->iomem && cpu_single_env) {
+        *cpu = ENV_GET_CPU(cpu_single_env)->cpu_index;
+        return tlm_cpu_access_type;
+    }
+    *cpu = -1;
+    return TLMU_ACCESS_DMA;
+}
+
+/* Bus access from the region into the main emulator.  */
+static int tlm_bus_access_region(struct TLMMemory_base *info, int64_t clk,
+                                 int rw, uint64_t addr, void *data, int len)
+{
+    MemoryRegion *cpu_mr = tlm_cpu_access_mr;
+    int cpu, access, ret;
+
+    if (!tlm_bus_access_cpu_cb) {
+        return tlm_bus_access_cb(tlm_opaque, clk, rw, addr, data, len);
+    }
+    access = tlm_access_initiator(info, &cpu);
+    /* Accesses the main emulator makes back into us are not the CPU's.  */
+    tlm_cpu_access_mr = NULL;
+    ret = tlm_bus_access_cpu_cb(tlm_opaque, clk, cpu, access, rw,
+                                addr, data, len);
+    tlm_cpu_access_mr = cpu_mr;
+    return ret;
+}
+
 static inline uint64_t tlm_dbg_read(void *opaque, hwaddr addr, unsigned int len){
     struct TLMMemory_base *const info = opaque;
-    const uint64_t eaddr = info->base_addr + adjust_address_for_endianness(addr, len);
-    uint64_t r = 0;
+    const uint64_t eaddr = info->base_addr + addr;
+    uint8_t buf[8] = { 0 };
     const int64_t clk = qemu_get_clock_ns(vm_clock);
     D(printf("tlm_dbg_read(%p, %08llX, %d)\n", opaque, (long long)eaddr, len));
-    tlm_bus_access_dbg_cb(tlm_opaque, clk, 0, eaddr, &r, len);
-    return r;
+    tlm_bus_access_dbg_cb(tlm_opaque, clk, 0, eaddr, buf, len);
+    return tlm_ld_data(buf, len);
 }
 
 static inline void tlm_dbg_write(void *opaque, hwaddr addr, uint64_t value, unsigned int len){
     struct TLMMemory_base *const info = opaque;
-    const uint64_t eaddr = info->base_addr + adjust_address_for_endianness(addr, len);
+    const uint64_t eaddr = info->base_addr + addr;
+    uint8_t buf[8];
     const int64_t clk = qemu_get_clock_ns(vm_clock);
     D(printf("tlm_dbg_write(%p, %08llX, %08llX, %d)\n", opaque, (long long)eaddr, (long long)value, len));
-    tlm_bus_access_dbg_cb(tlm_opaque, clk, 1, eaddr, &value, len);
+    tlm_st_data(buf, value, len);
+    tlm_bus_access_dbg_cb(tlm_opaque, clk, 1, eaddr, buf, len);
 }
 
 static inline
 uint64_t tlm_read(void *opaque, hwaddr addr, unsigned int len)
 {
     struct TLMMemory_base *const info = opaque;
-    uint64_t r = 0;
-    const uint64_t eaddr = info->base_addr + adjust_address_for_endianness(addr, len);
+    uint64_t r;
+    uint8_t buf[8] = { 0 };
+    const uint64_t eaddr = info->base_addr + addr;
     int64_t clk;
     int dmi_supported;
 
@@ -236,9 +431,9 @@ uint64_t tlm_read(void *opaque, hwaddr addr, unsigned int len)
 
         offset = eaddr - info->dmi.base;
         p += offset;
-        memcpy(&r, p, len);
+        r = tlm_ld_data(p, len);
         qemu_icount += info->dmi.read_latency * len;
-        if (!info->is_ram) {
+        if (info->flags & TLMU_REGION_SYNC) {
             clk = qemu_get_clock_ns(vm_clock);
             tlm_sync(tlm_opaque, clk);
         }
@@ -246,8 +441,9 @@ uint64_t tlm_read(void *opaque, hwaddr addr, unsigned int len)
     }
 
     clk = qemu_get_clock_ns(vm_clock);
-    dmi_supported = tlm_bus_access_cb(tlm_opaque, clk, 0, eaddr, &r, len);
-    if (dmi_supported && !info->dmi.prot) {
+    dmi_supported = tlm_bus_access_region(info, clk, 0, eaddr, buf, len);
+    r = tlm_ld_data(buf, len);
+    if (dmi_supported && !info->dmi.prot && (info->flags & TLMU_REGION_DMI)) {
         tlm_try_dmi(info, eaddr, len);
     }
 
@@ -259,14 +455,24 @@ static inline void
 tlm_write(void *opaque, hwaddr addr, uint64_t value, unsigned int len)
 {
     struct TLMMemory_base *const info = opaque;
-    const uint64_t eaddr = info->base_addr + adjust_address_for_endianness(addr, len);
+    const uint64_t eaddr = info->base_addr + addr;
+    uint8_t buf[8];
     int64_t clk;
     int dmi_supported;
+    int cpu;
 
     D(printf("tlm_write(%p, %08llX, %08llX, %d)\n", opaque, (long long)eaddr, (long long)value, len));
 
+    /* Only regions mapped read only on purpose, ROMs from tlm_map_ram()
+       still see the writes (e.g flash commands).  */
+    if (info->flags & TLMU_REGION_READONLY) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: write to read only region %s "
+                      "at 0x%" PRIx64 "\n", __func__, info->name, eaddr);
+        return;
+    }
+
     if (info->is_ram) {
-        //notdirty_mem_wr(eaddr, len); //FIXME just to compile
+        tlm_invalidate_local_code(info, addr, len);
     }
 
     if (dmi_is_allowed(info, TLMU_DMI_PROT_WRITE, eaddr, len)) {
@@ -275,18 +481,44 @@ tlm_write(void *opaque, hwaddr addr, uint64_t value, unsigned int len)
 
         offset = eaddr - info->dmi.base;
         p += offset;
-        memcpy(p, &value, len);
+        tlm_st_data(p, value, len);
         qemu_icount += info->dmi.write_latency * len;
-        if (!info->is_ram) {
+        tlm_invalidate_remote_code(info, eaddr, len);
+        if (info->dirty) {
+            hbitmap_set(info->dirty, eaddr - info->base_addr, len);
+        }
+        if ((info->flags & (TLMU_REGION_SYNC | TLMU_REGION_POSTED))
+            == TLMU_REGION_SYNC) {
             clk = qemu_get_clock_ns(vm_clock);
             tlm_sync(tlm_opaque, clk);
         }
         return;
     }
 
+    tlm_st_data(buf, value, len);
+
+    /* Outside a DMI window, posted writes go out as non-blocking
+       transactions and don't stall the CPU. They never ask for DMI
+       themselves. If the main emulator doesn't take them, fall back to
+       the blocking access below, which may still get DMI granted.  */
+    if (info->flags & TLMU_REGION_POSTED) {
+        tlm_access_initiator(info, &cpu);
+        if (!tlm_nb_post_write(cpu, eaddr, buf, len)) {
+            tlm_invalidate_remote_code(info, eaddr, len);
+            if (info->dirty) {
+                hbitmap_set(info->dirty, eaddr - info->base_addr, len);
+            }
+            return;
+        }
+    }
+
     clk = qemu_get_clock_ns(vm_clock);
-    dmi_supported = tlm_bus_access_cb(tlm_opaque, clk, 1, eaddr, &value, len);
-    if (dmi_supported && !info->dmi.prot) {
+    dmi_supported = tlm_bus_access_region(info, clk, 1, eaddr, buf, len);
+    tlm_invalidate_remote_code(info, eaddr, len);
+    if (info->dirty) {
+        hbitmap_set(info->dirty, eaddr - info->base_addr, len);
+    }
+    if (dmi_supported && !info->dmi.prot && (info->flags & TLMU_REGION_DMI)) {
         tlm_try_dmi(info, eaddr, len);
     }
 }
@@ -295,15 +527,62 @@ static const MemoryRegionOps tlm_mem_ops[2] = {
     {
         .read = tlm_read,
         .write = tlm_write,
-        .endianness = DEVICE_NATIVE_ENDIAN
+        .endianness = DEVICE_NATIVE_ENDIAN,
+        .valid = {
+            .min_access_size = 1,
+            .max_access_size = 8,
+            .unaligned = true
+        },
+        .impl = {
+            .min_access_size = 1,
+            .max_access_size = 8,
+            .unaligned = true
+        }
     },
     {
         .read = tlm_dbg_read,
         .write = tlm_dbg_write,
-        .endianness = DEVICE_NATIVE_ENDIAN
+        .endianness = DEVICE_NATIVE_ENDIAN,
+        .valid = {
+            .min_access_size = 1,
+            .max_access_size = 8,
+            .unaligned = true
+        },
+        .impl = {
+            .min_access_size = 1,
+            .max_access_size = 8,
+            .unaligned = true
+        }
     }
 };
 
+/*
+ * Device DMA into tlm areas without DMI goes out as non-blocking
+ * transactions. RAM shadows are left to the synchronous path, it keeps the
+ * translated code and the dirty tracking coherent.
+ */
+static int tlm_dma_async_rw(dma_addr_t addr, void *buf, dma_addr_t len,
+                            DMADirection dir,
+                            BlockDriverCompletionFunc *cb, void *opaque)
+{
+    const int rw = dir == DMA_DIRECTION_FROM_DEVICE;
+    MemoryRegionSection section;
+    struct TLMMemory_base *info;
+
+    section = memory_region_find(get_system_memory(), addr, len);
+    if (!section.mr || section.size < len
+        || section.mr->ops != tlm_mem_ops
+        || memory_region_is_tlmu_ramd(section.mr)) {
+        return -1;
+    }
+
+    info = section.mr->opaque;
+    if (dmi_is_allowed(info, rw ? TLMU_DMI_PROT_WRITE : TLMU_DMI_PROT_READ,
+                       addr, len)) {
+        return -1;
+    }
+    return tlm_nb_submit(rw, addr, buf, len, cb, opaque);
+}
 
 static void update_irq(void *opaque)
 {
@@ -322,6 +601,84 @@ static void update_irq(void *opaque)
     }
 }
 
+/*
+ * Drop our translated code from a range modified by someone else. Runs
+ * from the main loop so that the CPU is not executing the TBs.
+ */
+static void tlm_invalidate_code_range(uint64_t addr, uint64_t len)
+{
+    struct TLMRegisterRamEntry *ram;
+    uint64_t start, end, page;
+    uint64_t *mask;
+    ram_addr_t ram_base;
+
+    for (ram = tlm_register_ram_entries; ram; ram = ram->next) {
+        struct TLMMemory_base *info = &ram->info;
+
+        if (!memory_region_is_tlmu_ramd(&info->iomem)
+            || addr >= info->base_addr + info->size
+            || addr + len <= info->base_addr) {
+            continue;
+        }
+
+        /* Invalidate whole DMI pages, that's what the masks track.  */
+        start = MAX(addr & ~(TLMU_DMI_PAGE_SIZE - 1), info->base_addr);
+        end = MIN((addr + len + TLMU_DMI_PAGE_SIZE - 1)
+                  & ~(TLMU_DMI_PAGE_SIZE - 1),
+                  info->base_addr + info->size);
+
+        for (page = start; page < end; page += TLMU_DMI_PAGE_SIZE) {
+            mask = tlm_code_page(info, page);
+            if (mask) {
+                __sync_fetch_and_and(mask, ~(1ULL << tlm_instance_id));
+            }
+        }
+
+        ram_base = memory_region_get_ram_addr(&info->iomem);
+        tb_invalidate_phys_range(ram_base + (start - info->base_addr),
+                                 ram_base + (end - info->base_addr), 0);
+    }
+}
+
+static void tlm_invalidate_code(void *opaque)
+{
+    struct TLMMemory *s = opaque;
+    struct TLMCodeInvalidate *inv, *next;
+
+    qemu_mutex_lock(&s->code_lock);
+    inv = s->code_pending;
+    s->code_pending = NULL;
+    qemu_mutex_unlock(&s->code_lock);
+
+    for (; inv; inv = next) {
+        next = inv->next;
+        D(printf("%s: %" PRIx64 " %" PRIx64 "\n", __func__,
+                 inv->addr, inv->len));
+        tlm_invalidate_code_range(inv->addr, inv->len);
+        g_free(inv);
+    }
+}
+
+/* May be called from any thread.  */
+static void tlm_queue_invalidate_code(struct tlmu_dmi *dmi)
+{
+    struct TLMCodeInvalidate *inv = g_malloc(sizeof *inv);
+    CPUArchState *env;
+
+    inv->addr = dmi->base;
+    inv->len = dmi->size;
+
+    qemu_mutex_lock(&main_tlmdev->code_lock);
+    inv->next = main_tlmdev->code_pending;
+    main_tlmdev->code_pending = inv;
+    qemu_mutex_unlock(&main_tlmdev->code_lock);
+
+    qemu_bh_schedule(main_tlmdev->code_bh);
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        cpu_exit(env);
+    }
+}
+
 static void timer_hit(void *opaque)
 {
     struct TLMMemory *s = opaque;
@@ -333,18 +690,23 @@ void tlm_notify_event(enum tlmu_event ev, void *d)
     CPUArchState *env;
 
     assert(main_tlmdev);
-    env = main_tlmdev->cpu_env;
+
+    tlm_rr_event(ev, d);
 
     switch (ev) {
         case TLMU_TLM_EVENT_SYNC:
             qemu_notify_event();
             break;
         case TLMU_TLM_EVENT_WAKE:
-            ENV_GET_CPU(env)->halted = 0;
-            cpu_reset_interrupt(ENV_GET_CPU(env), CPU_INTERRUPT_HALT);
+            for (env = first_cpu; env != NULL; env = env->next_cpu) {
+                ENV_GET_CPU(env)->halted = 0;
+                cpu_reset_interrupt(ENV_GET_CPU(env), CPU_INTERRUPT_HALT);
+            }
             break;
         case TLMU_TLM_EVENT_SLEEP:
-            cpu_interrupt(ENV_GET_CPU(env), CPU_INTERRUPT_HALT);
+            for (env = first_cpu; env != NULL; env = env->next_cpu) {
+                cpu_interrupt(ENV_GET_CPU(env), CPU_INTERRUPT_HALT);
+            }
             break;
         case TLMU_TLM_EVENT_IRQ:
             tlm_write_irq(d);
@@ -352,6 +714,12 @@ void tlm_notify_event(enum tlmu_event ev, void *d)
         case TLMU_TLM_EVENT_INVALIDATE_DMI:
             tlm_invalidate_dmi(d);
             break;
+        case TLMU_TLM_EVENT_INVALIDATE_CODE:
+            tlm_queue_invalidate_code(d);
+            break;
+        case TLMU_TLM_EVENT_NB_DONE:
+            tlm_nb_done(d);
+            break;
         case TLMU_TLM_EVENT_RESET:
             qemu_system_reset_request();
             break;
@@ -384,6 +752,8 @@ static int tlm_memory_init(SysBusDevice *dev)
     s->irq_bh = qemu_bh_new(update_irq, s);
     s->sync_bh = qemu_bh_new(timer_hit, s);
     s->sync_ptimer = ptimer_init(s->sync_bh);
+    s->code_bh = qemu_bh_new(tlm_invalidate_code, s);
+    qemu_mutex_init(&s->code_lock);
     if (s->sync_period_ns) {
         ptimer_set_period(s->sync_ptimer, s->sync_period_ns / 10);
         ptimer_set_limit(s->sync_ptimer, 10, 1);
@@ -391,11 +761,16 @@ static int tlm_memory_init(SysBusDevice *dev)
     }
 
     s->info.name = "tlm_memory";
+    s->info.flags = TLMU_REGION_DMI | TLMU_REGION_SYNC;
     memory_region_init_io(&s->info.iomem, tlm_mem_ops, &s->info, s->info.name, s->info.size);
     sysbus_init_mmio(dev, &s->info.iomem);
 
     /* Register the main tlm dev.  Used for interrupts.  */
     main_tlmdev = s;
+    tlm_prof_init();
+    tlm_rr_init();
+    tlm_nb_init();
+    dma_async_rw_func = tlm_dma_async_rw;
     D(printf("tlm_memory_init() called %p\n", main_tlmdev));
     return 0;
 }
@@ -431,17 +806,46 @@ static void tlm_memory_register_type(void){
 type_init(tlm_memory_register_type)
 
 
+/* Targets that are not memories get a plain I/O region of their own.  */
+static void map_io(struct TLMRegisterRamEntry *ram)
+{
+    D(printf("map_io(%p:%s) base:0x%08llX size:0x%08llX flags:%x\n",
+            ram, ram->info.name, (long long)ram->info.base_addr,
+            (long long)ram->info.size, ram->info.flags));
+    memory_region_init_io(&ram->info.iomem, tlm_mem_ops, &ram->info,
+                          ram->info.name, ram->info.size);
+    memory_region_add_subregion(&main_tlmdev->info.iomem, ram->info.base_addr,
+                                &ram->info.iomem);
+}
+
 static void map_ram(struct TLMRegisterRamEntry *ram)
 {
+    const int try_turbo_mode = ram->info.flags & TLMU_REGION_TURBO;
+
     D(printf("map_ram(%p:%s) base:0x%08llX size:0x%08llX called\n",
             ram, ram->info.name, (long long)ram->info.base_addr, (long long)ram->info.size));
-    tlm_try_dmi(&ram->info, ram->info.base_addr, ram->info.size);
-    if(ram->try_turbo_mode && ram->info.dmi.ptr){//turbo mode
+    if (!(ram->info.flags & TLMU_REGION_CACHEABLE)) {
+        map_io(ram);
+        return;
+    }
+    if (ram->info.flags & TLMU_REGION_DMI) {
+        tlm_try_dmi(&ram->info, ram->info.base_addr, ram->info.size);
+    }
+    if (ram->info.is_ram && !ram->info.dirty) {
+        ram->info.dirty = hbitmap_alloc(ram->info.size, TLMU_DMI_PAGE_BITS);
+    }
+    if(try_turbo_mode && ram->info.dmi.ptr){//turbo mode
         D(printf("DMI is OK\n"));
         memory_region_init_ram_ptr(&ram->info.iomem, ram->info.name, ram->info.size, ram->info.dmi.ptr);
+        /* QEMU writes directly into turbo maps, track them with the
+           softmmu dirty logging.  */
+        if (ram->info.dirty) {
+            memory_region_set_log(&ram->info.iomem, true, DIRTY_MEMORY_VGA);
+            ram->info.dirty_log = 1;
+        }
     }
     else{
-        if(ram->try_turbo_mode){
+        if(try_turbo_mode){
             fprintf(stderr,
                     "Warning: ram(%s) is expected to use turmo mode, "
                     "but DMI(r/w) is not available for this area. This area will be accessed via b_transport()\n",
@@ -457,25 +861,114 @@ static void map_ram(struct TLMRegisterRamEntry *ram)
     memory_region_set_readonly(&ram->info.iomem, ram->info.is_ram ? false : true);
 }
 
-void tlm_map_ram(const char *name, uint64_t addr, uint64_t size, int rw, int try_turbo_mode)
+void tlm_map_region(const char *name, uint64_t addr, uint64_t size,
+                    uint32_t flags)
 {
     struct TLMRegisterRamEntry *const ram = g_malloc0(sizeof *ram);
     ram->info.name = g_strdup(name);
     ram->info.base_addr = addr;
     ram->info.size = size;
-    ram->info.is_ram = rw;
-    ram->try_turbo_mode = try_turbo_mode;
+    ram->info.flags = flags;
+    ram->info.is_ram = (flags & TLMU_REGION_CACHEABLE)
+                       && !(flags & (TLMU_REGION_READONLY | TLMU_REGION_ROM));
 
     /* Insert.  */
     ram->next = tlm_register_ram_entries;
     tlm_register_ram_entries = ram;
 }
 
+void tlm_map_ram(const char *name, uint64_t addr, uint64_t size, int rw, int try_turbo_mode)
+{
+    uint32_t flags = TLMU_REGION_DMI | TLMU_REGION_CACHEABLE;
+
+    if (try_turbo_mode) {
+        flags |= TLMU_REGION_TURBO;
+    }
+    /* ROMs take the sync-free DMI path like RAM, devices that need a
+       sync point on every access must ask for it with TLMU_REGION_SYNC.  */
+    if (!rw) {
+        flags |= TLMU_REGION_ROM;
+    }
+    tlm_map_region(name, addr, size, flags);
+}
+
 void tlm_register_rams(void)
 {
     struct TLMRegisterRamEntry *ram;
+
+    /* Log all the maps before any DMI request is made.  */
+    for(ram = tlm_register_ram_entries; ram; ram = ram->next){
+        tlm_rr_map_region(ram->info.name, ram->info.base_addr, ram->info.size,
+                          ram->info.flags);
+    }
     for(ram = tlm_register_ram_entries; ram; ram = ram->next){
         map_ram(ram);
     }
 }
 
+/* Fold the softmmu dirty log of a turbo map into the dirty bitmap.  */
+static void tlm_sync_dirty_log(struct TLMMemory_base *info)
+{
+    uint64_t offset;
+
+    if (!info->dirty_log) {
+        return;
+    }
+    for (offset = 0; offset < info->size; offset += TLMU_DMI_PAGE_SIZE) {
+        if (memory_region_test_and_clear_dirty(&info->iomem, offset,
+                                               TLMU_DMI_PAGE_SIZE,
+                                               DIRTY_MEMORY_VGA)) {
+            hbitmap_set(info->dirty, offset, TLMU_DMI_PAGE_SIZE);
+        }
+    }
+}
+
+static void tlm_get_dirty_area(struct TLMMemory_base *info,
+                               uint64_t base, uint64_t size,
+                               uint8_t *bitmap, int clear)
+{
+    uint64_t start, end, addr, page;
+
+    if (!info->dirty
+        || base >= info->base_addr + info->size
+        || base + size <= info->base_addr) {
+        return;
+    }
+
+    tlm_sync_dirty_log(info);
+
+    start = MAX(base, info->base_addr);
+    end = MIN(base + size, info->base_addr + info->size);
+    for (addr = start; addr < end;
+         addr = (addr + TLMU_DMI_PAGE_SIZE) & ~(TLMU_DMI_PAGE_SIZE - 1)) {
+        if (hbitmap_get(info->dirty, addr - info->base_addr)) {
+            page = (addr - base) >> TLMU_DMI_PAGE_BITS;
+            bitmap[page / 8] |= 1 << (page % 8);
+        }
+    }
+
+    if (clear) {
+        hbitmap_reset(info->dirty, start - info->base_addr, end - start);
+    }
+}
+
+int tlm_get_dirty_bitmap(uint64_t base, uint64_t size,
+                         uint8_t *bitmap, int clear)
+{
+    struct TLMRegisterRamEntry *ram;
+    uint64_t page, nr_pages;
+    int nr_dirty = 0;
+
+    for (ram = tlm_register_ram_entries; ram; ram = ram->next) {
+        tlm_get_dirty_area(&ram->info, base, size, bitmap, clear);
+    }
+    if (main_tlmdev) {
+        tlm_get_dirty_area(&main_tlmdev->info, base, size, bitmap, clear);
+    }
+
+    nr_pages = (size + TLMU_DMI_PAGE_SIZE - 1) >> TLMU_DMI_PAGE_BITS;
+    for (page = 0; page < nr_pages; page++) {
+        nr_dirty += !!(bitmap[page / 8] & (1 << (page % 8)));
+    }
+    return nr_dirty;
+}
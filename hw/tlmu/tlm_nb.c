@@ -0,0 +1,164 @@
+/*
+ * Non-blocking TLM transactions from TLMu into the main emulator.
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Transactions are handed to the main emulator with tlm_nb_access_cb and
+ * complete asynchronously when the main emulator notifies a
+ * TLMU_TLM_EVENT_NB_DONE event. Completions may be notified from any
+ * thread, they are queued and the completion callbacks run from a bottom
+ * half.
+ *
+ * Ordering against blocking accesses is left to the main emulator, it must
+ * not let a blocking bus access pass earlier non-blocking ones.
+ */
+
+#include "hw/sysbus.h"
+#include "cpu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/queue.h"
+
+#include "tlm.h"
+
+#define D(x)
+
+/* Max number of transactions in flight.  */
+#define TLM_NB_MAX_OUTSTANDING 16
+
+typedef struct TLMNbTxn {
+    struct tlmu_nb_txn txn;
+    void (*cb)(void *opaque, int status);
+    void *opaque;
+    uint64_t buf;
+    QSIMPLEQ_ENTRY(TLMNbTxn) next;
+} TLMNbTxn;
+
+static struct {
+    QEMUBH *bh;
+    QemuMutex lock;
+    QSIMPLEQ_HEAD(, TLMNbTxn) done;
+    unsigned int outstanding;
+} tlm_nb;
+
+static void tlm_nb_complete(void *opaque)
+{
+    QSIMPLEQ_HEAD(, TLMNbTxn) done = QSIMPLEQ_HEAD_INITIALIZER(done);
+    TLMNbTxn *t;
+
+    qemu_mutex_lock(&tlm_nb.lock);
+    QSIMPLEQ_CONCAT(&done, &tlm_nb.done);
+    qemu_mutex_unlock(&tlm_nb.lock);
+
+    while ((t = QSIMPLEQ_FIRST(&done)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&done, next);
+        tlm_nb.outstanding--;
+        D(printf("%s: addr=%" PRIx64 " len=%d status=%d\n", __func__,
+                 t->txn.addr, t->txn.len, t->txn.status));
+        if (t->cb) {
+            t->cb(t->opaque, t->txn.status);
+        }
+        g_free(t);
+    }
+}
+
+static int tlm_nb_issue(TLMNbTxn *t)
+{
+    if (!tlm_nb.bh || !tlm_nb_access_cb
+        || tlm_nb.outstanding >= TLM_NB_MAX_OUTSTANDING) {
+        return -1;
+    }
+
+    t->txn.clk = qemu_get_clock_ns(vm_clock);
+    tlm_nb.outstanding++;
+    if (!tlm_nb_access_cb(tlm_opaque, &t->txn)) {
+        /* Rejected, the caller falls back to a blocking access.  */
+        tlm_nb.outstanding--;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Submit a non-blocking access. data must stay valid until cb is called.
+ * Returns -1 if the access could not be issued, the caller should then
+ * make a blocking access.
+ */
+int tlm_nb_submit(int rw, uint64_t addr, void *data, int len,
+                  void (*cb)(void *opaque, int status), void *opaque)
+{
+    TLMNbTxn *t = g_malloc0(sizeof *t);
+
+    t->txn.rw = rw;
+    t->txn.cpu = -1;
+    t->txn.addr = addr;
+    t->txn.data = data;
+    t->txn.len = len;
+    t->cb = cb;
+    t->opaque = opaque;
+    if (tlm_nb_issue(t)) {
+        g_free(t);
+        return -1;
+    }
+    return 0;
+}
+
+/* Posted write, the data is copied and nobody waits for the completion.  */
+int tlm_nb_post_write(int cpu, uint64_t addr, const void *data, int len)
+{
+    TLMNbTxn *t = g_malloc0(sizeof *t);
+
+    assert(len <= sizeof t->buf);
+    memcpy(&t->buf, data, len);
+    t->txn.rw = 1;
+    t->txn.cpu = cpu;
+    t->txn.addr = addr;
+    t->txn.data = &t->buf;
+    t->txn.len = len;
+    if (tlm_nb_issue(t)) {
+        g_free(t);
+        return -1;
+    }
+    return 0;
+}
+
+/* TLMU_TLM_EVENT_NB_DONE, may be called from any thread.  */
+void tlm_nb_done(struct tlmu_nb_txn *txn)
+{
+    TLMNbTxn *t = container_of(txn, TLMNbTxn, txn);
+
+    qemu_mutex_lock(&tlm_nb.lock);
+    QSIMPLEQ_INSERT_TAIL(&tlm_nb.done, t, next);
+    qemu_mutex_unlock(&tlm_nb.lock);
+    qemu_bh_schedule(tlm_nb.bh);
+}
+
+void tlm_nb_init(void)
+{
+    if (tlm_nb.bh) {
+        return;
+    }
+    qemu_mutex_init(&tlm_nb.lock);
+    QSIMPLEQ_INIT(&tlm_nb.done);
+    tlm_nb.bh = qemu_bh_new(tlm_nb_complete, NULL);
+}
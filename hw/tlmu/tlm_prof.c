@@ -0,0 +1,253 @@
+/*
+ * Statistical PC sampling profiler for TLMu instances.
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The profiler arms a vm_clock timer that expires every N guest
+ * instructions. With -icount, the CPU loop cuts its instruction budget at
+ * the nearest vm_clock deadline, so the CPU is stopped exactly at the sample
+ * point when the timer fires and the architectural PC is up to date.
+ *
+ * Samples (the PC plus an optional frame pointer walk) are aggregated into
+ * a hash table and written out in callgrind format when the emulator exits.
+ * Since every TLMu instance is a separate copy of the library, every
+ * instance gets its own profile.
+ */
+
+#include "hw/sysbus.h"
+#include "sysemu/sysemu.h"
+#include "qemu/timer.h"
+#include "disas/disas.h"
+
+#include "tlm.h"
+
+#define D(x)
+
+#define TLM_PROF_MAX_DEPTH 32
+
+typedef struct TLMProfStack {
+    uint64_t count;
+    unsigned int depth;
+    target_ulong pc[TLM_PROF_MAX_DEPTH + 1];
+} TLMProfStack;
+
+static struct {
+    char *filename;
+    uint64_t period_insns;
+    unsigned int depth;
+
+    QEMUTimer *timer;
+    int64_t period_ns;
+    GHashTable *samples;
+    uint64_t nr_samples;
+    Notifier exit_notifier;
+} tlm_prof;
+
+static size_t tlm_prof_stack_size(unsigned int depth)
+{
+    return offsetof(TLMProfStack, pc) + (depth + 1) * sizeof(target_ulong);
+}
+
+static guint tlm_prof_hash(gconstpointer key)
+{
+    const TLMProfStack *st = key;
+    guint h = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i <= st->depth; i++) {
+        h = (h ^ (guint) st->pc[i]) * 16777619U;
+    }
+    return h;
+}
+
+static gboolean tlm_prof_equal(gconstpointer a, gconstpointer b)
+{
+    const TLMProfStack *sa = a;
+    const TLMProfStack *sb = b;
+
+    return sa->depth == sb->depth
+           && !memcmp(sa->pc, sb->pc, (sa->depth + 1) * sizeof(target_ulong));
+}
+
+/*
+ * Walk the guest frame pointer chain. Only targets with a well defined
+ * frame layout are supported, on the rest we only sample the PC.
+ */
+static unsigned int tlm_prof_unwind(CPUArchState *env, target_ulong *ret,
+                                    unsigned int max_depth)
+{
+    unsigned int depth = 0;
+#if defined(TARGET_ARM)
+    /* APCS frames: fp points to the saved pc, fp - 4 holds the return
+       address and fp - 12 the callers fp.  */
+    target_ulong fp = env->regs[11];
+    uint8_t buf[4];
+
+    if (env->thumb) {
+        return 0;
+    }
+
+    while (depth < max_depth && fp && !(fp & 3)) {
+        target_ulong lr, next;
+
+        if (cpu_memory_rw_debug(env, fp - 4, buf, 4, 0)) {
+            break;
+        }
+        lr = ldl_p(buf);
+        if (cpu_memory_rw_debug(env, fp - 12, buf, 4, 0)) {
+            break;
+        }
+        next = ldl_p(buf);
+
+        ret[depth++] = lr;
+        /* Stacks grow downwards, bail out on bogus chains.  */
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+#endif
+    return depth;
+}
+
+static void tlm_prof_sample(CPUArchState *env)
+{
+    TLMProfStack st;
+    TLMProfStack *entry;
+    target_ulong pc, cs_base;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    st.pc[0] = pc;
+    st.depth = tlm_prof_unwind(env, &st.pc[1], tlm_prof.depth);
+
+    entry = g_hash_table_lookup(tlm_prof.samples, &st);
+    if (!entry) {
+        entry = g_malloc0(tlm_prof_stack_size(st.depth));
+        entry->depth = st.depth;
+        memcpy(entry->pc, st.pc, (st.depth + 1) * sizeof(target_ulong));
+        g_hash_table_insert(tlm_prof.samples, entry, entry);
+    }
+    entry->count++;
+    tlm_prof.nr_samples++;
+}
+
+static void tlm_prof_tick(void *opaque)
+{
+    CPUArchState *env;
+
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        if (!ENV_GET_CPU(env)->halted) {
+            tlm_prof_sample(env);
+        }
+    }
+    qemu_mod_timer(tlm_prof.timer,
+                   qemu_get_clock_ns(vm_clock) + tlm_prof.period_ns);
+}
+
+static void tlm_prof_put_fn(FILE *f, const char *key, target_ulong addr)
+{
+    const char *sym = lookup_symbol(addr);
+
+    if (sym && sym[0]) {
+        fprintf(f, "%s=%s\n", key, sym);
+    } else {
+        fprintf(f, "%s=0x" TARGET_FMT_lx "\n", key, addr);
+    }
+}
+
+/*
+ * Emit one aggregated stack. The sampled PC gets the self cost and every
+ * return address on the stack gets a call edge with inclusive cost.
+ */
+static void tlm_prof_put_stack(gpointer key, gpointer value, gpointer opaque)
+{
+    TLMProfStack *st = value;
+    FILE *f = opaque;
+    unsigned int i;
+
+    tlm_prof_put_fn(f, "fn", st->pc[0]);
+    fprintf(f, "0x" TARGET_FMT_lx " %" PRIu64 "\n", st->pc[0], st->count);
+
+    for (i = 1; i <= st->depth; i++) {
+        tlm_prof_put_fn(f, "fn", st->pc[i]);
+        tlm_prof_put_fn(f, "cfn", st->pc[i - 1]);
+        fprintf(f, "calls=%" PRIu64 " 0x" TARGET_FMT_lx "\n",
+                st->count, st->pc[i - 1]);
+        fprintf(f, "0x" TARGET_FMT_lx " %" PRIu64 "\n", st->pc[i], st->count);
+    }
+}
+
+static void tlm_prof_write(Notifier *notifier, void *data)
+{
+    FILE *f;
+
+    f = fopen(tlm_prof.filename, "w");
+    if (!f) {
+        perror(tlm_prof.filename);
+        return;
+    }
+
+    fprintf(f, "version: 1\n");
+    fprintf(f, "creator: tlmu\n");
+    fprintf(f, "positions: instr\n");
+    fprintf(f, "events: Samples\n");
+    fprintf(f, "summary: %" PRIu64 "\n\n", tlm_prof.nr_samples);
+    fprintf(f, "fl=guest\n");
+    g_hash_table_foreach(tlm_prof.samples, tlm_prof_put_stack, f);
+    fclose(f);
+}
+
+void tlm_set_profiling(const char *filename, uint64_t period_insns, int depth)
+{
+    g_free(tlm_prof.filename);
+    tlm_prof.filename = g_strdup(filename);
+    tlm_prof.period_insns = period_insns;
+    tlm_prof.depth = depth < 0 ? 0 : MIN(depth, TLM_PROF_MAX_DEPTH);
+}
+
+void tlm_prof_init(void)
+{
+    if (!tlm_prof.period_insns || !tlm_prof.filename || tlm_prof.timer) {
+        return;
+    }
+
+    if (use_icount) {
+        tlm_prof.period_ns = cpu_icount_to_ns(tlm_prof.period_insns);
+    } else {
+        fprintf(stderr, "%s: profiling without -icount, sampling every "
+                "%" PRIu64 " ns\n", __func__, tlm_prof.period_insns);
+        tlm_prof.period_ns = tlm_prof.period_insns;
+    }
+
+    tlm_prof.samples = g_hash_table_new_full(tlm_prof_hash, tlm_prof_equal,
+                                             NULL, g_free);
+    tlm_prof.timer = qemu_new_timer_ns(vm_clock, tlm_prof_tick, NULL);
+    qemu_mod_timer(tlm_prof.timer,
+                   qemu_get_clock_ns(vm_clock) + tlm_prof.period_ns);
+
+    tlm_prof.exit_notifier.notify = tlm_prof_write;
+    qemu_add_exit_notifier(&tlm_prof.exit_notifier);
+    D(printf("%s: period=%" PRId64 "ns depth=%d\n", __func__,
+             tlm_prof.period_ns, tlm_prof.depth));
+}
@@ -0,0 +1,654 @@
+/*
+ * Record and replay of the TLM traffic between TLMu and the main emulator.
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * When recording, the callbacks registered by the main emulator are wrapped
+ * and every bus access result, DMI grant, sync point and event notified into
+ * TLMu is appended to a log file. The RAM maps are logged first so that a
+ * replay can recreate them.
+ *
+ * When replaying, the callbacks are replaced with versions that feed the
+ * logged responses back into the emulator. No main emulator is needed, the
+ * library can be driven by a bare tlmu_run(). Bus accesses must come in the
+ * same order with the same address, direction, size and (for writes) data
+ * as when recording, otherwise the replay aborts. Events are stamped with
+ * the vm_clock time they were notified at and replayed from a timer at that
+ * time. An event still pending when a later bus access or DMI request is
+ * replayed is delivered right away, to keep the log order.
+ *
+ * Non-blocking transactions are not logged, they are disabled in both
+ * modes and everything goes through the blocking callbacks. Completions
+ * notified anyway are not logged either.
+ *
+ * DMI grants are logged with a snapshot of the granted memory. Memory that
+ * is written behind the back of TLMu while DMI is granted (e.g by SystemC
+ * DMA masters) is not tracked, such memories should not be mapped with DMI
+ * when recording.
+ */
+
+#include "hw/sysbus.h"
+#include "sysemu/sysemu.h"
+#include "qemu/timer.h"
+#include "qemu/thread.h"
+
+#include "tlm.h"
+
+#define D(x)
+
+#define TLM_RR_MAGIC "TLMURR02"
+#define TLM_RR_PAGE_SIZE 4096
+
+enum {
+    TLM_RR_RAM = 1,
+    TLM_RR_BUS,
+    TLM_RR_DMI,
+    TLM_RR_EVENT,
+    TLM_RR_SYNC,
+    TLM_RR_EOF = 0xff,
+};
+
+/* Fixed part of a record, the variable payload follows in the log.  */
+typedef struct TLMRRRecord {
+    uint8_t type;
+    int64_t clk;
+    uint64_t addr;
+    uint64_t size;
+    uint32_t ev;
+    uint32_t len;
+    uint8_t rw;
+    uint8_t ret;
+} TLMRRRecord;
+
+static struct {
+    int mode;
+    char *filename;
+    FILE *f;
+    QemuMutex lock;
+    uint64_t nr_records;
+    int64_t last_clk;
+
+    /* The main emulators callbacks while recording.  */
+    int (*bus_access_cb)(void *o, int64_t clk, int rw,
+                         uint64_t addr, void *data, int len);
+    int (*bus_access_cpu_cb)(void *o, int64_t clk, int cpu, int access,
+                             int rw, uint64_t addr, void *data, int len);
+    void (*get_dmi_ptr_cb)(void *o, uint64_t addr, struct tlmu_dmi *dmi);
+    void (*sync)(void *o, uint64_t time_ns);
+
+    /* Replay state.  */
+    TLMRRRecord next;
+    QEMUTimer *event_timer;
+    GHashTable *dmi_bufs;
+} tlm_rr;
+
+static void tlm_rr_put(const void *buf, size_t len)
+{
+    if (fwrite(buf, 1, len, tlm_rr.f) != len) {
+        perror(tlm_rr.filename);
+        exit(1);
+    }
+}
+
+static bool tlm_rr_get(void *buf, size_t len)
+{
+    return fread(buf, 1, len, tlm_rr.f) == len;
+}
+
+static void GCC_FMT_ATTR(1, 2) tlm_rr_diverged(const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "tlm-replay: %s diverged at record %" PRIu64
+            " clk=%" PRId64 ": ", tlm_rr.filename, tlm_rr.nr_records,
+            tlm_rr.last_clk);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+/*
+ * Dump a memory snapshot page by page. All zero pages are stored as a
+ * single marker byte to keep large and mostly empty RAMs cheap.
+ */
+static void tlm_rr_put_mem(const uint8_t *p, uint64_t size)
+{
+    static const uint8_t zero[TLM_RR_PAGE_SIZE];
+    uint64_t i;
+
+    for (i = 0; i < size; i += TLM_RR_PAGE_SIZE) {
+        size_t len = MIN(TLM_RR_PAGE_SIZE, size - i);
+        uint8_t has_data = memcmp(p + i, zero, len) != 0;
+
+        tlm_rr_put(&has_data, 1);
+        if (has_data) {
+            tlm_rr_put(p + i, len);
+        }
+    }
+}
+
+static void tlm_rr_get_mem(uint8_t *p, uint64_t size)
+{
+    uint64_t i;
+
+    for (i = 0; i < size; i += TLM_RR_PAGE_SIZE) {
+        size_t len = MIN(TLM_RR_PAGE_SIZE, size - i);
+        uint8_t has_data;
+
+        if (!tlm_rr_get(&has_data, 1)
+            || (has_data && !tlm_rr_get(p + i, len))) {
+            tlm_rr_diverged("truncated DMI snapshot");
+        }
+        if (!has_data) {
+            memset(p + i, 0, len);
+        }
+    }
+}
+
+static void tlm_rr_put_hdr(uint8_t type)
+{
+    tlm_rr_put(&type, 1);
+    tlm_rr.nr_records++;
+}
+
+/* Parse the fixed part of the next record into tlm_rr.next.  */
+static void tlm_rr_peek(void)
+{
+    TLMRRRecord *r = &tlm_rr.next;
+    bool ok = true;
+
+    memset(r, 0, sizeof *r);
+    if (!tlm_rr_get(&r->type, 1)) {
+        r->type = TLM_RR_EOF;
+        return;
+    }
+
+    switch (r->type) {
+    case TLM_RR_RAM:
+        ok = tlm_rr_get(&r->addr, 8) && tlm_rr_get(&r->size, 8)
+             && tlm_rr_get(&r->ev, 4) && tlm_rr_get(&r->len, 4);
+        break;
+    case TLM_RR_BUS:
+        ok = tlm_rr_get(&r->clk, 8) && tlm_rr_get(&r->rw, 1)
+             && tlm_rr_get(&r->ret, 1) && tlm_rr_get(&r->len, 4)
+             && tlm_rr_get(&r->addr, 8);
+        break;
+    case TLM_RR_DMI:
+        ok = tlm_rr_get(&r->addr, 8);
+        break;
+    case TLM_RR_EVENT:
+        ok = tlm_rr_get(&r->clk, 8) && tlm_rr_get(&r->ev, 4);
+        break;
+    case TLM_RR_SYNC:
+        ok = tlm_rr_get(&r->clk, 8);
+        break;
+    default:
+        ok = false;
+        break;
+    }
+
+    if (!ok) {
+        tlm_rr_diverged("corrupt record type %d", r->type);
+    }
+}
+
+/*
+ * Recording.
+ */
+static void tlm_rr_record_sync(void *o, uint64_t time_ns)
+{
+    int64_t clk = time_ns;
+
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_put_hdr(TLM_RR_SYNC);
+    tlm_rr_put(&clk, 8);
+    tlm_rr.last_clk = clk;
+    qemu_mutex_unlock(&tlm_rr.lock);
+
+    if (tlm_rr.sync) {
+        tlm_rr.sync(o, time_ns);
+    }
+}
+
+static void tlm_rr_put_bus_access(int64_t clk, int rw, int ret,
+                                  uint64_t addr, void *data, int len)
+{
+    uint8_t rw8 = rw, ret8 = ret;
+    uint32_t len32 = len;
+
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_put_hdr(TLM_RR_BUS);
+    tlm_rr_put(&clk, 8);
+    tlm_rr_put(&rw8, 1);
+    tlm_rr_put(&ret8, 1);
+    tlm_rr_put(&len32, 4);
+    tlm_rr_put(&addr, 8);
+    tlm_rr_put(data, len);
+    if (clk != -1) {
+        tlm_rr.last_clk = clk;
+    }
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+static int tlm_rr_record_bus_access(void *o, int64_t clk, int rw,
+                                    uint64_t addr, void *data, int len)
+{
+    int ret;
+
+    ret = tlm_rr.bus_access_cb(o, clk, rw, addr, data, len);
+    tlm_rr_put_bus_access(clk, rw, ret, addr, data, len);
+    return ret;
+}
+
+/* The CPU index and access kind are not logged, replays run with
+   tlm_bus_access_cb only.  */
+static int tlm_rr_record_bus_access_cpu(void *o, int64_t clk, int cpu,
+                                        int access, int rw, uint64_t addr,
+                                        void *data, int len)
+{
+    int ret;
+
+    ret = tlm_rr.bus_access_cpu_cb(o, clk, cpu, access, rw, addr, data, len);
+    tlm_rr_put_bus_access(clk, rw, ret, addr, data, len);
+    return ret;
+}
+
+static void tlm_rr_record_get_dmi_ptr(void *o, uint64_t addr,
+                                      struct tlmu_dmi *dmi)
+{
+    uint32_t prot, rlat, wlat;
+
+    tlm_rr.get_dmi_ptr_cb(o, addr, dmi);
+
+    prot = dmi->ptr ? dmi->prot : 0;
+    rlat = dmi->read_latency;
+    wlat = dmi->write_latency;
+
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_put_hdr(TLM_RR_DMI);
+    tlm_rr_put(&addr, 8);
+    tlm_rr_put(&dmi->base, 8);
+    tlm_rr_put(&dmi->size, 8);
+    tlm_rr_put(&prot, 4);
+    tlm_rr_put(&rlat, 4);
+    tlm_rr_put(&wlat, 4);
+    if (dmi->ptr) {
+        tlm_rr_put_mem(dmi->ptr, dmi->size);
+    }
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+void tlm_rr_event(enum tlmu_event ev, void *d)
+{
+    uint32_t ev32 = ev;
+    int64_t clk;
+
+    /* Non-blocking transactions are disabled while recording, there is
+       no transaction a completion could be replayed into.  */
+    if (tlm_rr.mode != TLMU_RR_RECORD || ev == TLMU_TLM_EVENT_NB_DONE) {
+        return;
+    }
+
+    clk = qemu_get_clock_ns(vm_clock);
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_put_hdr(TLM_RR_EVENT);
+    tlm_rr_put(&clk, 8);
+    tlm_rr_put(&ev32, 4);
+    switch (ev) {
+    case TLMU_TLM_EVENT_IRQ:
+    {
+        struct tlmu_irq *qirq = d;
+
+        tlm_rr_put(&qirq->addr, 8);
+        tlm_rr_put(&qirq->data, 4);
+        break;
+    }
+    case TLMU_TLM_EVENT_INVALIDATE_DMI:
+    case TLMU_TLM_EVENT_INVALIDATE_CODE:
+    {
+        struct tlmu_dmi *dmi = d;
+
+        tlm_rr_put(&dmi->base, 8);
+        tlm_rr_put(&dmi->size, 8);
+        break;
+    }
+    default:
+        break;
+    }
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+void tlm_rr_map_region(const char *name, uint64_t addr, uint64_t size,
+                       uint32_t flags)
+{
+    uint32_t len = strlen(name);
+
+    if (tlm_rr.mode != TLMU_RR_RECORD) {
+        return;
+    }
+
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_put_hdr(TLM_RR_RAM);
+    tlm_rr_put(&addr, 8);
+    tlm_rr_put(&size, 8);
+    tlm_rr_put(&flags, 4);
+    tlm_rr_put(&len, 4);
+    tlm_rr_put(name, len);
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+/*
+ * Replay.
+ */
+static void tlm_rr_replay_event(void)
+{
+    TLMRRRecord *r = &tlm_rr.next;
+    struct tlmu_irq qirq;
+    struct tlmu_dmi dmi;
+    void *d = NULL;
+    bool ok = true;
+
+    switch (r->ev) {
+    case TLMU_TLM_EVENT_IRQ:
+        ok = tlm_rr_get(&qirq.addr, 8) && tlm_rr_get(&qirq.data, 4);
+        d = &qirq;
+        break;
+    case TLMU_TLM_EVENT_INVALIDATE_DMI:
+    case TLMU_TLM_EVENT_INVALIDATE_CODE:
+        ok = tlm_rr_get(&dmi.base, 8) && tlm_rr_get(&dmi.size, 8);
+        d = &dmi;
+        break;
+    case TLMU_TLM_EVENT_NB_DONE:
+        tlm_rr_diverged("non-blocking completion in the log");
+        break;
+    default:
+        break;
+    }
+    if (!ok) {
+        tlm_rr_diverged("truncated event %d", r->ev);
+    }
+
+    D(printf("%s: ev=%d clk=%" PRId64 "\n", __func__, r->ev, r->clk));
+    tlm_rr.last_clk = r->clk;
+    tlm_rr.nr_records++;
+    tlm_notify_event(r->ev, d);
+}
+
+/* Arm the event timer if the next record is an event.  */
+static void tlm_rr_arm_event(void)
+{
+    if (tlm_rr.next.type == TLM_RR_EVENT) {
+        qemu_mod_timer(tlm_rr.event_timer, tlm_rr.next.clk);
+    }
+}
+
+/*
+ * Deliver pending events and skip sync points up to the next bus access or
+ * DMI request. If now is not -1, stop at the first event logged after now
+ * and arm the event timer for it. With now == -1 events are delivered
+ * early, the caller is about to consume the record that follows them.
+ */
+static void tlm_rr_replay_pending(int64_t now)
+{
+    TLMRRRecord *r = &tlm_rr.next;
+
+    for (;;) {
+        if (r->type == TLM_RR_SYNC) {
+            tlm_rr.last_clk = r->clk;
+            tlm_rr.nr_records++;
+        } else if (r->type == TLM_RR_EVENT) {
+            if (now != -1 && r->clk > now) {
+                tlm_rr_arm_event();
+                return;
+            }
+            tlm_rr_replay_event();
+        } else {
+            return;
+        }
+        tlm_rr_peek();
+    }
+}
+
+static void tlm_rr_event_timer_hit(void *opaque)
+{
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_replay_pending(qemu_get_clock_ns(vm_clock));
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+static void tlm_rr_replay_eof(void)
+{
+    fprintf(stderr, "tlm-replay: %s: end of log after %" PRIu64
+            " records\n", tlm_rr.filename, tlm_rr.nr_records);
+    qemu_system_shutdown_request();
+}
+
+static void tlm_rr_replay_sync(void *o, uint64_t time_ns)
+{
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_replay_pending(time_ns);
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+static int tlm_rr_replay_bus_access(void *o, int64_t clk, int rw,
+                                    uint64_t addr, void *data, int len)
+{
+    TLMRRRecord *r = &tlm_rr.next;
+    uint8_t buf[64];
+    int ret;
+
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_replay_pending(-1);
+
+    if (r->type == TLM_RR_EOF) {
+        tlm_rr_replay_eof();
+        if (!rw) {
+            memset(data, 0, len);
+        }
+        qemu_mutex_unlock(&tlm_rr.lock);
+        return 0;
+    }
+    if (r->type != TLM_RR_BUS || len > sizeof buf) {
+        tlm_rr_diverged("%s addr=%" PRIx64 " len=%d, log has record type %d",
+                        rw ? "write" : "read", addr, len, r->type);
+    }
+    if (r->rw != !!rw || r->addr != addr || r->len != len) {
+        tlm_rr_diverged("%s addr=%" PRIx64 " len=%d, log has %s addr=%"
+                        PRIx64 " len=%d", rw ? "write" : "read", addr, len,
+                        r->rw ? "write" : "read", r->addr, r->len);
+    }
+    if (!tlm_rr_get(buf, len)) {
+        tlm_rr_diverged("truncated bus access");
+    }
+    if (rw && memcmp(buf, data, len)) {
+        tlm_rr_diverged("write addr=%" PRIx64 " data differs", addr);
+    }
+    if (!rw) {
+        memcpy(data, buf, len);
+    }
+
+    if (r->clk != -1) {
+        tlm_rr.last_clk = r->clk;
+    }
+    tlm_rr.nr_records++;
+    ret = r->ret;
+    tlm_rr_peek();
+    tlm_rr_arm_event();
+    qemu_mutex_unlock(&tlm_rr.lock);
+    return ret;
+}
+
+static void tlm_rr_replay_get_dmi_ptr(void *o, uint64_t addr,
+                                      struct tlmu_dmi *dmi)
+{
+    TLMRRRecord *r = &tlm_rr.next;
+    uint32_t prot, rlat, wlat;
+    uint8_t *buf;
+
+    qemu_mutex_lock(&tlm_rr.lock);
+    tlm_rr_replay_pending(-1);
+
+    if (r->type != TLM_RR_DMI || r->addr != addr) {
+        tlm_rr_diverged("DMI request addr=%" PRIx64 ", log has record "
+                        "type %d addr=%" PRIx64, addr, r->type, r->addr);
+    }
+    if (!tlm_rr_get(&dmi->base, 8) || !tlm_rr_get(&dmi->size, 8)
+        || !tlm_rr_get(&prot, 4) || !tlm_rr_get(&rlat, 4)
+        || !tlm_rr_get(&wlat, 4)) {
+        tlm_rr_diverged("truncated DMI grant");
+    }
+
+    dmi->ptr = NULL;
+    dmi->prot = prot;
+    dmi->read_latency = rlat;
+    dmi->write_latency = wlat;
+    if (prot) {
+        /* Keep one buffer per DMI base so that pointers handed out
+           earlier stay valid across re-grants.  */
+        buf = g_hash_table_lookup(tlm_rr.dmi_bufs, &dmi->base);
+        if (!buf) {
+            uint64_t *key = g_new(uint64_t, 1);
+
+            *key = dmi->base;
+            buf = g_malloc0(dmi->size + 1);
+            g_hash_table_insert(tlm_rr.dmi_bufs, key, buf);
+        }
+        tlm_rr_get_mem(buf, dmi->size);
+        dmi->ptr = buf;
+    }
+
+    tlm_rr.nr_records++;
+    tlm_rr_peek();
+    tlm_rr_arm_event();
+    qemu_mutex_unlock(&tlm_rr.lock);
+}
+
+/* Debug accesses are not logged, reads from a replay return zeroes.  */
+static void tlm_rr_replay_bus_access_dbg(void *o, int64_t clk, int rw,
+                                         uint64_t addr, void *data, int len)
+{
+    if (!rw) {
+        memset(data, 0, len);
+    }
+}
+
+/*
+ * Recreate the logged RAM maps. tlm_map_region() prepends to the list of RAMs,
+ * so map them in reverse to get the DMI requests in the logged order.
+ */
+static void tlm_rr_replay_rams(void)
+{
+    TLMRRRecord *r = &tlm_rr.next;
+    GSList *rams = NULL, *l;
+
+    while (r->type == TLM_RR_RAM) {
+        TLMRRRecord *ram = g_memdup(r, sizeof *r);
+        char *name = g_malloc0(r->len + 1);
+
+        if (!tlm_rr_get(name, r->len)) {
+            tlm_rr_diverged("truncated RAM map");
+        }
+        rams = g_slist_prepend(rams, ram);
+        rams = g_slist_prepend(rams, name);
+        tlm_rr.nr_records++;
+        tlm_rr_peek();
+    }
+
+    for (l = rams; l; l = l->next->next) {
+        char *name = l->data;
+        TLMRRRecord *ram = l->next->data;
+
+        tlm_map_region(name, ram->addr, ram->size, ram->ev);
+        g_free(name);
+        g_free(ram);
+    }
+    g_slist_free(rams);
+}
+
+void tlm_set_record_replay(int mode, const char *filename)
+{
+    tlm_rr.mode = mode;
+    g_free(tlm_rr.filename);
+    tlm_rr.filename = g_strdup(filename);
+}
+
+void tlm_rr_init(void)
+{
+    char magic[8];
+
+    if (tlm_rr.mode == TLMU_RR_OFF || tlm_rr.f) {
+        return;
+    }
+
+    qemu_mutex_init(&tlm_rr.lock);
+    tlm_rr.f = fopen(tlm_rr.filename,
+                     tlm_rr.mode == TLMU_RR_RECORD ? "wb" : "rb");
+    if (!tlm_rr.f) {
+        perror(tlm_rr.filename);
+        exit(1);
+    }
+
+    tlm_nb_access_cb = NULL;
+
+    if (tlm_rr.mode == TLMU_RR_RECORD) {
+        tlm_rr_put(TLM_RR_MAGIC, 8);
+
+        tlm_rr.bus_access_cb = tlm_bus_access_cb;
+        tlm_rr.bus_access_cpu_cb = tlm_bus_access_cpu_cb;
+        tlm_rr.get_dmi_ptr_cb = tlm_get_dmi_ptr_cb;
+        tlm_rr.sync = tlm_sync;
+        tlm_bus_access_cb = tlm_rr_record_bus_access;
+        if (tlm_bus_access_cpu_cb) {
+            tlm_bus_access_cpu_cb = tlm_rr_record_bus_access_cpu;
+        }
+        if (tlm_get_dmi_ptr_cb) {
+            tlm_get_dmi_ptr_cb = tlm_rr_record_get_dmi_ptr;
+        }
+        tlm_sync = tlm_rr_record_sync;
+        return;
+    }
+
+    if (!tlm_rr_get(magic, 8) || memcmp(magic, TLM_RR_MAGIC, 8)) {
+        fprintf(stderr, "tlm-replay: %s is not a TLMu log\n",
+                tlm_rr.filename);
+        exit(1);
+    }
+
+    tlm_rr.dmi_bufs = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            g_free, NULL);
+    tlm_rr.event_timer = qemu_new_timer_ns(vm_clock,
+                                           tlm_rr_event_timer_hit, NULL);
+    tlm_bus_access_cb = tlm_rr_replay_bus_access;
+    tlm_bus_access_cpu_cb = NULL;
+    if (!tlm_bus_access_dbg_cb) {
+        tlm_bus_access_dbg_cb = tlm_rr_replay_bus_access_dbg;
+    }
+    tlm_get_dmi_ptr_cb = tlm_rr_replay_get_dmi_ptr;
+    tlm_sync = tlm_rr_replay_sync;
+
+    tlm_rr_peek();
+    tlm_rr_replay_rams();
+    tlm_rr_arm_event();
+}
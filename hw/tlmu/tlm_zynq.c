@@ -28,6 +28,7 @@
 #include "hw/fdt_generic_devices.h"
 
 #include "hw/arm/arm.h"
+#include "hw/xilinx.h"
 
 #include "tlm.h"
 #include "hw/tlm_mem.h"
@@ -150,6 +151,11 @@ fail:
 
 static struct arm_boot_info tlm_zynq_binfo = {};
 
+static void tlm_zynq_bitstream(void *opaque, const uint8_t *buf, int len)
+{
+    tlm_bitstream_cb(tlm_opaque, buf, len);
+}
+
 static void tlm_zynq_init(QEMUMachineInitArgs *args)
 {
     const char *cpu_model = args->cpu_model;
@@ -159,6 +165,7 @@ static void tlm_zynq_init(QEMUMachineInitArgs *args)
     qemu_irq cpu_irq[MAX_CPUS+1];
     DeviceState *dev;
     SysBusDevice *busdev;
+    Object *devcfg;
     memset(cpu_irq, 0, sizeof(cpu_irq));
 
     void *fdt;
@@ -241,6 +248,12 @@ static void tlm_zynq_init(QEMUMachineInitArgs *args)
     irqs = zynq_get_irqs(fdti);
     fdt_init_destroy_fdti(fdti);
 
+    /* Hand bitstreams loaded through PCAP over to the SystemC world.  */
+    devcfg = object_resolve_path_type("", TYPE_XILINX_DEVCFG, NULL);
+    if (devcfg && tlm_bitstream_cb) {
+        xilinx_devcfg_set_sink(DEVICE(devcfg), tlm_zynq_bitstream, NULL);
+    }
+
     tlm_zynq_binfo.fdt = fdt;
     tlm_zynq_binfo.fdt_size = fdt_size;
 
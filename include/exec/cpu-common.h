@@ -61,6 +61,8 @@ int cpu_physical_memory_rw(hwaddr addr, uint8_t *buf,
                             int len, int is_write);
 void cpu_physical_memory_rw_debug(hwaddr addr, uint8_t *buf,
                             int len, int is_write);
+int cpu_physical_memory_rw_cached(hwaddr addr, uint8_t *buf,
+                                  int len, int is_write);
 void *qemu_map_paddr_to_host(hwaddr *paddr_p, int *len);
 
 static inline void cpu_physical_memory_read(hwaddr addr,
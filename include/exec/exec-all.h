@@ -372,6 +372,14 @@ uint64_t io_mem_read(struct MemoryRegion *mr, hwaddr addr,
 void io_mem_write(struct MemoryRegion *mr, hwaddr addr,
                   uint64_t value, unsigned size);
 
+/* Region the softmmu of this thread is dispatching a guest access to, and
+   the kind of access (0 load, 1 store, 2 code fetch, as for tlb_fill).
+   NULL when the access comes from anything else, e.g device DMA.  */
+DECLARE_TLS(struct MemoryRegion *, tlm_cpu_access_mr);
+#define tlm_cpu_access_mr tls_var(tlm_cpu_access_mr)
+DECLARE_TLS(int, tlm_cpu_access_type);
+#define tlm_cpu_access_type tls_var(tlm_cpu_access_type)
+
 void tlb_fill(CPUArchState *env1, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr);
 
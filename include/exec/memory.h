@@ -460,6 +460,21 @@ bool memory_region_get_dirty(MemoryRegion *mr, hwaddr addr,
 void memory_region_set_dirty(MemoryRegion *mr, hwaddr addr,
                              hwaddr size);
 
+/**
+ * memory_region_invalidate_code: Drop translated code from a range of a
+ *                                RAM region.
+ *
+ * For RAM whose contents changed without going through the softmmu,
+ * e.g. a region created with memory_region_init_ram_ptr() over storage
+ * that a device modifies.
+ *
+ * @mr: the memory region being modified.
+ * @addr: the address (relative to the start of the region) of the range.
+ * @size: size of the range.
+ */
+void memory_region_invalidate_code(MemoryRegion *mr, hwaddr addr,
+                                   hwaddr size);
+
 /**
  * memory_region_test_and_clear_dirty: Check whether a range of bytes is dirty
  *                                     for a specified client. It clears them.
@@ -17,6 +17,7 @@
 
 typedef struct RegisterInfo RegisterInfo;
 typedef struct RegisterAccessInfo RegisterAccessInfo;
+typedef struct RegisterInfoArray RegisterInfoArray;
 
 /**
  * A register access error message
@@ -34,6 +35,7 @@ typedef struct RegisterAccessError {
  * state.
  *
  * @name: String name of the register
+ * @addr: Offset of the register within its block, see register_init_block32
  * @ro: whether or not the bit is read-only
  * @wo: Bits that are write only (read as reset value)
  * @w1c: bits with the common write 1 to clear semantic.
@@ -61,6 +63,7 @@ typedef struct RegisterAccessError {
 
 struct RegisterAccessInfo {
     const char *name;
+    hwaddr addr;
     uint64_t ro;
     uint64_t wo;
     uint64_t w1c;
@@ -95,6 +98,10 @@ struct RegisterAccessInfo {
  * @opaque: Opaque data for the register
  *
  * @mem: optional Memory region for the register
+ *
+ * @fast_read: Reads have no side effects, set up by register_init_block32
+ * @fast_write: Writes have no side effects, set up by register_init_block32
+ * @checked: Writes are checked against the ge/ui tables when logging is on
  */
 
 struct RegisterInfo {
@@ -110,6 +117,26 @@ struct RegisterInfo {
     void *opaque;
 
     MemoryRegion mem;
+
+    bool fast_read;
+    bool fast_write;
+    bool checked;
+};
+
+/**
+ * A block of 32 bit registers decoded through a single memory region
+ * @mem: Memory region covering the whole block
+ * @r: RegisterInfo for every word of the block, indexed by offset / 4. Holes
+ * have no access description.
+ * @num_elements: Number of words in the block
+ * @prefix: String prefix for log and debug messages
+ */
+
+struct RegisterInfoArray {
+    MemoryRegion mem;
+    RegisterInfo *r;
+    int num_elements;
+    const char *prefix;
 };
 
 /**
@@ -144,4 +171,40 @@ void register_write_memory_le(void *opaque, hwaddr addr, uint64_t value,
 uint64_t register_read_memory_be(void *opaque, hwaddr addr, unsigned size);
 uint64_t register_read_memory_le(void *opaque, hwaddr addr, unsigned size);
 
+/**
+ * Set up a block of 32 bit registers from a static table
+ * @rae: Table of access descriptions, in any order, located by their addr
+ * @num: Number of entries in rae
+ * @ri: RegisterInfo array, one element per word of the block
+ * @data: Register storage, one element per word of the block
+ * @ops: Memory region ops, normally with the register_block_*_memory_*
+ * handlers and the opaque set to the returned RegisterInfoArray
+ * @debug: Whether or not verbose debug is enabled
+ * @prefix: String prefix for log and debug messages
+ * @opaque: Opaque data for the registers
+ * @memory_size: Size of the block in bytes
+ * returns: The block, map its mem field to make it guest accessible
+ *
+ * Decoding a guest access is an array lookup. Registers without side effect
+ * hooks, debug and (unless guest error or unimplemented logging is enabled)
+ * error tables are accessed without going through register_read/write.
+ */
+
+RegisterInfoArray *register_init_block32(const RegisterAccessInfo *rae,
+                                         int num, RegisterInfo *ri,
+                                         uint32_t *data,
+                                         const MemoryRegionOps *ops,
+                                         bool debug, const char *prefix,
+                                         void *opaque, uint64_t memory_size);
+
+void register_block_write_memory_be(void *opaque, hwaddr addr, uint64_t value,
+                                    unsigned size);
+void register_block_write_memory_le(void *opaque, hwaddr addr, uint64_t value,
+                                    unsigned size);
+
+uint64_t register_block_read_memory_be(void *opaque, hwaddr addr,
+                                       unsigned size);
+uint64_t register_block_read_memory_le(void *opaque, hwaddr addr,
+                                       unsigned size);
+
 #endif
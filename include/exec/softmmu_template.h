@@ -77,17 +77,25 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
     }
 
     env->mem_io_vaddr = addr;
+    tlm_cpu_access_mr = mr;
+    tlm_cpu_access_type = READ_ACCESS_TYPE;
 #if SHIFT <= 2
     res = io_mem_read(mr, physaddr, 1 << SHIFT);
 #else
+    if (mr->ops->impl.max_access_size >= 8) {
+        /* The region takes 64-bit accesses in one go.  */
+        res = io_mem_read(mr, physaddr, 8);
+    } else {
 #ifdef TARGET_WORDS_BIGENDIAN
-    res = io_mem_read(mr, physaddr, 4) << 32;
-    res |= io_mem_read(mr, physaddr + 4, 4);
+        res = io_mem_read(mr, physaddr, 4) << 32;
+        res |= io_mem_read(mr, physaddr + 4, 4);
 #else
-    res = io_mem_read(mr, physaddr, 4);
-    res |= io_mem_read(mr, physaddr + 4, 4) << 32;
+        res = io_mem_read(mr, physaddr, 4);
+        res |= io_mem_read(mr, physaddr + 4, 4) << 32;
 #endif
+    }
 #endif /* SHIFT > 2 */
+    tlm_cpu_access_mr = NULL;
     return res;
 }
 
@@ -229,17 +237,24 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
 
     env->mem_io_vaddr = addr;
     env->mem_io_pc = retaddr;
+    tlm_cpu_access_mr = mr;
+    tlm_cpu_access_type = 1;
 #if SHIFT <= 2
     io_mem_write(mr, physaddr, val, 1 << SHIFT);
 #else
+    if (mr->ops->impl.max_access_size >= 8) {
+        io_mem_write(mr, physaddr, val, 8);
+    } else {
 #ifdef TARGET_WORDS_BIGENDIAN
-    io_mem_write(mr, physaddr, (val >> 32), 4);
-    io_mem_write(mr, physaddr + 4, (uint32_t)val, 4);
+        io_mem_write(mr, physaddr, (val >> 32), 4);
+        io_mem_write(mr, physaddr + 4, (uint32_t)val, 4);
 #else
-    io_mem_write(mr, physaddr, (uint32_t)val, 4);
-    io_mem_write(mr, physaddr + 4, val >> 32, 4);
+        io_mem_write(mr, physaddr, (uint32_t)val, 4);
+        io_mem_write(mr, physaddr + 4, val >> 32, 4);
 #endif
+    }
 #endif /* SHIFT > 2 */
+    tlm_cpu_access_mr = NULL;
 }
 
 void glue(glue(helper_st, SUFFIX), MMUSUFFIX)(CPUArchState *env,
@@ -53,6 +53,20 @@ typedef struct SSISlaveClass {
      * always be called for the device for every txrx access to the parent bus
      */
     uint32_t (*transfer_raw)(SSISlave *dev, uint32_t val);
+
+    /* Optional. Same as calling transfer for each byte of tx, storing the
+     * results in rx. Only used with the standard CS behaviour.
+     */
+    void (*transfer_bulk)(SSISlave *dev, const uint8_t *tx, uint8_t *rx,
+                          int len);
+
+    /* Optional, for memory devices. Return the storage read by command cmd
+     * followed by hdr_bytes of address, mode and dummy bytes, or NULL if
+     * that is not a plain read. Lets masters map the storage for execute
+     * in place. gen changes whenever the storage is modified.
+     */
+    uint8_t *(*get_xip_storage)(SSISlave *dev, uint8_t cmd, int hdr_bytes,
+                                uint64_t *size, uint32_t *gen);
 } SSISlaveClass;
 
 struct SSISlave {
@@ -82,6 +96,12 @@ DeviceState *ssi_create_slave_no_init(SSIBus *bus, const char *name);
 SSIBus *ssi_create_bus(DeviceState *parent, const char *name);
 
 uint32_t ssi_transfer(SSIBus *bus, uint32_t val);
+/* Same as ssi_transfer() for each byte of tx, results go to rx.  */
+void ssi_transfer_bulk(SSIBus *bus, const uint8_t *tx, uint8_t *rx, int len);
+
+/* Storage of the only slave on bus, see SSISlaveClass::get_xip_storage.  */
+uint8_t *ssi_get_xip_storage(SSIBus *bus, uint8_t cmd, int hdr_bytes,
+                             uint64_t *size, uint32_t *gen);
 
 /* Automatically connect all children nodes a spi controller as slaves */
 void ssi_auto_connect_slaves(DeviceState *parent, qemu_irq *cs_line,
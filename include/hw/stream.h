@@ -29,7 +29,8 @@ typedef struct StreamSlaveClass {
      * one byte of data. Returns false if cannot accept. If not implemented, the
      * slave is assumed to always be capable of receiving.
      * @notify: Optional callback that the slave will call when the slave is
-     * capable of receiving again. Only called if false is returned.
+     * capable of receiving again. Only called if false is returned. A NULL
+     * @notify cancels a previously armed callback.
      * @notify_opaque: opaque data to pass to notify call.
      */
     bool (*can_push)(StreamSlave *obj, StreamCanPushNotifyFn notify,
@@ -48,15 +49,49 @@ typedef struct StreamSlaveClass {
      */
     size_t (*push)(StreamSlave *obj, unsigned char *buf, size_t len,
                    uint32_t attr);
+    /**
+     * push_iov - push a vector of data to a Stream slave. Same semantics as
+     * push(), the slave may consume only a part of the data and returns the
+     * number of bytes consumed. The attributes apply to the last byte, so
+     * EOP only takes effect if everything was consumed. A slave implementing
+     * push_iov may leave push unset.
+     * @obj: Stream slave to push to
+     * @iov: Data to write
+     * @iovcnt: Number of entries in @iov
+     * @attr: Attributes.
+     */
+    size_t (*push_iov)(StreamSlave *obj, const struct iovec *iov, int iovcnt,
+                       uint32_t attr);
 } StreamSlaveClass;
 
 size_t
 stream_push(StreamSlave *sink, uint8_t *buf, size_t len, uint32_t attr);
 
+size_t
+stream_push_iov(StreamSlave *sink, const struct iovec *iov, int iovcnt,
+                uint32_t attr);
+
 bool
 stream_can_push(StreamSlave *sink, StreamCanPushNotifyFn notify,
                 void *notify_opaque);
 
+void
+stream_can_push_cancel(StreamSlave *sink);
+
+/*
+ * Ready notification for slaves implementing can_push. A slave that refuses
+ * data arms it from can_push with stream_ready_wait() and calls
+ * stream_ready() once it can accept again, the callback fires once.
+ */
+typedef struct StreamReadyNotifier {
+    StreamCanPushNotifyFn notify;
+    void *opaque;
+} StreamReadyNotifier;
+
+void stream_ready_wait(StreamReadyNotifier *n, StreamCanPushNotifyFn notify,
+                       void *notify_opaque);
+void stream_ready(StreamReadyNotifier *n);
+
 static inline bool stream_attr_has_eop(uint32_t attr)
 {
     return (attr & STREAM_ATTR_EOP) != 0;
@@ -93,4 +93,12 @@ xilinx_axidma_init(DeviceState *dev, StreamSlave *ds, StreamSlave *cs,
     sysbus_connect_irq(SYS_BUS_DEVICE(dev), 1, irq2);
 }
 
+/* Zynq devcfg.  */
+#define TYPE_XILINX_DEVCFG "xlnx.ps7-dev-cfg"
+
+/* Gets the bitstream written to the PL through PCAP, in DMA sized pieces.  */
+typedef void XilinxDevcfgSink(void *opaque, const uint8_t *buf, int len);
+void xilinx_devcfg_set_sink(DeviceState *dev, XilinxDevcfgSink *sink,
+                            void *opaque);
+
 #endif
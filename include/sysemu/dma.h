@@ -288,6 +288,27 @@ BlockDriverAIOCB *dma_bdrv_write(BlockDriverState *bs,
 uint64_t dma_buf_read(uint8_t *ptr, int32_t len, QEMUSGList *sg);
 uint64_t dma_buf_write(uint8_t *ptr, int32_t len, QEMUSGList *sg);
 
+/*
+ * Asynchronous versions of dma_buf_read/write. Parts of the transfer that
+ * land in memories modelled outside of QEMU may complete after the call
+ * returns. ptr must stay valid until cb is called, cb is always called from
+ * a bottom half. sg may be destroyed when the call returns.
+ */
+uint64_t dma_buf_read_async(uint8_t *ptr, int32_t len, QEMUSGList *sg,
+                            BlockDriverCompletionFunc *cb, void *opaque);
+uint64_t dma_buf_write_async(uint8_t *ptr, int32_t len, QEMUSGList *sg,
+                             BlockDriverCompletionFunc *cb, void *opaque);
+
+/*
+ * Hook for memories modelled outside of QEMU (e.g TLMu). Returns 0 if the
+ * access was queued, cb is then called when it completes. Otherwise the
+ * access is done synchronously with dma_memory_rw.
+ */
+typedef int DMAAsyncRWFunc(dma_addr_t addr, void *buf, dma_addr_t len,
+                           DMADirection dir,
+                           BlockDriverCompletionFunc *cb, void *opaque);
+extern DMAAsyncRWFunc *dma_async_rw_func;
+
 void dma_acct_start(BlockDriverState *bs, BlockAcctCookie *cookie,
                     QEMUSGList *sg, enum BlockAcctType type);
 
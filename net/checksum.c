@@ -21,17 +21,171 @@
 #define PROTO_TCP  6
 #define PROTO_UDP 17
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+/*
+ * Ones-complement sums do not depend on the byte order the 16-bit words
+ * are read in (RFC 1071). The kernels below sum host order words of an
+ * even length buffer into a 64-bit accumulator, the caller folds the
+ * result and swaps it into network order once.
+ */
+static uint64_t net_checksum_sum_generic(const uint8_t *buf, size_t len)
 {
-    uint32_t sum = 0;
+    uint64_t sum = 0;
+    uint64_t w;
+    uint16_t h;
+
+    /* 2^32 == 1 modulo 0xffff, so 32-bit halves can be added as is.  */
+    while (len >= 8) {
+        memcpy(&w, buf, 8);
+        sum += (w & 0xffffffff) + (w >> 32);
+        buf += 8;
+        len -= 8;
+    }
+    while (len >= 2) {
+        memcpy(&h, buf, 2);
+        sum += h;
+        buf += 2;
+        len -= 2;
+    }
+    return sum;
+}
+
+/*
+ * The vector kernels widen the 16-bit words into 32-bit lanes. Every
+ * block adds at most 2 * 0xffff to a lane, so the lanes are drained into
+ * the 64-bit sum every NET_CHECKSUM_LANE_BLOCKS blocks.
+ */
+#define NET_CHECKSUM_LANE_BLOCKS 16384
+
+#ifdef __SSE2__
+static uint64_t net_checksum_sum_sse2(const uint8_t *buf, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t lanes[4];
+    uint64_t sum = 0;
+    size_t n;
+
+    while (len >= 16) {
+        __m128i acc = zero;
+
+        n = MIN(len / 16, NET_CHECKSUM_LANE_BLOCKS);
+        len -= n * 16;
+        while (n--) {
+            __m128i v = _mm_loadu_si128((const __m128i *)buf);
+
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            buf += 16;
+        }
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + net_checksum_sum_generic(buf, len);
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <cpuid.h>
+#include <immintrin.h>
+
+static uint64_t net_checksum_sum_avx2(const uint8_t *buf, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t lanes[8];
+    uint64_t sum = 0;
+    size_t n;
     int i;
 
-    for (i = seq; i < seq + len; i++) {
-        if (i & 1) {
-            sum += (uint32_t)buf[i - seq];
-        } else {
-            sum += (uint32_t)buf[i - seq] << 8;
+    while (len >= 32) {
+        __m256i acc = zero;
+
+        n = MIN(len / 32, NET_CHECKSUM_LANE_BLOCKS);
+        len -= n * 32;
+        while (n--) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            buf += 32;
         }
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+    return sum + net_checksum_sum_generic(buf, len);
+}
+#pragma GCC pop_options
+
+#ifndef bit_AVX2
+#define bit_AVX2 (1 << 5)
+#endif
+#ifndef bit_OSXSAVE
+#define bit_OSXSAVE (1 << 27)
+#endif
+#endif
+
+#ifdef __SSE2__
+static uint64_t (*net_checksum_sum)(const uint8_t *buf, size_t len) =
+    net_checksum_sum_sse2;
+#else
+static uint64_t (*net_checksum_sum)(const uint8_t *buf, size_t len) =
+    net_checksum_sum_generic;
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((constructor)) net_checksum_init(void)
+{
+    unsigned int a, b, c, d, xcr0_lo, xcr0_hi;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return;
+    }
+    __cpuid(1, a, b, c, d);
+    if (!(c & bit_OSXSAVE)) {
+        return;
+    }
+    /* The OS has to save the YMM state.  */
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6) {
+        return;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    if (b & bit_AVX2) {
+        net_checksum_sum = net_checksum_sum_avx2;
+    }
+}
+#endif
+
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    uint64_t wsum;
+    uint32_t sum = 0;
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    if (seq & 1) {
+        /* Low byte of a word started by the previous chunk.  */
+        sum += buf[0];
+        buf++;
+        len--;
+    }
+
+    if (len >= 64) {
+        wsum = net_checksum_sum(buf, len & ~1);
+    } else {
+        wsum = net_checksum_sum_generic(buf, len & ~1);
+    }
+    while (wsum >> 16) {
+        wsum = (wsum & 0xffff) + (wsum >> 16);
+    }
+    sum += be16_to_cpu(wsum);
+
+    if (len & 1) {
+        sum += (uint32_t)buf[len - 1] << 8;
     }
     return sum;
 }
@@ -9,6 +9,7 @@
  */
 
 #include "exec/register.h"
+#include "qemu/bswap.h"
 #include "qemu/log.h"
 
 static inline void register_write_log(RegisterInfo *reg, int dir, uint64_t val,
@@ -24,6 +25,33 @@ static inline void register_write_val(RegisterInfo *reg, uint64_t val)
 {
     int i;
 
+    switch (reg->data_size) {
+    case 1:
+        reg->data[0] = val;
+        return;
+    case 2:
+        if (reg->data_big_endian) {
+            stw_be_p(reg->data, val);
+        } else {
+            stw_le_p(reg->data, val);
+        }
+        return;
+    case 4:
+        if (reg->data_big_endian) {
+            stl_be_p(reg->data, val);
+        } else {
+            stl_le_p(reg->data, val);
+        }
+        return;
+    case 8:
+        if (reg->data_big_endian) {
+            stq_be_p(reg->data, val);
+        } else {
+            stq_le_p(reg->data, val);
+        }
+        return;
+    }
+
     for (i = 0; i < reg->data_size; ++i) {
         reg->data[i] = val >> (reg->data_big_endian ?
                     8 * (reg->data_size - 1 - i) : 8 * i);
@@ -35,6 +63,20 @@ static inline uint64_t register_read_val(RegisterInfo *reg)
     uint64_t ret = 0;
     int i;
 
+    switch (reg->data_size) {
+    case 1:
+        return reg->data[0];
+    case 2:
+        return reg->data_big_endian ? lduw_be_p(reg->data)
+                                    : lduw_le_p(reg->data);
+    case 4:
+        return (uint32_t)(reg->data_big_endian ? ldl_be_p(reg->data)
+                                               : ldl_le_p(reg->data));
+    case 8:
+        return reg->data_big_endian ? ldq_be_p(reg->data)
+                                    : ldq_le_p(reg->data);
+    }
+
     for (i = 0; i < reg->data_size; ++i) {
         ret |= (uint64_t)reg->data[i] << (reg->data_big_endian ?
                     8 * (reg->data_size - 1 - i) : 8 * i);
@@ -42,28 +84,27 @@ static inline uint64_t register_read_val(RegisterInfo *reg)
     return ret;
 }
 
-void register_write(RegisterInfo *reg, uint64_t val, uint64_t we)
+/* The value a register takes when val is written with write enables we.  */
+static inline uint64_t register_write_masked(const RegisterAccessInfo *ac,
+                                             uint64_t old_val, uint64_t val,
+                                             uint64_t we)
 {
-    uint64_t old_val, new_val, test;
-    const RegisterAccessInfo *ac;
-    const RegisterAccessError *rae;
-
-    assert(reg);
-
-    ac = reg->access;
-    if (!ac || !ac->name) {
-        qemu_log_mask(LOG_GUEST_ERROR, "%s: write to undefined device state "
-                      "(written value: %#" PRIx64 ")\n", reg->prefix, val);
-        return;
-    }
+    uint64_t no_w0_mask = ac->ro | ac->w1c | ac->nw0 | ~we;
+    uint64_t no_w1_mask = ac->ro | ac->w1c | ac->nw1 | ~we;
+    uint64_t new_val;
 
-    uint32_t no_w0_mask = ac->ro | ac->w1c | ac->nw0 | ~we;
-    uint32_t no_w1_mask = ac->ro | ac->w1c | ac->nw1 | ~we;
+    new_val = val & ~(no_w1_mask & val);
+    new_val |= no_w1_mask & old_val & val;
+    new_val |= no_w0_mask & old_val & ~val;
+    new_val &= ~(val & ac->w1c);
+    return new_val;
+}
 
-    if (reg->debug) {
-        qemu_log("%s:%s: write of value %#" PRIx64 "\n", reg->prefix, ac->name,
-                 val);
-    }
+static void register_write_check(RegisterInfo *reg, uint64_t val)
+{
+    const RegisterAccessInfo *ac = reg->access;
+    const RegisterAccessError *rae;
+    uint64_t test;
 
     if (qemu_loglevel_mask(LOG_GUEST_ERROR)) {
         for (rae = ac->ge1; rae && rae->mask; rae++) {
@@ -98,14 +139,34 @@ void register_write(RegisterInfo *reg, uint64_t val, uint64_t we)
             }
         }
     }
+}
+
+void register_write(RegisterInfo *reg, uint64_t val, uint64_t we)
+{
+    uint64_t old_val, new_val;
+    const RegisterAccessInfo *ac;
+
+    assert(reg);
+
+    ac = reg->access;
+    if (!ac || !ac->name) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: write to undefined device state "
+                      "(written value: %#" PRIx64 ")\n", reg->prefix, val);
+        return;
+    }
+
+    if (reg->debug) {
+        qemu_log("%s:%s: write of value %#" PRIx64 "\n", reg->prefix, ac->name,
+                 val);
+    }
+
+    if (qemu_loglevel_mask(LOG_GUEST_ERROR | LOG_UNIMP)) {
+        register_write_check(reg, val);
+    }
 
     assert(reg->data);
     old_val = register_read_val(reg);
-
-    new_val = val & ~(no_w1_mask & val);
-    new_val |= no_w1_mask & old_val & val;
-    new_val |= no_w0_mask & old_val & ~val;
-    new_val &= ~(val & ac->w1c);
+    new_val = register_write_masked(ac, old_val, val, we);
 
     if (ac->pre_write) {
         new_val = ac->pre_write(reg, new_val);
@@ -205,3 +266,99 @@ uint64_t register_read_memory_le(void *opaque, hwaddr addr, unsigned size)
 {
     return register_read_memory(opaque, addr, size, false);
 }
+
+RegisterInfoArray *register_init_block32(const RegisterAccessInfo *rae,
+                                         int num, RegisterInfo *ri,
+                                         uint32_t *data,
+                                         const MemoryRegionOps *ops,
+                                         bool debug, const char *prefix,
+                                         void *opaque, uint64_t memory_size)
+{
+    RegisterInfoArray *ra = g_new0(RegisterInfoArray, 1);
+    int i;
+
+    ra->r = ri;
+    ra->num_elements = memory_size / sizeof(uint32_t);
+    ra->prefix = prefix;
+
+    for (i = 0; i < ra->num_elements; i++) {
+        ri[i] = (RegisterInfo) {
+            .data = (uint8_t *)&data[i],
+            .data_size = sizeof(uint32_t),
+#if defined(HOST_WORDS_BIGENDIAN)
+            .data_big_endian = true,
+#endif
+            .debug = debug,
+            .prefix = prefix,
+            .opaque = opaque,
+        };
+    }
+
+    for (i = 0; i < num; i++) {
+        const RegisterAccessInfo *ac = &rae[i];
+        int index = ac->addr / sizeof(uint32_t);
+        RegisterInfo *r = &ri[index];
+
+        assert(!(ac->addr & 3) && index < ra->num_elements && !r->access);
+        r->access = ac;
+        r->fast_read = !debug && !ac->pre_read && !ac->post_read
+                       && !ac->cor && !ac->wo;
+        r->fast_write = !debug && !ac->pre_write && !ac->post_write;
+        r->checked = ac->ge0 || ac->ge1 || ac->ui0 || ac->ui1;
+    }
+
+    memory_region_init_io(&ra->mem, ops, ra, prefix, memory_size);
+    return ra;
+}
+
+static inline void register_block_write_memory(void *opaque, hwaddr addr,
+                                               uint64_t value, unsigned size,
+                                               bool be)
+{
+    RegisterInfoArray *ra = opaque;
+    RegisterInfo *reg = &ra->r[addr / sizeof(uint32_t)];
+    uint32_t *data = (uint32_t *)reg->data;
+
+    if (likely(size == 4 && reg->fast_write) &&
+        !(reg->checked && qemu_loglevel_mask(LOG_GUEST_ERROR | LOG_UNIMP))) {
+        *data = register_write_masked(reg->access, *data, value, ~0ULL);
+        return;
+    }
+    register_write_memory(reg, addr & 3, value, size, be);
+}
+
+void register_block_write_memory_be(void *opaque, hwaddr addr, uint64_t value,
+                                    unsigned size)
+{
+    register_block_write_memory(opaque, addr, value, size, true);
+}
+
+void register_block_write_memory_le(void *opaque, hwaddr addr, uint64_t value,
+                                    unsigned size)
+{
+    register_block_write_memory(opaque, addr, value, size, false);
+}
+
+static inline uint64_t register_block_read_memory(void *opaque, hwaddr addr,
+                                                  unsigned size, bool be)
+{
+    RegisterInfoArray *ra = opaque;
+    RegisterInfo *reg = &ra->r[addr / sizeof(uint32_t)];
+
+    if (likely(size == 4 && reg->fast_read)) {
+        return *(uint32_t *)reg->data;
+    }
+    return register_read_memory(reg, addr & 3, size, be);
+}
+
+uint64_t register_block_read_memory_be(void *opaque, hwaddr addr,
+                                       unsigned size)
+{
+    return register_block_read_memory(opaque, addr, size, true);
+}
+
+uint64_t register_block_read_memory_le(void *opaque, hwaddr addr,
+                                       unsigned size)
+{
+    return register_block_read_memory(opaque, addr, size, false);
+}
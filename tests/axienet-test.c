@@ -0,0 +1,247 @@
+/*
+ * QTest testcase for the Xilinx AXI Ethernet and AXI DMA
+ *
+ * Frames are sent by the MM2S channel, gathered from several buffers, and
+ * looped back into the S2MM channel through a UDP socket backend.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Run with -m perf to get the packet rate. The numbers include the qtest
+ * protocol and the UDP loopback, compare them between builds rather than
+ * with real hardware.
+ */
+#include "libqtest.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#define AXIDMA_BASE     0x84600000
+#define MM2S_BASE       (AXIDMA_BASE + 0x00)
+#define S2MM_BASE       (AXIDMA_BASE + 0x30)
+
+#define R_DMACR         0x00
+#define R_DMASR         0x04
+#define R_CURDESC       0x08
+#define R_TAILDESC      0x10
+
+#define DMACR_RUNSTOP   1
+#define DMACR_RESET     4
+#define DMASR_IDLE      2
+
+#define DESC_SIZE       64
+#define DESC_CTRL_EOF   (1 << 26)
+#define DESC_CTRL_SOF   (1 << 27)
+#define DESC_STATUS_EOF (1 << 26)
+#define DESC_STATUS_SOF (1 << 27)
+#define DESC_STATUS_COMPLETE (1U << 31)
+
+#define DDR_BASE        0x50000000
+#define MM2S_RING       (DDR_BASE + 0x00000)
+#define S2MM_RING       (DDR_BASE + 0x10000)
+#define TX_BUFS         (DDR_BASE + 0x100000)
+#define RX_BUFS         (DDR_BASE + 0x400000)
+#define BUF_STRIDE      2048
+
+/* Stays well within the default socket buffer, frames are not dropped.  */
+#define MAX_FRAMES      64
+#define FRAME_SIZE      1514
+#define FCS_SIZE        4
+
+/* Every frame goes out as a header, a short and a long buffer.  */
+static const unsigned int frag_len[] = { 14, 100, FRAME_SIZE - 114 };
+#define NR_FRAGS        G_N_ELEMENTS(frag_len)
+
+static uint8_t mm2s_ring[MAX_FRAMES * NR_FRAGS * DESC_SIZE];
+static uint8_t s2mm_ring[MAX_FRAMES * DESC_SIZE];
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, v);
+    put_le32(p + 4, v >> 32);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void desc_fill(uint8_t *d, uint64_t next, uint64_t buf,
+                      uint32_t control)
+{
+    memset(d, 0, DESC_SIZE);
+    put_le64(d, next);
+    put_le64(d + 8, buf);
+    put_le32(d + 24, control);
+}
+
+/* Circular rings for nr frames, statuses cleared.  */
+static void rings_setup(int nr)
+{
+    int i, j, n = 0;
+    uint64_t buf, next;
+    uint32_t control;
+
+    for (i = 0; i < nr; i++) {
+        buf = TX_BUFS + i * BUF_STRIDE;
+        for (j = 0; j < NR_FRAGS; j++, n++) {
+            control = frag_len[j];
+            control |= j == 0 ? DESC_CTRL_SOF : 0;
+            control |= j == NR_FRAGS - 1 ? DESC_CTRL_EOF : 0;
+            next = MM2S_RING + ((n + 1) % (nr * NR_FRAGS)) * DESC_SIZE;
+            desc_fill(mm2s_ring + n * DESC_SIZE, next, buf, control);
+            buf += frag_len[j];
+        }
+
+        next = S2MM_RING + ((i + 1) % nr) * DESC_SIZE;
+        desc_fill(s2mm_ring + i * DESC_SIZE, next, RX_BUFS + i * BUF_STRIDE,
+                  BUF_STRIDE);
+    }
+    memwrite(MM2S_RING, mm2s_ring, n * DESC_SIZE);
+    memwrite(S2MM_RING, s2mm_ring, nr * DESC_SIZE);
+}
+
+static void dma_start(void)
+{
+    writel(MM2S_BASE + R_DMACR, DMACR_RESET);
+    writel(S2MM_BASE + R_DMACR, DMACR_RESET);
+    /* The reset bit clears once read.  */
+    readl(MM2S_BASE + R_DMACR);
+    readl(S2MM_BASE + R_DMACR);
+    writel(MM2S_BASE + R_CURDESC, MM2S_RING);
+    writel(S2MM_BASE + R_CURDESC, S2MM_RING);
+    writel(MM2S_BASE + R_DMACR, (1 << 16) | DMACR_RUNSTOP);
+    writel(S2MM_BASE + R_DMACR, (1 << 16) | DMACR_RUNSTOP);
+}
+
+/* Send nr frames and wait until all of them came back.  */
+static void loopback(int nr)
+{
+    GTimer *timer = g_timer_new();
+    uint32_t tail = nr - 1;
+
+    writel(S2MM_BASE + R_TAILDESC, S2MM_RING + tail * DESC_SIZE);
+    tail = nr * NR_FRAGS - 1;
+    writel(MM2S_BASE + R_TAILDESC, MM2S_RING + tail * DESC_SIZE);
+
+    while (!(readl(S2MM_BASE + R_DMASR) & DMASR_IDLE)) {
+        g_assert_cmpfloat(g_timer_elapsed(timer, NULL), <, 5.0);
+    }
+    g_timer_destroy(timer);
+}
+
+static void frames_fill(int nr)
+{
+    uint8_t frame[FRAME_SIZE];
+    int i, j;
+
+    for (i = 0; i < nr; i++) {
+        /* Broadcast, passes the address filter of the NIC.  */
+        memset(frame, 0xff, 6);
+        memcpy(frame + 6, "\x52\x54\x00\x12\x34\x56", 6);
+        frame[12] = 0x88;
+        frame[13] = 0xb5;
+        for (j = 14; j < FRAME_SIZE; j++) {
+            frame[j] = i + j;
+        }
+        memwrite(TX_BUFS + i * BUF_STRIDE, frame, FRAME_SIZE);
+    }
+}
+
+static void test_loopback(void)
+{
+    uint8_t tx[FRAME_SIZE], rx[FRAME_SIZE];
+    uint8_t desc[DESC_SIZE];
+    const int nr = 4;
+    uint32_t status;
+    int i;
+
+    frames_fill(nr);
+    rings_setup(nr);
+    dma_start();
+    loopback(nr);
+
+    for (i = 0; i < nr * NR_FRAGS; i++) {
+        memread(MM2S_RING + i * DESC_SIZE, desc, sizeof desc);
+        g_assert(get_le32(desc + 28) & DESC_STATUS_COMPLETE);
+    }
+
+    for (i = 0; i < nr; i++) {
+        memread(S2MM_RING + i * DESC_SIZE, desc, sizeof desc);
+        status = get_le32(desc + 28);
+        g_assert_cmphex(status & (DESC_STATUS_COMPLETE | DESC_STATUS_SOF
+                                  | DESC_STATUS_EOF), ==,
+                        DESC_STATUS_COMPLETE | DESC_STATUS_SOF
+                        | DESC_STATUS_EOF);
+        /* app4 holds the received length, FCS included.  */
+        g_assert_cmpuint(get_le32(desc + 32 + 16) & 0xffff, ==,
+                         FRAME_SIZE + FCS_SIZE);
+
+        memread(TX_BUFS + i * BUF_STRIDE, tx, FRAME_SIZE);
+        memread(RX_BUFS + i * BUF_STRIDE, rx, FRAME_SIZE);
+        g_assert(memcmp(tx, rx, FRAME_SIZE) == 0);
+    }
+}
+
+static void bench_loopback(void)
+{
+    uint64_t frames = 0;
+    double secs;
+
+    frames_fill(MAX_FRAMES);
+    rings_setup(MAX_FRAMES);
+    dma_start();
+
+    g_test_timer_start();
+    do {
+        loopback(MAX_FRAMES);
+        frames += MAX_FRAMES;
+        /* Hand the descriptors back to the DMA.  */
+        rings_setup(MAX_FRAMES);
+    } while (g_test_timer_elapsed() < 1.0);
+    secs = g_test_timer_last();
+
+    g_test_maximized_result(frames / secs,
+                            "%d byte frames in %zu buffers: %.0f frames/s, "
+                            "%.1f MB/s", FRAME_SIZE, NR_FRAGS, frames / secs,
+                            frames * FRAME_SIZE / secs / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    QTestState *s;
+    char *args;
+    int port;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* The socket backend sends the frames to itself.  */
+    port = 30000 + getpid() % 30000;
+    args = g_strdup_printf("-display none -machine petalogix-ml605 "
+                           "-net nic,model=xlnx.axi-ethernet "
+                           "-net socket,udp=127.0.0.1:%d,"
+                           "localaddr=127.0.0.1:%d", port, port);
+    s = qtest_start(args);
+    g_free(args);
+
+    qtest_add_func("/axienet/loopback", test_loopback);
+    if (g_test_perf()) {
+        qtest_add_func("/axienet/bench/loopback", bench_loopback);
+    }
+
+    ret = g_test_run();
+
+    qtest_quit(s);
+
+    return ret;
+}
@@ -0,0 +1,137 @@
+/*
+ * Internet checksum tests and micro-benchmark
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ * Run with -m perf to get the throughput numbers.
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+
+#define BUF_SIZE (64 * 1024)
+
+/* The byte at a time loop net_checksum_add_cont() used to be.  */
+static uint32_t ref_checksum_add_cont(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = seq; i < seq + len; i++) {
+        if (i & 1) {
+            sum += (uint32_t)buf[i - seq];
+        } else {
+            sum += (uint32_t)buf[i - seq] << 8;
+        }
+    }
+    return sum;
+}
+
+static uint8_t *random_buf(size_t len)
+{
+    uint8_t *buf = g_malloc(len);
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = g_test_rand_int();
+    }
+    return buf;
+}
+
+static void test_lengths(void)
+{
+    uint8_t *buf = random_buf(BUF_SIZE);
+    int off, len, seq;
+
+    for (off = 0; off < 8; off++) {
+        for (len = 0; len < 600; len++) {
+            for (seq = 0; seq < 2; seq++) {
+                g_assert_cmphex(
+                    net_checksum_finish(net_checksum_add_cont(len, buf + off,
+                                                              seq)), ==,
+                    net_checksum_finish(ref_checksum_add_cont(len, buf + off,
+                                                              seq)));
+            }
+        }
+    }
+
+    /* Large enough to drain the vector lanes a few times.  */
+    g_assert_cmphex(net_checksum_finish(net_checksum_add(BUF_SIZE - 1, buf)),
+                    ==,
+                    net_checksum_finish(ref_checksum_add_cont(BUF_SIZE - 1,
+                                                              buf, 0)));
+    g_free(buf);
+}
+
+static void test_saturated(void)
+{
+    uint8_t *buf = g_malloc(BUF_SIZE);
+
+    memset(buf, 0xff, BUF_SIZE);
+    g_assert_cmphex(net_checksum_finish(net_checksum_add(BUF_SIZE, buf)), ==,
+                    net_checksum_finish(ref_checksum_add_cont(BUF_SIZE,
+                                                              buf, 0)));
+    memset(buf, 0, BUF_SIZE);
+    g_assert_cmphex(net_checksum_finish(net_checksum_add(BUF_SIZE, buf)), ==,
+                    0xffff);
+    g_free(buf);
+}
+
+static void test_iov(void)
+{
+    uint8_t *buf = random_buf(1500);
+    struct iovec iov[4] = {
+        { buf, 13 },
+        { buf + 13, 1 },
+        { buf + 14, 999 },
+        { buf + 1013, 487 },
+    };
+
+    g_assert_cmphex(net_checksum_finish(net_checksum_add_iov(iov, 4, 14,
+                                                             1500 - 14)), ==,
+                    net_checksum_finish(net_checksum_add(1500 - 14,
+                                                         buf + 14)));
+    g_free(buf);
+}
+
+static void bench_checksum(gconstpointer opaque)
+{
+    size_t len = GPOINTER_TO_SIZE(opaque);
+    uint8_t *buf = random_buf(len);
+    uint32_t sum = 0;
+    size_t total = 0;
+    double secs;
+
+    g_test_timer_start();
+    do {
+        sum += net_checksum_add(len, buf);
+        total += len;
+    } while (g_test_timer_elapsed() < 1.0);
+    secs = g_test_timer_last();
+
+    g_test_minimized_result(secs * 1e9 * len / total,
+                            "%zu bytes: %.1f ns per packet, %.0f MB/s (%x)",
+                            len, secs * 1e9 * len / total,
+                            total / secs / 1e6, sum);
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/lengths", test_lengths);
+    g_test_add_func("/net/checksum/saturated", test_saturated);
+    g_test_add_func("/net/checksum/iov", test_iov);
+    if (g_test_perf()) {
+        g_test_add_data_func("/net/checksum/bench/64",
+                             GSIZE_TO_POINTER(64), bench_checksum);
+        g_test_add_data_func("/net/checksum/bench/1500",
+                             GSIZE_TO_POINTER(1500), bench_checksum);
+        g_test_add_data_func("/net/checksum/bench/9000",
+                             GSIZE_TO_POINTER(9000), bench_checksum);
+    }
+    return g_test_run();
+}
@@ -52,6 +52,7 @@ uint32_t ram[128 * 1024 / 4];
 struct tlmu_wrap {
 	struct tlmu q;
 	const char *name;
+	int invalidate_code;
 };
 
 void tlm_get_dmi_ptr(void *o, uint64_t addr, struct tlmu_dmi *dmi)
@@ -147,8 +148,25 @@ void *run_tlmu(void *p)
 
 void tlm_sync(void *o, int64_t time_ns)
 {
+	struct tlmu_wrap *t = o;
+
+	/* When recording, put a code invalidation into the log so that
+	   the replay test covers it.  */
+	if (t->invalidate_code) {
+		struct tlmu_dmi dmi = { .base = 0x19000000, .size = sizeof ram };
+
+		t->invalidate_code = 0;
+		tlmu_notify_event(&t->q, TLMU_TLM_EVENT_INVALIDATE_CODE, &dmi);
+	}
 }
 
+/*
+ * Usage: c_example [log]
+ *
+ * With a log, the first system records its run into it. Replay it with:
+ *   replay libtlmu-arm.so log -M tlm-mach -icount 1 -cpu arm926 \
+ *          -kernel arm-guest/guest
+ */
 int main(int argc, char **argv)
 {
 	int i;
@@ -228,6 +246,12 @@ int main(int argc, char **argv)
 		tlmu_map_ram(&sys[i].t.q, "rom", 0x18000000ULL, 128 * 1024, 0);
 		tlmu_map_ram(&sys[i].t.q, "ram", 0x19000000ULL, 128 * 1024, 1);
 
+		if (i == 0 && argc > 1) {
+			tlmu_set_record_replay(&sys[i].t.q, TLMU_RR_RECORD,
+					       argv[1]);
+			sys[i].t.invalidate_code = 1;
+		}
+
 		pthread_create(&sys[i].tid, NULL, run_tlmu, &sys[i].t);
 		i++;
 	}
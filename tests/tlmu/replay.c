@@ -0,0 +1,65 @@
+/*
+ * TLMu standalone replay of a recorded run.
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Usage: replay <libtlmu-arch.so> <log> [emulator args]
+ *
+ * The emulator args must match the ones used when recording, e.g:
+ *   replay libtlmu-arm.so arm0.rr -M tlm-mach -cpu arm926 -icount 1 \
+ *          -kernel arm-guest/guest
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "tlmu.h"
+
+int main(int argc, char **argv)
+{
+	struct tlmu q;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <libtlmu-arch.so> <log> [args]\n",
+			argv[0]);
+		return 1;
+	}
+
+	tlmu_init(&q, "replay");
+	if (tlmu_load(&q, argv[1])) {
+		printf("failed to load tlmu %s\n", argv[1]);
+		return 1;
+	}
+
+	for (i = 3; i < argc; i++) {
+		tlmu_append_arg(&q, argv[i]);
+	}
+
+	/* No callbacks, all responses come from the log.  */
+	tlmu_set_record_replay(&q, TLMU_RR_REPLAY, argv[2]);
+	tlmu_set_boot_state(&q, TLMU_BOOT_RUNNING);
+	tlmu_run(&q);
+	return 0;
+}
@@ -38,6 +38,91 @@ struct memmap_entry {
 	uint64_t size;
 	enum addrmode addrmode;
 	int sk_idx;
+	/* Hint for initiators that mirror the map (e.g TLMU_REGION_*).  */
+	unsigned int policy;
+};
+
+/*
+ * Address decoder. Entries are kept sorted by address and looked up with
+ * a binary search, the last hit of every initiator is tried first.
+ * Entries must not overlap.
+ */
+template<unsigned int N_ENTRIES, unsigned int N_INITIATORS>
+class addr_decoder
+{
+public:
+	struct memmap_entry map[N_ENTRIES];
+	unsigned int nr_entries;
+
+	addr_decoder() : nr_entries(0)
+	{
+		unsigned int i;
+
+		for (i = 0; i < N_INITIATORS; i++)
+			last_hit[i] = -1;
+	}
+
+	/* Returns the index of the new entry in map, -1 if full.  */
+	int add(uint64_t addr, uint64_t size,
+		enum addrmode addrmode, int sk_idx, unsigned int policy)
+	{
+		unsigned int i, pos;
+		int idx;
+
+		if (nr_entries == N_ENTRIES)
+			return -1;
+
+		idx = nr_entries++;
+		map[idx].addr = addr;
+		map[idx].size = size;
+		map[idx].addrmode = addrmode;
+		map[idx].sk_idx = sk_idx;
+		map[idx].policy = policy;
+
+		/* Insert sorted.  */
+		for (pos = idx; pos > 0 && map[sorted[pos - 1]].addr > addr; pos--)
+			sorted[pos] = sorted[pos - 1];
+		sorted[pos] = idx;
+
+		for (i = 0; i < N_INITIATORS; i++)
+			last_hit[i] = -1;
+		return idx;
+	}
+
+	bool contains(int idx, uint64_t addr) const
+	{
+		return addr >= map[idx].addr
+			&& addr - map[idx].addr < map[idx].size;
+	}
+
+	/* Returns the map index for addr, -1 if nothing is mapped there.  */
+	int lookup(unsigned int initiator, uint64_t addr)
+	{
+		unsigned int lo = 0, hi = nr_entries;
+		int hit = last_hit[initiator];
+
+		if (hit >= 0 && contains(hit, addr))
+			return hit;
+
+		/* Find the last entry starting at or below addr.  */
+		while (lo < hi) {
+			unsigned int mid = lo + (hi - lo) / 2;
+
+			if (map[sorted[mid]].addr <= addr)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == 0 || !contains(sorted[lo - 1], addr))
+			return -1;
+
+		last_hit[initiator] = sorted[lo - 1];
+		return last_hit[initiator];
+	}
+
+private:
+	unsigned int sorted[N_ENTRIES];
+	int last_hit[N_INITIATORS];
 };
 
 template<unsigned int N_INITIATORS, unsigned int N_TARGETS>
@@ -45,8 +130,6 @@ class iconnect
 : public sc_core::sc_module
 {
 public:
-	struct memmap_entry map[N_TARGETS * 4];
-
 	tlm_utils::simple_target_socket_tagged<iconnect> *t_sk[N_INITIATORS];
 	tlm_utils::simple_initiator_socket_tagged<iconnect> *i_sk[N_TARGETS];
 
@@ -69,17 +152,38 @@ public:
 
 
 	int memmap(sc_dt::uint64 addr, sc_dt::uint64 size,
-		enum addrmode addrmode, int idx, tlm::tlm_target_socket<> &s);
+		enum addrmode addrmode, int idx, tlm::tlm_target_socket<> &s,
+		unsigned int policy = 0);
+
+	/* Publish the decode table to an initiator, e.g a tlmu_sc.  */
+	template<class T>
+	void export_memmap(T *initiator)
+	{
+		char txt[32];
+		unsigned int i;
+
+		for (i = 0; i < dec.nr_entries; i++) {
+			sprintf(txt, "%s.%d", name(), i);
+			initiator->map_region(txt, dec.map[i].addr,
+					      dec.map[i].size,
+					      dec.map[i].policy);
+		}
+	}
 private:
-	unsigned int map_address(sc_dt::uint64 addr, sc_dt::uint64& offset);
-	void unmap_offset(unsigned int target_nr,
+	addr_decoder<N_TARGETS * 4, N_INITIATORS> dec;
+	unsigned int nr_sk;
+	/* Map entries every initiator got DMI pointers for.  */
+	bool dmi_granted[N_INITIATORS][N_TARGETS * 4];
+
+	int map_address(int id, sc_dt::uint64 addr, sc_dt::uint64& offset);
+	void unmap_offset(int map_idx,
 				sc_dt::uint64 offset, sc_dt::uint64& addr);
 
 };
 
 template<unsigned int N_INITIATORS, unsigned int N_TARGETS>
 iconnect<N_INITIATORS, N_TARGETS>::iconnect (sc_module_name name)
-	: sc_module(name)
+	: sc_module(name), nr_sk(0)
 {
 	char txt[32];
 	unsigned int i;
@@ -101,79 +205,74 @@ iconnect<N_INITIATORS, N_TARGETS>::iconnect (sc_module_name name)
 
 		i_sk[i]->register_invalidate_direct_mem_ptr(this,
 				&iconnect::invalidate_direct_mem_ptr, i);
-		map[i].size = 0;
 	}
+	memset(dmi_granted, 0, sizeof dmi_granted);
 }
 
 template<unsigned int N_INITIATORS, unsigned int N_TARGETS>
 int iconnect<N_INITIATORS, N_TARGETS>::memmap(
 		sc_dt::uint64 addr, sc_dt::uint64 size,
 		enum addrmode addrmode, int idx,
-		tlm::tlm_target_socket<> &s)
+		tlm::tlm_target_socket<> &s,
+		unsigned int policy)
 {
-	unsigned int i;
+	int r;
 
-	for (i = 0; i < N_TARGETS * 4; i++) {
-		if (map[i].size == 0) {
-			/* Found a free entry.  */
-			map[i].addr = addr;
-			map[i].size = size;
-			map[i].addrmode = addrmode;
-			map[i].sk_idx = i;
-			if (idx == -1)
-				i_sk[i]->bind(s);
-			else
-				map[i].sk_idx = idx;
-			return i;
+	if (idx == -1) {
+		/* Bind the target to the next free socket.  */
+		if (nr_sk == N_TARGETS) {
+			printf("FATAL! mapping onto full interconnect!\n");
+			abort();
 		}
+		idx = nr_sk++;
+		i_sk[idx]->bind(s);
 	}
-	printf("FATAL! mapping onto full interconnect!\n");
-	abort();
-	return -1;
+
+	r = dec.add(addr, size, addrmode, idx, policy);
+	if (r < 0) {
+		printf("FATAL! mapping onto full interconnect!\n");
+		abort();
+	}
+	return r;
 }
 
 template<unsigned int N_INITIATORS, unsigned int N_TARGETS>
-unsigned int iconnect<N_INITIATORS, N_TARGETS>::map_address(
+int iconnect<N_INITIATORS, N_TARGETS>::map_address(int id,
 			sc_dt::uint64 addr,
 			sc_dt::uint64& offset)
 {
-	unsigned int i;
+	int i = dec.lookup(id, addr);
 
-	for (i = 0; i < N_TARGETS * 4; i++) {
-		if (map[i].size
-		    && addr >= map[i].addr
-		    && addr <= (map[i].addr + map[i].size)) {
-			if (map[i].addrmode == ADDRMODE_RELATIVE) {
-				offset = addr - map[i].addr;
-			} else {
-				offset = addr;
-			}
-			return map[i].sk_idx;
-		}
+	if (i < 0) {
+		/* Did not find any slave !?!?  */
+		printf("DECODE ERROR! %lx\n", (unsigned long) addr);
+		offset = addr;
+		return -1;
 	}
 
-	/* Did not find any slave !?!?  */
-        printf("DECODE ERROR! %lx\n", (unsigned long) addr);
-	return 0;
+	if (dec.map[i].addrmode == ADDRMODE_RELATIVE) {
+		offset = addr - dec.map[i].addr;
+	} else {
+		offset = addr;
+	}
+	return i;
 }
 
 template<unsigned int N_INITIATORS, unsigned int N_TARGETS>
 void iconnect<N_INITIATORS, N_TARGETS>::unmap_offset(
-			unsigned int target_nr,
+			int map_idx,
 			sc_dt::uint64 offset,
 			sc_dt::uint64& addr)
 {
-	if (target_nr >= N_TARGETS) {
-		SC_REPORT_FATAL("TLM-2", "Invalid target_nr in iconnect\n");
-	}
+	const struct memmap_entry *m = &dec.map[map_idx];
 
-	if (map[target_nr].addrmode == ADDRMODE_RELATIVE) {
-		if (offset >= map[target_nr].size) {
+	if (m->addrmode == ADDRMODE_RELATIVE) {
+		if (offset >= m->size) {
 			printf("offset=%lx\n", (unsigned long) offset);
 			SC_REPORT_FATAL("TLM-2", "Invalid range in iconnect\n");
 		}
 
-		addr = map[target_nr].addr + offset;
+		addr = m->addr + offset;
 	} else {
 		addr = offset;
 	}
@@ -186,18 +285,22 @@ void iconnect<N_INITIATORS, N_TARGETS>::b_transport(int id,
 {
 	sc_dt::uint64 addr;
 	sc_dt::uint64 offset;
-	unsigned int target_nr;
+	int map_idx;
 
 	if (id >= (int) N_INITIATORS) {
 		SC_REPORT_FATAL("TLM-2", "Invalid socket tag in iconnect\n");
 	}
 
 	addr = trans.get_address();
-	target_nr = map_address(addr, offset);
+	map_idx = map_address(id, addr, offset);
+	if (map_idx < 0) {
+		trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+		return;
+	}
 
 	trans.set_address(offset);
 	/* Forward the transaction.  */
-	(*i_sk[target_nr])->b_transport(trans, delay);
+	(*i_sk[dec.map[map_idx].sk_idx])->b_transport(trans, delay);
 	/* Restore the addresss.  */
 	trans.set_address(addr);
 }
@@ -209,7 +312,7 @@ bool iconnect<N_INITIATORS, N_TARGETS>::get_direct_mem_ptr(int id,
 {
 	sc_dt::uint64 addr;
 	sc_dt::uint64 offset;
-	unsigned int target_nr;
+	int map_idx;
 	bool r;
 
 	if (id >= (int) N_INITIATORS) {
@@ -217,16 +320,23 @@ bool iconnect<N_INITIATORS, N_TARGETS>::get_direct_mem_ptr(int id,
 	}
 
 	addr = trans.get_address();
-	target_nr = map_address(addr, offset);
+	map_idx = map_address(id, addr, offset);
+	if (map_idx < 0) {
+		return false;
+	}
 
 	trans.set_address(offset);
 	/* Forward the transaction.  */
-	r = (*i_sk[target_nr])->get_direct_mem_ptr(trans, dmi_data);
+	r = (*i_sk[dec.map[map_idx].sk_idx])->get_direct_mem_ptr(trans, dmi_data);
+	trans.set_address(addr);
 
-	unmap_offset(target_nr, dmi_data.get_start_address(), addr);
+	unmap_offset(map_idx, dmi_data.get_start_address(), addr);
 	dmi_data.set_start_address(addr);
-	unmap_offset(target_nr, dmi_data.get_end_address(), addr);
+	unmap_offset(map_idx, dmi_data.get_end_address(), addr);
 	dmi_data.set_end_address(addr);
+	if (r) {
+		dmi_granted[id][map_idx] = true;
+	}
 	return r;
 }
 
@@ -236,35 +346,66 @@ unsigned int iconnect<N_INITIATORS, N_TARGETS>::transport_dbg(int id,
 {
 	sc_dt::uint64 addr;
 	sc_dt::uint64 offset;
-	unsigned int target_nr;
+	int map_idx;
 
 	if (id >= (int) N_INITIATORS) {
 		SC_REPORT_FATAL("TLM-2", "Invalid socket tag in iconnect\n");
 	}
 
 	addr = trans.get_address();
-	target_nr = map_address(addr, offset);
+	map_idx = map_address(id, addr, offset);
+	if (map_idx < 0) {
+		return 0;
+	}
 
 	trans.set_address(offset);
 	/* Forward the transaction.  */
-	(*i_sk[target_nr])->transport_dbg(trans);
+	(*i_sk[dec.map[map_idx].sk_idx])->transport_dbg(trans);
 	/* Restore the addresss.  */
 	trans.set_address(addr);
 	return 0;
 }
 
+/*
+ * Forward invalidations only to the initiators that got DMI pointers from
+ * the affected map entries of the target.
+ */
 template<unsigned int N_INITIATORS, unsigned int N_TARGETS>
 void iconnect<N_INITIATORS, N_TARGETS>::invalidate_direct_mem_ptr(int id,
                                          sc_dt::uint64 start_range,
                                          sc_dt::uint64 end_range)
 {
 	sc_dt::uint64 start, end;
-	unsigned int i;
-
-	unmap_offset(id, start_range, start);
-	unmap_offset(id, end_range, end);
+	unsigned int i, m;
+
+	for (m = 0; m < dec.nr_entries; m++) {
+		const struct memmap_entry *e = &dec.map[m];
+		sc_dt::uint64 first, last;
+
+		if (e->sk_idx != id)
+			continue;
+
+		/* Clip the range to the entry.  */
+		if (e->addrmode == ADDRMODE_RELATIVE) {
+			if (start_range >= e->size)
+				continue;
+			first = start_range;
+			last = end_range < e->size ? end_range : e->size - 1;
+		} else {
+			if (start_range >= e->addr + e->size
+			    || end_range < e->addr)
+				continue;
+			first = start_range > e->addr ? start_range : e->addr;
+			last = end_range - e->addr < e->size ?
+				end_range : e->addr + e->size - 1;
+		}
+		unmap_offset(m, first, start);
+		unmap_offset(m, last, end);
 
-	for (i = 0; i < N_INITIATORS; i++) {
-		(*t_sk[i])->invalidate_direct_mem_ptr(start, end);
+		for (i = 0; i < N_INITIATORS; i++) {
+			if (!dmi_granted[i][m])
+				continue;
+			(*t_sk[i])->invalidate_direct_mem_ptr(start, end);
+		}
 	}
 }
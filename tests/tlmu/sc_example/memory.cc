@@ -32,6 +32,7 @@ using namespace sc_core;
 using namespace std;
 
 #include "memory.h"
+#include "tlmu.h"
 
 memory::memory(sc_module_name name, sc_time latency, int size_)
 	: sc_module(name), socket("socket"), LATENCY(latency)
@@ -41,8 +42,8 @@ memory::memory(sc_module_name name, sc_time latency, int size_)
 	socket.register_transport_dbg(this, &memory::transport_dbg);
 
 	size = size_;
-	mem = new uint8_t[size];
-	memset(&mem[0], 0, size);
+	/* Shared memory, so out-of-process TLMu instances get DMI too.  */
+	mem = (uint8_t *) tlmu_shm_alloc(size);
 }
 
 void memory::b_transport(tlm::tlm_generic_payload& trans, sc_time& delay)
@@ -113,11 +113,14 @@ SC_MODULE(Top)
 		static struct {
 			const char *name;
 			uint64_t base, size;
-			int rw;
+			unsigned int policy;
 			int access_delay_ns;
 		} rams[] = {
-			{"rom", 0x18000000ULL, 128 * 1024, 0, 5},
-			{"ram", 0x19000000ULL, 128 * 1024, 1, 5},
+			{"rom", 0x18000000ULL, 128 * 1024,
+			 TLMU_REGION_DMI | TLMU_REGION_CACHEABLE
+			 | TLMU_REGION_READONLY, 5},
+			{"ram", 0x19000000ULL, 128 * 1024,
+			 TLMU_REGION_DMI | TLMU_REGION_CACHEABLE, 5},
 		};
 
 		for (i = 0; i < sizeof rams / sizeof rams[0]; i++) {
@@ -125,16 +128,18 @@ SC_MODULE(Top)
 					sc_time(rams[i].access_delay_ns, SC_NS),
 					rams[i].size);
 			bus->memmap(rams[i].base, rams[i].size,
-					ADDRMODE_RELATIVE, -1, mem[i]->socket);
-			for (j = 0; j < NR_CPUS; j++) {
-				cpu[j]->map_ram(rams[i].name,
-					rams[i].base, rams[i].size, rams[i].rw);
-			}
+					ADDRMODE_RELATIVE, -1, mem[i]->socket,
+					rams[i].policy);
 		}
 
 		bus->memmap(0x10500000ULL, 1 * 1024,
 				ADDRMODE_RELATIVE, -1, magic->socket);
 
+		/* Let the CPUs mirror the bus decoder.  */
+		for (j = 0; j < NR_CPUS; j++) {
+			bus->export_memmap(cpu[j]);
+		}
+
 		/* Dummy IRQ connections.  */
 		cpu[0]->to_tlmu_sk.bind(to_arm_sk);
 		cpu[0]->to_tlmu_irq_sk.bind(to_arm_irq_sk);
@@ -0,0 +1,109 @@
+/*
+ * Benchmark of the TLMu to SystemC time conversion
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures the per access cost of converting TLMu time into sc_time, the
+ * way tlmu_sc used to do it (double math and sc_time(double, SC_NS)) and
+ * with tlmu_sc_clock. The accumulated time of both is printed to show the
+ * drift of the old conversion.
+ *
+ * Usage: time_bench [freq_mhz] [icount_shift] [iterations]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "systemc.h"
+#include "tlmu_sc_clock.h"
+
+using namespace sc_core;
+
+static double now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+int sc_main(int argc, char *argv[])
+{
+	uint64_t freq_hz = 200ULL * 1000 * 1000;
+	unsigned int shift = 1;
+	uint64_t iters = 10 * 1000 * 1000;
+	tlmu_sc_clock clock;
+	sc_time old_total, new_total;
+	double speed_factor, t0, t_old, t_new;
+	int64_t ns, last;
+	uint64_t i, last_units, res_fs;
+
+	if (argc > 1)
+		freq_hz = strtoull(argv[1], NULL, 0) * 1000 * 1000;
+	if (argc > 2)
+		shift = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		iters = strtoull(argv[3], NULL, 0);
+
+	res_fs = (uint64_t) (sc_get_time_resolution().to_seconds() * 1e15 + 0.5);
+	clock.init(freq_hz, shift, res_fs);
+
+	/* Steps of a few insns, like bus accesses between syncs.  */
+	speed_factor = 1e9 / freq_hz;
+	last = 0;
+	t0 = now_us();
+	for (i = 1; i <= iters; i++) {
+		double delta_ns;
+
+		ns = i * (7 << shift);
+		delta_ns = ns - last;
+		last = ns;
+		delta_ns /= 1 << shift;
+		delta_ns *= speed_factor;
+		old_total += sc_time(delta_ns, SC_NS);
+	}
+	t_old = now_us() - t0;
+
+	last_units = 0;
+	t0 = now_us();
+	for (i = 1; i <= iters; i++) {
+		uint64_t units;
+
+		ns = i * (7 << shift);
+		units = clock.to_units(ns);
+		new_total += sc_time(units - last_units, false);
+		last_units = units;
+	}
+	t_new = now_us() - t0;
+
+	printf("freq=%" PRIu64 "Hz icount=%u iterations=%" PRIu64 "\n",
+		freq_hz, shift, iters);
+	printf("double:      %.2f ns/access total=%s\n",
+		t_old * 1000 / iters, old_total.to_string().c_str());
+	printf("fixed-point: %.2f ns/access total=%s\n",
+		t_new * 1000 / iters, new_total.to_string().c_str());
+	return 0;
+}
@@ -51,17 +51,24 @@ tlmu_sc::tlmu_sc(sc_module_name name, const char *soname,
 	  from_tlmu_sk("fromTLMuSocket"),
 	  to_tlmu_sk("toTLMuSocket"),
 	  to_tlmu_irq_sk("toTLMuIRQSocket"),
+	  freq_hz(freq_hz),
+	  icount_shift(1),
 	  mach_name(mach_name),
 	  cpu_model(cpu_model),
 	  elf_filename(elf_filename),
 	  tracing(tracing),
 	  gdb_conn(gdb_conn),
-	  is_running(false)
+	  is_running(false),
+	  nr_cpus(1),
+	  nb_outstanding(0)
 {
 	int err;
 
+	memset(cpu_sk, 0, sizeof cpu_sk);
+
 	from_tlmu_sk.register_invalidate_direct_mem_ptr(this,
 			&tlmu_sc::invalidate_direct_mem_ptr);
+	from_tlmu_sk.register_nb_transport_bw(this, &tlmu_sc::nb_transport_bw);
 
 	/* Accesses from System-C TLM into TLMu bus.  */
 	to_tlmu_sk.register_b_transport(this, &tlmu_sc::to_tlmu_b_transport);
@@ -71,9 +78,8 @@ tlmu_sc::tlmu_sc(sc_module_name name, const char *soname,
 	/* Register the IRQ callbacks.  */
 	to_tlmu_irq_sk.register_b_transport(this, &tlmu_sc::irq_b_transport);
 
-	speed_factor = (1 * TLMU_GHZ);
-	speed_factor /= freq_hz;
 	last_sync = 0;
+	last_sync_units = 0;
 
 	tlmu_init(&q, this->name());
 
@@ -91,6 +97,7 @@ tlmu_sc::tlmu_sc(sc_module_name name, const char *soname,
 	}
 	tlmu_set_sync_period_ns(&q, sync_period_ns);
 	tlmu_set_bus_access_cb(&q, &tlmu_sc::bus_access);
+	tlmu_set_bus_access_cpu_cb(&q, &tlmu_sc::bus_access_cpu);
 	tlmu_set_bus_access_dbg_cb(&q, &tlmu_sc::bus_access_dbg);
 	tlmu_set_bus_get_dmi_ptr_cb(&q, &tlmu_sc::get_dmi_ptr);
 	tlmu_set_sync_cb(&q, &tlmu_sc::sync);
@@ -101,6 +108,11 @@ tlmu_sc::tlmu_sc(sc_module_name name, const char *soname,
 
 void tlmu_sc::start_of_simulation(void)
 {
+	uint64_t res_fs;
+
+	/* The time resolution is fixed by now.  */
+	res_fs = (uint64_t) (sc_get_time_resolution().to_seconds() * 1e15 + 0.5);
+	clock.init(freq_hz, icount_shift, res_fs);
 	m_qk.reset();
 }
 
@@ -112,37 +124,55 @@ void tlmu_sc::set_image_load_params(uint64_t base, uint64_t size)
 void tlmu_sc::sync_time(int64_t tlmu_time_ns)
 {
 	/* Did QEMU provide a valid time ?  */
-	if (tlmu_time_ns != -1) {
-		double delta_ns;
-		delta_ns = tlmu_time_ns - last_sync;
-		last_sync = tlmu_time_ns;
+	if (tlmu_time_ns != -1 && tlmu_time_ns > last_sync) {
+		uint64_t now = clock.to_units(tlmu_time_ns);
 
-		/* We run QEMU with -icount 1, meaning QEMU will execute
-		   one insn every 2ns (2^N where N is the icount value).
-		   Here we transform delta_ns into a 1Ghz CPU freq.  */
-		delta_ns /= 2;
-
-		/* Now scale it according to the request freq.  */
-		delta_ns *= speed_factor;
-		m_qk.inc(sc_time(delta_ns, SC_NS));
+		/* sc_time in resolution units, no scaling.  */
+		m_qk.inc(sc_time(now - last_sync_units, false));
+		last_sync = tlmu_time_ns;
+		last_sync_units = now;
 	}
 	if (m_qk.need_sync()) {
 		m_qk.sync();
 	}
 }
 
+/*
+ * Grab a payload from the pool and set it up for an access. The caller
+ * owns one reference.
+ */
+tlmu_sc_payload *tlmu_sc::get_payload(int64_t clk, int cpu,
+			enum tlmu_extension::access_type access,
+			int rw, uint64_t addr, void *data, int len)
+{
+	tlmu_sc_payload *tr = payloads.allocate();
+
+	tr->set_command(rw ? tlm::TLM_WRITE_COMMAND : tlm::TLM_READ_COMMAND );
+	tr->set_address(addr);
+	tr->set_data_ptr((unsigned char *)data);
+	tr->set_data_length(len);
+	tr->set_streaming_width(len);
+	tr->set_dmi_allowed(false);
+	tr->set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+	tr->ext.instance_id = q.id;
+	tr->ext.clk = clk;
+	tr->ext.access = access;
+	tr->ext.cpu = cpu;
+	return tr;
+}
+
 void tlmu_sc::get_dmi_ptr(uint64_t addr, struct tlmu_dmi *dmi)
 {
-	tlm::tlm_generic_payload tr;
+	tlmu_sc_payload *tr;
 	tlm::tlm_dmi dmi_data;
 	bool r;
 
 	dmi_data.init();
-	tr.set_address(addr);
-	r = from_tlmu_sk->get_direct_mem_ptr(tr, dmi_data);
+	tr = get_payload(last_sync, -1, tlmu_extension::LOAD, 0, addr, NULL, 0);
+	r = from_tlmu_sk->get_direct_mem_ptr(*tr, dmi_data);
+	tr->release();
 	if (r) {
-		sc_time latency;
-		double l;
 
 		dmi->ptr = dmi_data.get_dmi_ptr();
 		dmi->base = dmi_data.get_start_address();
@@ -156,14 +186,11 @@ void tlmu_sc::get_dmi_ptr(uint64_t addr, struct tlmu_dmi *dmi)
 			dmi->prot |= TLMU_DMI_PROT_WRITE;
 		}
 
-		/* Convert the latencies to insn counts, can we do better?  */
-		latency = dmi_data.get_read_latency();
-		l = latency.to_seconds() * 1000 * 1000 * 1000;
-		dmi->read_latency = (unsigned int) ((l + 1) / 2);
-
-		latency = dmi_data.get_write_latency();
-		l = latency.to_seconds() * 1000 * 1000 * 1000;
-		dmi->write_latency = (unsigned int) ((l + 1) / 2);
+		/* Convert the latencies to insn counts.  */
+		dmi->read_latency = clock.units_to_insns(
+				dmi_data.get_read_latency().value());
+		dmi->write_latency = clock.units_to_insns(
+				dmi_data.get_write_latency().value());
 	}
 }
 
@@ -177,53 +204,140 @@ void tlmu_sc::invalidate_direct_mem_ptr(sc_dt::uint64 start,
 	tlmu_notify_event(&q, TLMU_TLM_EVENT_INVALIDATE_DMI, &dmi);
 }
 
+void tlmu_sc::cpu_invalidate_direct_mem_ptr(int id, sc_dt::uint64 start,
+				sc_dt::uint64 end)
+{
+	invalidate_direct_mem_ptr(start, end);
+}
+
 int tlmu_sc::bus_access(int64_t clk, int rw,
 			uint64_t addr, void *data, int len)
 {
-	tlm::tlm_generic_payload tr;
+	return bus_access_sk(from_tlmu_sk, clk, -1, tlmu_extension::DMA,
+			rw, addr, data, len);
+}
+
+int tlmu_sc::bus_access_cpu(int64_t clk, int cpu, int access, int rw,
+			uint64_t addr, void *data, int len)
+{
+	enum tlmu_extension::access_type type;
+
+	switch (access) {
+	case TLMU_ACCESS_LOAD:
+		type = tlmu_extension::LOAD;
+		break;
+	case TLMU_ACCESS_STORE:
+		type = tlmu_extension::STORE;
+		break;
+	case TLMU_ACCESS_FETCH:
+		type = tlmu_extension::FETCH;
+		break;
+	default:
+		type = tlmu_extension::DMA;
+		break;
+	}
+
+	/* Core 0 and accesses not made by a core use the main socket.  */
+	if (cpu > 0 && (unsigned int) cpu < nr_cpus) {
+		return bus_access_sk(*cpu_sk[cpu], clk, cpu, type,
+				rw, addr, data, len);
+	}
+	return bus_access_sk(from_tlmu_sk, clk, cpu, type, rw, addr, data, len);
+}
+
+int tlmu_sc::bus_access_sk(tlm::tlm_initiator_socket<> &sk,
+			int64_t clk, int cpu,
+			enum tlmu_extension::access_type access, int rw,
+			uint64_t addr, void *data, int len)
+{
+	tlmu_sc_payload *tr;
 	sc_time delay;
+	int dmi_allowed;
 
 #if 0
 	printf("%s: rw=%d addr=%lx len=%d data=%x\n", __func__,
 			rw, addr, len, *(uint32_t *)data);
 #endif
-	tr.set_command(rw ? tlm::TLM_WRITE_COMMAND : tlm::TLM_READ_COMMAND );
-	tr.set_address(addr);
-	tr.set_data_ptr((unsigned char *)data);
-	tr.set_data_length(len);
-	tr.set_streaming_width(len);
-	tr.set_dmi_allowed(false);
-	tr.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+	tr = get_payload(clk, cpu, access, rw, addr, data, len);
+
+	/* Don't let blocking accesses pass non-blocking ones.  */
+	while (nb_outstanding) {
+		wait(nb_done_ev);
+	}
 
 	/* Sync the QEMU time with TLM to let the target see the elapsed
 	   time from CPU execution.  */
 	sync_time(clk);
 	delay = m_qk.get_local_time();
-	from_tlmu_sk->b_transport(tr, delay);
+	sk->b_transport(*tr, delay);
 
-	if (tr.get_response_status() != tlm::TLM_OK_RESPONSE) {
+	if (tr->get_response_status() != tlm::TLM_OK_RESPONSE) {
 		tlmu_notify_event(&q, TLMU_TLM_EVENT_DEBUG_BREAK, 0);
 	}
+	dmi_allowed = tr->is_dmi_allowed();
+	tr->release();
 
 	m_qk.set_and_sync(delay);
-	return tr.is_dmi_allowed();
+	return dmi_allowed;
+}
+
+void tlmu_sc::nb_complete(tlmu_sc_payload *tr)
+{
+	tr->txn->status = tr->get_response_status() != tlm::TLM_OK_RESPONSE;
+	nb_outstanding--;
+	nb_done_ev.notify();
+	tlmu_notify_event(&q, TLMU_TLM_EVENT_NB_DONE, tr->txn);
+	tr->release();
+}
+
+int tlmu_sc::nb_access(struct tlmu_nb_txn *txn)
+{
+	tlmu_sc_payload *tr;
+	tlm::tlm_phase phase = tlm::BEGIN_REQ;
+	tlm::tlm_sync_enum r;
+	sc_time delay;
+
+	/* Posted writes come from a core, the rest is device DMA.  */
+	tr = get_payload(txn->clk, txn->cpu,
+			txn->cpu < 0 ? tlmu_extension::DMA : tlmu_extension::STORE,
+			txn->rw, txn->addr, txn->data, txn->len);
+	tr->txn = txn;
+
+	sync_time(txn->clk);
+	delay = m_qk.get_local_time();
+	nb_outstanding++;
+	r = from_tlmu_sk->nb_transport_fw(*tr, phase, delay);
+	if (r == tlm::TLM_UPDATED && phase == tlm::BEGIN_RESP) {
+		phase = tlm::END_RESP;
+		from_tlmu_sk->nb_transport_fw(*tr, phase, delay);
+		r = tlm::TLM_COMPLETED;
+	}
+	if (r == tlm::TLM_COMPLETED) {
+		nb_complete(tr);
+	}
+	return 1;
+}
+
+tlm::tlm_sync_enum tlmu_sc::nb_transport_bw(tlm::tlm_generic_payload& trans,
+				tlm::tlm_phase& phase, sc_time& delay)
+{
+	if (phase == tlm::BEGIN_RESP) {
+		nb_complete(static_cast<tlmu_sc_payload *>(&trans));
+		return tlm::TLM_COMPLETED;
+	}
+	/* END_REQ, wait for the response.  */
+	return tlm::TLM_ACCEPTED;
 }
 
 void tlmu_sc::bus_access_dbg(int64_t clk, int rw,
 				uint64_t addr, void *data, int len)
 {
-	tlm::tlm_generic_payload tr;
+	tlmu_sc_payload *tr;
 
 	//printf("%s: rw=%d addr=%lx len=%d\n", __func__, rw, addr, len);
-	tr.set_command(rw ? tlm::TLM_WRITE_COMMAND : tlm::TLM_READ_COMMAND );
-	tr.set_address(addr);
-	tr.set_data_ptr((unsigned char *)data);
-	tr.set_data_length(len);
-	tr.set_streaming_width(len);
-	tr.set_dmi_allowed(false);
-	tr.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
-
-	from_tlmu_sk->transport_dbg(tr);
+	tr = get_payload(clk, -1, tlmu_extension::DEBUG, rw, addr, data, len);
+	from_tlmu_sk->transport_dbg(*tr);
+	tr->release();
 }
 
 bool tlmu_sc::to_tlmu_get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
@@ -332,6 +446,13 @@ void tlmu_sc::map_ram(const char *name, uint64_t base, uint64_t size, int rw)
 	tlmu_map_ram(&q, name, base, size, rw);
 }
 
+void tlmu_sc::map_region(const char *name, uint64_t base, uint64_t size,
+			uint32_t flags)
+{
+	sc_assert(!is_running);
+	tlmu_map_region(&q, name, base, size, flags);
+}
+
 unsigned int tlmu_sc::irq_transport_dbg(tlm::tlm_generic_payload& trans)
 {
 	return 0;
@@ -381,6 +502,64 @@ void tlmu_sc::gdb(const char *gdb_conn, bool wait_for_gdb_at_start)
 		tlmu_append_arg(&q, "-S");
 }
 
+/* Log all responses from the SystemC side for standalone replays.  */
+void tlmu_sc::record(const char *filename)
+{
+	sc_assert(!is_running);
+	tlmu_set_record_replay(&q, TLMU_RR_RECORD, filename);
+}
+
+/*
+ * Run nr_cpus cores in this instance. They share the translated code, core
+ * N > 0 makes its bus accesses on cpu_sk[N]. Must be called at elaboration.
+ */
+void tlmu_sc::smp(unsigned int n)
+{
+	char txt[32];
+	unsigned int i;
+
+	sc_assert(!is_running);
+	sc_assert(n > 0 && n <= MAX_CPUS);
+
+	for (i = nr_cpus; i < n; i++) {
+		sprintf(txt, "fromTLMuSocket_%d", i);
+		cpu_sk[i] = new tlm_utils::simple_initiator_socket_tagged<tlmu_sc>(txt);
+		cpu_sk[i]->register_invalidate_direct_mem_ptr(this,
+				&tlmu_sc::cpu_invalidate_direct_mem_ptr, i);
+	}
+	if (n > nr_cpus) {
+		nr_cpus = n;
+	}
+}
+
+/*
+ * Let posted writes and device DMA use nb_transport with several
+ * transactions in flight. CPU loads still block.
+ */
+void tlmu_sc::enable_nb(void)
+{
+	sc_assert(!is_running);
+	tlmu_set_nb_access_cb(&q, &tlmu_sc::nb_access);
+}
+
+/*
+ * QEMU advances its clock by 2^shift ns per insn, defaults to 1. Larger
+ * shifts let QEMU timers with ns periods stay coarse compared to the insn
+ * rate. Must be called at elaboration.
+ */
+void tlmu_sc::icount(unsigned int shift)
+{
+	sc_assert(!is_running);
+	sc_assert(shift <= 10);
+	icount_shift = shift;
+}
+
+void tlmu_sc::out_of_process(void)
+{
+	sc_assert(!is_running);
+	tlmu_set_out_of_process(&q, 1);
+}
+
 void tlmu_sc::wait_started() {
 	if (!is_running) {
 		wait(start);
@@ -412,16 +591,21 @@ void tlmu_sc::process(void)
 		tlmu_append_arg(&q, "tlm-mach");
 	}
 
+	if (nr_cpus > 1) {
+		snprintf(smp_arg, sizeof smp_arg, "%u", nr_cpus);
+		tlmu_append_arg(&q, "-smp");
+		tlmu_append_arg(&q, smp_arg);
+	}
+
 	if (elf_filename) {
 		tlmu_append_arg(&q, "-kernel");
 		tlmu_append_arg(&q, elf_filename);
 	}
 
 	/* Insn count driven time.  */
-	if (1) {
-		tlmu_append_arg(&q, "-icount");
-		tlmu_append_arg(&q, "1");
-	}
+	snprintf(icount_arg, sizeof icount_arg, "%u", icount_shift);
+	tlmu_append_arg(&q, "-icount");
+	tlmu_append_arg(&q, icount_arg);
 
 	/* Debug.  */
 	if (tracing & TRACING_EXEC) {
@@ -429,6 +613,15 @@ void tlmu_sc::process(void)
 		tlmu_append_arg(&q, "in_asm,exec,cpu");
 	}
 
+	/* Statistical profiling, sample every 10K insns.  */
+	if (tracing & TRACING_PROF) {
+		std::string prof_name(".tlmu/");
+
+		prof_name += name();
+		prof_name += ".callgrind";
+		tlmu_set_profiling(&q, prof_name.c_str(), 10 * 1000, 8);
+	}
+
 	/* Gdb stub.  */
 	if (gdb_conn) {
 		tlmu_append_arg(&q, "-gdb");
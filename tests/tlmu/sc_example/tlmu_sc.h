@@ -22,6 +22,11 @@
  * THE SOFTWARE.
  */
 
+#include <vector>
+#include <assert.h>
+
+#include "tlmu_sc_clock.h"
+
 /* To Avoid warnings when declaring the funcion pointers accross C and C++.  */
 #define TLMU_NO_DECLARE_CB_FUNC_PTR
 extern "C" {
@@ -32,6 +37,109 @@ extern "C" {
 #define TLMU_MHZ (1000 * 1000)
 #define TLMU_GHZ (1000 * 1000 * 1000)
 
+/*
+ * Attached to every payload TLMu issues, lets models route or cache on
+ * the origin of an access without decoding it again.
+ */
+class tlmu_extension
+: public tlm::tlm_extension<tlmu_extension>
+{
+public:
+	enum access_type {
+		LOAD,
+		STORE,
+		FETCH,
+		DMA,
+		DEBUG
+	};
+
+	tlmu_extension()
+		: instance_id(0), clk(0), access(LOAD), cpu(-1) {}
+
+	tlm::tlm_extension_base *clone() const
+	{
+		return new tlmu_extension(*this);
+	}
+
+	void copy_from(const tlm::tlm_extension_base &ext)
+	{
+		*this = static_cast<const tlmu_extension &>(ext);
+	}
+
+	int instance_id;
+	/* QEMU vm_clock in ns when the access was issued.  */
+	int64_t clk;
+	enum access_type access;
+	/* Index of the issuing core, -1 if not made by a core.  */
+	int cpu;
+};
+
+/* Payloads handed out by tlmu_sc_payload_pool.  */
+class tlmu_sc_payload
+: public tlm::tlm_generic_payload
+{
+public:
+	tlmu_sc_payload(tlm::tlm_mm_interface *mm)
+		: tlm::tlm_generic_payload(mm), txn(NULL)
+	{
+		set_extension(&ext);
+	}
+
+	~tlmu_sc_payload()
+	{
+		/* ext is a member, don't let the payload free it.  */
+		clear_extension(&ext);
+	}
+
+	tlmu_extension ext;
+	/* The TLMu transaction of non-blocking accesses.  */
+	struct tlmu_nb_txn *txn;
+};
+
+/*
+ * Per instance payload pool. Payloads go back to the pool when their
+ * reference count drops to zero, models may acquire() them to hold on.
+ */
+class tlmu_sc_payload_pool
+: public tlm::tlm_mm_interface
+{
+public:
+	~tlmu_sc_payload_pool()
+	{
+		while (!pool.empty()) {
+			delete pool.back();
+			pool.pop_back();
+		}
+	}
+
+	tlmu_sc_payload *allocate(void)
+	{
+		tlmu_sc_payload *tr;
+
+		if (pool.empty()) {
+			tr = new tlmu_sc_payload(this);
+		} else {
+			tr = pool.back();
+			pool.pop_back();
+		}
+		tr->acquire();
+		return tr;
+	}
+
+	void free(tlm::tlm_generic_payload *trans)
+	{
+		tlmu_sc_payload *tr = static_cast<tlmu_sc_payload *>(trans);
+
+		/* reset() keeps our extension, it was not set as auto.  */
+		tr->reset();
+		tr->txn = NULL;
+		pool.push_back(tr);
+	}
+
+private:
+	std::vector<tlmu_sc_payload *> pool;
+};
+
 class tlmu_sc
 : public sc_core::sc_module
 {
@@ -42,8 +150,13 @@ public:
 		TRACING_PROF	= 2,
 		TRACING_COV	= 4
 	};
+	enum {
+		MAX_CPUS = 16
+	};
 
 	tlm_utils::simple_initiator_socket<tlmu_sc> from_tlmu_sk;
+	/* With smp(), accesses from core N > 0 go out on cpu_sk[N].  */
+	tlm_utils::simple_initiator_socket_tagged<tlmu_sc> *cpu_sk[MAX_CPUS];
 	tlm_utils::simple_target_socket<tlmu_sc> to_tlmu_sk;
 	tlm_utils::simple_target_socket<tlmu_sc> to_tlmu_irq_sk;
 
@@ -60,9 +173,16 @@ public:
 		 int64_t sync_period_ns=-1);
 
 	void map_ram(const char *name, uint64_t base, uint64_t size, int rw);
+	void map_region(const char *name, uint64_t base, uint64_t size,
+			uint32_t flags);
 	void set_image_load_params(uint64_t base, uint64_t size);
 	void append_arg(const char *newarg);
 	void gdb(const char *gdb_conn, bool wait_for_gdb_at_start=true);
+	void record(const char *filename);
+	void smp(unsigned int nr_cpus);
+	void enable_nb(void);
+	void icount(unsigned int shift);
+	void out_of_process(void);
 
 	void wake(void);
 	void sleep(void);
@@ -70,8 +190,10 @@ public:
 
 private:
 	tlm_utils::tlm_quantumkeeper m_qk;
-	/* Relative to 1Ghz.  */
-	double speed_factor;
+	uint64_t freq_hz;
+	unsigned int icount_shift;
+	char icount_arg[8];
+	tlmu_sc_clock clock;
 	const char *mach_name;
 	const char *cpu_model;
 	const char *elf_filename;
@@ -82,9 +204,19 @@ private:
 	struct tlmu q;
 	bool is_running;
 	sc_core::sc_event start;
+	unsigned int nr_cpus;
+	char smp_arg[16];
+
+	tlmu_sc_payload_pool payloads;
+	/* Non-blocking accesses in flight.  */
+	unsigned int nb_outstanding;
+	sc_core::sc_event nb_done_ev;
 
 	virtual void invalidate_direct_mem_ptr(sc_dt::uint64 start_range,
 					sc_dt::uint64 end_range);
+	virtual void cpu_invalidate_direct_mem_ptr(int id,
+					sc_dt::uint64 start_range,
+					sc_dt::uint64 end_range);
 
 	virtual bool to_tlmu_get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
 					tlm::tlm_dmi& dmi_data);
@@ -100,10 +232,24 @@ private:
 	void get_dmi_ptr(uint64_t addr, struct tlmu_dmi *dmi);
 	int bus_access(int64_t clk, int rw,
 				uint64_t addr, void *data, int len);
+	int bus_access_cpu(int64_t clk, int cpu, int access, int rw,
+				uint64_t addr, void *data, int len);
+	int bus_access_sk(tlm::tlm_initiator_socket<> &sk, int64_t clk,
+				int cpu, enum tlmu_extension::access_type access,
+				int rw, uint64_t addr, void *data, int len);
+	tlmu_sc_payload *get_payload(int64_t clk, int cpu,
+				enum tlmu_extension::access_type access,
+				int rw, uint64_t addr, void *data, int len);
+	int nb_access(struct tlmu_nb_txn *txn);
+	void nb_complete(tlmu_sc_payload *tr);
+	virtual tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload& trans,
+				tlm::tlm_phase& phase, sc_time& delay);
 	void bus_access_dbg(int64_t clk, int rw,
 			uint64_t addr, void *data, int len);
 	void sync(int64_t time_ns);
 	int64_t last_sync;
+	/* last_sync in SystemC resolution units.  */
+	uint64_t last_sync_units;
 };
 
 extern "C" {
@@ -113,6 +259,12 @@ void tlmu_set_sync_cb(struct tlmu *q, void (tlmu_sc::*cb) (int64_t));
 void tlmu_set_bus_access_cb(struct tlmu *q,
 			int (tlmu_sc::*access)(int64_t clk, int rw,
 				uint64_t addr, void *data, int len));
+void tlmu_set_bus_access_cpu_cb(struct tlmu *q,
+			int (tlmu_sc::*access)(int64_t clk, int cpu,
+				int access, int rw,
+				uint64_t addr, void *data, int len));
+void tlmu_set_nb_access_cb(struct tlmu *q,
+			int (tlmu_sc::*nb)(struct tlmu_nb_txn *txn));
 void tlmu_set_bus_access_dbg_cb(struct tlmu *q,
 			void (tlmu_sc::*access_debug)(int64_t clk, int rw,
                                 uint64_t addr, void *data, int len));
@@ -0,0 +1,95 @@
+/*
+ * TLMu to SystemC time conversion
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * With -icount N, QEMU advances vm_clock by 2^N ns per executed insn. An
+ * insn takes 1 / freq_hz seconds of target time. The conversion from
+ * vm_clock ns into SystemC time resolution units is done with a
+ * precomputed multiplier and shift. When the ratio is an integer it is
+ * exact, otherwise the error stays below one unit per 2^32 ns. Callers
+ * convert absolute times and take differences, so errors don't add up.
+ */
+class tlmu_sc_clock
+{
+public:
+	enum {
+		MULT_SHIFT = 32
+	};
+
+	tlmu_sc_clock() : freq_hz(0), units_per_sec(0), mult(0), shift(0) {}
+
+	/* res_fs is the SystemC time resolution in femto seconds.  */
+	void init(uint64_t freq, unsigned int icount_shift, uint64_t res_fs)
+	{
+		uint64_t num, den, a, b, t;
+
+		freq_hz = freq;
+		units_per_sec = 1000ULL * 1000 * 1000 * 1000 * 1000 / res_fs;
+
+		num = units_per_sec;
+		den = freq << icount_shift;
+		/* Reduce the ratio.  */
+		a = num;
+		b = den;
+		while (b) {
+			t = a % b;
+			a = b;
+			b = t;
+		}
+		num /= a;
+		den /= a;
+
+		if (den == 1) {
+			mult = num;
+			shift = 0;
+		} else {
+			/* num can be way above 32 bits, e.g at 1 ps resolution.  */
+			unsigned __int128 m;
+
+			m = ((unsigned __int128) num << MULT_SHIFT) / den;
+			assert(m <= UINT64_MAX);
+			mult = m;
+			shift = MULT_SHIFT;
+		}
+	}
+
+	/* vm_clock ns to SystemC resolution units.  */
+	uint64_t to_units(uint64_t ns) const
+	{
+		return ((unsigned __int128) ns * mult) >> shift;
+	}
+
+	/* SystemC resolution units to target insns, rounded up.  */
+	uint64_t units_to_insns(uint64_t units) const
+	{
+		return ((unsigned __int128) units * freq_hz + units_per_sec - 1)
+			/ units_per_sec;
+	}
+
+private:
+	uint64_t freq_hz;
+	uint64_t units_per_sec;
+	uint64_t mult;
+	unsigned int shift;
+};
@@ -11,10 +11,22 @@ int (*tlm_bus_access_cb)(void *o, int64_t clk, int rw,
                           uint64_t addr, void *data, int len);
 void (*tlm_bus_access_dbg_cb)(void *o, int64_t clk, int rw, uint64_t addr,
                               void *data, int len);
+/* Same as tlm_bus_access_cb but also gets the index of the accessing CPU,
+   -1 if not made by a CPU, and the kind of access (enum tlmu_access).
+   Used instead of tlm_bus_access_cb when set.  */
+int (*tlm_bus_access_cpu_cb)(void *o, int64_t clk, int cpu, int access,
+                             int rw, uint64_t addr, void *data, int len);
+/* Optional non-blocking accesses. Returns non-zero if the transaction was
+   accepted, see hw/tlmu/tlm_nb.c.  */
+int (*tlm_nb_access_cb)(void *o, struct tlmu_nb_txn *txn);
 
 void (*tlm_get_dmi_ptr_cb)(void *o, uint64_t addr,
                            struct tlmu_dmi *dmi) = 0;
 
+/* Optional receiver of FPGA bitstreams loaded by the emulated device
+   configuration interface, e.g the Zynq PCAP.  */
+void (*tlm_bitstream_cb)(void *o, const void *data, int len);
+
 /* Used to call out into the SystemC world every time the CPU gets
    a chance to synchronize. Typically done at TB exit and at
    external bus accesses.  */
@@ -34,5 +46,12 @@ uint64_t tlm_sync_period_ns = 0;
 
 int tlm_boot_state;
 
+/* Per page tracking of translated code in DMI windows shared with other
+   TLMu instances. Provided by libtlmu, NULL when running without it.  */
+int tlm_instance_id = -1;
+void *tlm_dmi_pages_opaque;
+uint64_t *(*tlm_dmi_pages_map)(void *o, uint64_t *base, uint64_t *size);
+void (*tlm_dmi_pages_written)(void *o, uint64_t addr, uint64_t len);
+
 uint64_t tlm_image_load_base = 0;
 uint64_t tlm_image_load_size = 0;
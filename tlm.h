@@ -10,8 +10,13 @@ extern int (*tlm_bus_access_cb)(void *o, int64_t clk, int rw,
 extern void (*tlm_bus_access_dbg_cb)(void *o, int64_t clk,
                                 int rw, uint64_t addr,
                                 void *data, int len);
+extern int (*tlm_bus_access_cpu_cb)(void *o, int64_t clk, int cpu,
+                                    int access, int rw,
+                                    uint64_t addr, void *data, int len);
+extern int (*tlm_nb_access_cb)(void *o, struct tlmu_nb_txn *txn);
 extern void (*tlm_get_dmi_ptr_cb)(void *o, uint64_t addr,
                                   struct tlmu_dmi *dmi);
+extern void (*tlm_bitstream_cb)(void *o, const void *data, int len);
 
 /* From SystemC into QEMU.  */
 extern int tlm_bus_access(int rw, uint64_t addr, void *data, int len);
@@ -27,6 +32,9 @@ extern void (*tlm_timer_start)(void *q, void *o,
    on these areas.  */
 void tlm_map_ram(const char *name, uint64_t addr, uint64_t size, int rw, int);
 void tlm_register_rams(void);
+/* Map a target of the main emulators memory map, flags are TLMU_REGION_*.  */
+void tlm_map_region(const char *name, uint64_t addr, uint64_t size,
+                    uint32_t flags);
 
 extern uint64_t tlm_sync_period_ns;
 
@@ -35,9 +43,38 @@ extern void tlm_notify_event(enum tlmu_event ev, void *d);
 /* Non-zero means running.  */
 extern int tlm_boot_state;
 
+extern int tlm_instance_id;
+extern void *tlm_dmi_pages_opaque;
+extern uint64_t *(*tlm_dmi_pages_map)(void *o, uint64_t *base, uint64_t *size);
+extern void (*tlm_dmi_pages_written)(void *o, uint64_t addr, uint64_t len);
+/* Called when a RAM page gets its first translated block.  */
+void tlm_code_page_protect(uint64_t ram_addr);
+
+/* Pages written through DMI windows and RAM maps.  */
+int tlm_get_dirty_bitmap(uint64_t base, uint64_t size,
+                         uint8_t *bitmap, int clear);
+
 extern uint64_t tlm_image_load_base;
 extern uint64_t tlm_image_load_size;
 
+/* Statistical PC sampling profiler, see hw/tlmu/tlm_prof.c.  */
+void tlm_set_profiling(const char *filename, uint64_t period_insns, int depth);
+void tlm_prof_init(void);
+
+/* Non-blocking transactions, see hw/tlmu/tlm_nb.c.  */
+int tlm_nb_submit(int rw, uint64_t addr, void *data, int len,
+                  void (*cb)(void *opaque, int status), void *opaque);
+int tlm_nb_post_write(int cpu, uint64_t addr, const void *data, int len);
+void tlm_nb_done(struct tlmu_nb_txn *txn);
+void tlm_nb_init(void);
+
+/* Record/replay of the main emulator responses, see hw/tlmu/tlm_rr.c.  */
+void tlm_set_record_replay(int mode, const char *filename);
+void tlm_rr_init(void);
+void tlm_rr_event(enum tlmu_event ev, void *d);
+void tlm_rr_map_region(const char *name, uint64_t addr, uint64_t size,
+                       uint32_t flags);
+
 #ifdef __cplusplus
 }
 #endif
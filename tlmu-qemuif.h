@@ -18,8 +18,45 @@ enum tlmu_event {
     TLMU_TLM_EVENT_INVALIDATE_DMI,
     TLMU_TLM_EVENT_RESET,
     TLMU_TLM_EVENT_DEBUG_BREAK,
+    TLMU_TLM_EVENT_INVALIDATE_CODE,
+    TLMU_TLM_EVENT_NB_DONE,
 };
 
+/*
+ * DMI windows shared between TLMu instances track, per page, which
+ * instances hold translated code from the page. Every page has a 64bit
+ * mask with one bit per instance id.
+ */
+#define TLMU_DMI_PAGE_BITS 12
+#define TLMU_DMI_PAGE_SIZE (1ULL << TLMU_DMI_PAGE_BITS)
+#define TLMU_MAX_INSTANCES 64
+
+enum tlmu_rr_mode {
+    TLMU_RR_OFF,
+    TLMU_RR_RECORD,
+    TLMU_RR_REPLAY
+};
+
+/* Kind of bus access, numbered like the is_write argument of tlb_fill.  */
+enum tlmu_access {
+    TLMU_ACCESS_LOAD = 0,
+    TLMU_ACCESS_STORE = 1,
+    TLMU_ACCESS_FETCH = 2,       /* Code fetch from a non DMI region.  */
+    TLMU_ACCESS_DMA = 3,         /* Not made by a CPU.  */
+};
+
+/* Per target policies for memory map regions.  */
+enum {
+    TLMU_REGION_DMI = 1,         /* Try to get DMI pointers.  */
+    TLMU_REGION_TURBO = 2,       /* Map DMI pointers directly as QEMU RAM.  */
+    TLMU_REGION_POSTED = 4,      /* Writes need no sync point.  */
+    TLMU_REGION_CACHEABLE = 8,   /* Memory, code may execute from it.  */
+    TLMU_REGION_SYNC = 16,       /* Sync with the main emulator on every
+                                    DMI access, opt-in.  */
+    TLMU_REGION_READONLY = 32,   /* Writes are dropped.  */
+    TLMU_REGION_ROM = 64,        /* Not writable as RAM, writes still go
+                                    to the target.  */
+};
 
 enum {
     TLMU_DMI_PROT_NONE = 0,
@@ -45,6 +82,21 @@ struct tlmu_dmi
     unsigned int write_latency;  /* Write access delay.  */
 };
 
+/*
+ * Non-blocking transaction. Owned by TLMu, the main emulator hands it back
+ * with a TLMU_TLM_EVENT_NB_DONE event when completed.
+ */
+struct tlmu_nb_txn
+{
+    uint64_t addr;
+    void *data;
+    int len;
+    int rw;
+    int cpu;                     /* Issuing core, -1 for device DMA.  */
+    int64_t clk;                 /* TLMu time when issued.  */
+    int status;                  /* Set by the main emulator, 0 if OK.  */
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1251 @@
+/*
+ * Out-of-process TLMu instances.
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * With tlmu_set_out_of_process(), tlmu_run() forks and the emulator runs
+ * in the child. The library was loaded and configured by the parent
+ * before the fork, so the child starts from the same state. In the child,
+ * the callbacks registered in the library are replaced by stubs that
+ * forward the calls to the parent over a pair of single producer, single
+ * consumer rings in shared memory:
+ *
+ *   up   - child to parent: callbacks and replies to parent requests
+ *   down - parent to child: events, accesses into TLMu and replies
+ *
+ * Requests that expect a reply carry a tag that the reply echoes. The
+ * parent serves the child from the thread running tlmu_run() and from
+ * whichever simulation thread waits for a reply. The child serves the
+ * parent from a service thread, timers run locally in the child.
+ *
+ * Host pointers in DMI replies are only usable by the child if they point
+ * into memory from tlmu_shm_alloc(). The backing memfd is passed to the
+ * child over a socket the first time it is needed and mapped there, other
+ * DMI pointers are refused and the accesses go over the rings.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/futex.h>
+
+#include "tlmu.h"
+#include "tlmu-remote.h"
+
+#define D(x)
+
+#define TLMU_RING_SLOTS 64
+#define TLMU_MSG_DATA 64
+/* Polls before sleeping on the futex.  */
+#define TLMU_RING_SPIN 4000
+/* How often a sleeping parent checks that the child is alive.  */
+#define TLMU_RING_TIMEOUT_NS (50 * 1000 * 1000)
+
+enum {
+	TLMU_MSG_REPLY,
+	/* Child to parent.  */
+	TLMU_MSG_BUS_ACCESS,
+	TLMU_MSG_BUS_ACCESS_DBG,
+	TLMU_MSG_NB_ACCESS,
+	TLMU_MSG_GET_DMI_PTR,
+	TLMU_MSG_SYNC,
+	TLMU_MSG_DMI_PAGES_MAP,
+	TLMU_MSG_DMI_PAGES_WRITTEN,
+	TLMU_MSG_BITSTREAM,
+	TLMU_MSG_EXIT,
+	/* Parent to child.  */
+	TLMU_MSG_NOTIFY,
+	TLMU_MSG_NB_DONE,
+	TLMU_MSG_BUS_ACCESS_IN,
+	TLMU_MSG_BUS_ACCESS_IN_DBG,
+	TLMU_MSG_DIRTY_BITMAP,
+	TLMU_MSG_SHUTDOWN,
+};
+
+struct tlmu_msg {
+	uint32_t type;
+	uint32_t tag;		/* Non-zero if a reply is expected.  */
+	int32_t ret;
+	int32_t len;
+	int32_t rw;
+	int32_t cpu;
+	int32_t access;
+	int64_t clk;
+	uint64_t addr;
+	uint64_t arg[3];
+	uint8_t data[TLMU_MSG_DATA];
+};
+
+struct tlmu_ring {
+	/* Written by the producer.  */
+	uint32_t head;
+	uint32_t producer_waiting;
+	uint8_t pad0[56];
+	/* Written by the consumer.  */
+	uint32_t tail;
+	uint32_t consumer_waiting;
+	uint8_t pad1[56];
+	struct tlmu_msg msg[TLMU_RING_SLOTS];
+};
+
+struct tlmu_rings {
+	struct tlmu_ring up;
+	struct tlmu_ring down;
+};
+
+/* A request waiting for its reply.  */
+struct tlmu_call {
+	uint32_t tag;
+	int done;
+	struct tlmu_msg reply;
+	struct tlmu_call *next;
+};
+
+struct tlmu_remote {
+	struct tlmu *q;
+	int is_child;
+	pid_t pid;
+	volatile int dead;
+	/* Unix socket used to pass memfds to the child.  */
+	int sk;
+
+	struct tlmu_rings *rings;
+	struct tlmu_ring *tx;
+	struct tlmu_ring *rx;
+	pthread_mutex_t tx_lock;
+
+	pthread_mutex_t calls_lock;
+	pthread_cond_t calls_cond;
+	struct tlmu_call *calls;
+	uint32_t next_tag;
+	/* The rx ring has a single consumer at a time, under calls_lock.  */
+	int rx_busy;
+	pthread_t rx_owner;
+
+	/* Child: the thread consuming the down ring.  */
+	pthread_t service;
+
+	/* Parent: regions with lower ids were inherited by the child.  */
+	uint32_t first_unsent;
+	uint8_t *sent;
+	uint32_t nr_sent;
+};
+
+/* Parent side proxy of a non-blocking transaction of the child.  */
+struct tlmu_nb_proxy {
+	struct tlmu_nb_txn txn;
+	uint64_t remote;
+	uint8_t data[TLMU_MSG_DATA];
+};
+
+/* Memory that can be mapped into out-of-process instances.  */
+struct tlmu_shm_region {
+	uint32_t id;
+	int fd;
+	uint8_t *ptr;
+	size_t size;
+	struct tlmu_shm_region *next;
+};
+
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tlmu_shm_region *shm_regions = NULL;
+static uint32_t shm_next_id = 1;
+
+static int tlmu_memfd_create(const char *name)
+{
+#ifdef SYS_memfd_create
+	return syscall(SYS_memfd_create, name, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Without memfd, fall back to anonymous shared memory. It is still shared
+ * with instances started later on, but can't be passed to running ones.
+ */
+void *tlmu_shm_alloc(size_t size)
+{
+	struct tlmu_shm_region *r;
+	void *p;
+	int fd;
+
+	fd = tlmu_memfd_create("tlmu-shm");
+	if (fd >= 0) {
+		if (ftruncate(fd, size)) {
+			perror("ftruncate");
+			close(fd);
+			return NULL;
+		}
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	} else {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	}
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	r = calloc(1, sizeof *r);
+	if (!r) {
+		munmap(p, size);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	r->fd = fd;
+	r->ptr = p;
+	r->size = size;
+	pthread_mutex_lock(&shm_lock);
+	r->id = shm_next_id++;
+	r->next = shm_regions;
+	shm_regions = r;
+	pthread_mutex_unlock(&shm_lock);
+	return p;
+}
+
+void tlmu_shm_free(void *p)
+{
+	struct tlmu_shm_region **rp, *r;
+
+	pthread_mutex_lock(&shm_lock);
+	for (rp = &shm_regions; *rp; rp = &(*rp)->next) {
+		r = *rp;
+		if (r->ptr == p) {
+			*rp = r->next;
+			munmap(r->ptr, r->size);
+			if (r->fd >= 0) {
+				close(r->fd);
+			}
+			free(r);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&shm_lock);
+}
+
+/* Called with shm_lock held.  */
+static struct tlmu_shm_region *tlmu_shm_find(const void *p, uint64_t len)
+{
+	const uint8_t *b = p;
+	struct tlmu_shm_region *r;
+
+	for (r = shm_regions; r; r = r->next) {
+		if (b >= r->ptr && b - r->ptr + len <= r->size) {
+			return r;
+		}
+	}
+	return NULL;
+}
+
+/* Called with shm_lock held.  */
+static struct tlmu_shm_region *tlmu_shm_find_id(uint32_t id)
+{
+	struct tlmu_shm_region *r;
+
+	for (r = shm_regions; r; r = r->next) {
+		if (r->id == id) {
+			return r;
+		}
+	}
+	return NULL;
+}
+
+struct tlmu_shm_hdr {
+	uint32_t id;
+	uint64_t size;
+};
+
+static int tlmu_send_fd(int sk, int fd, const struct tlmu_shm_hdr *hdr)
+{
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} u;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t r;
+
+	memset(&msg, 0, sizeof msg);
+	iov.iov_base = (void *) hdr;
+	iov.iov_len = sizeof *hdr;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof u.buf;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+
+	do {
+		r = sendmsg(sk, &msg, 0);
+	} while (r < 0 && errno == EINTR);
+	return r == sizeof *hdr ? 0 : -1;
+}
+
+static int tlmu_recv_fd(int sk, struct tlmu_shm_hdr *hdr)
+{
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} u;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t r;
+	int fd = -1;
+
+	memset(&msg, 0, sizeof msg);
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof *hdr;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof u.buf;
+
+	do {
+		r = recvmsg(sk, &msg, 0);
+	} while (r < 0 && errno == EINTR);
+	if (r != sizeof *hdr) {
+		return -1;
+	}
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+	    && cmsg->cmsg_type == SCM_RIGHTS) {
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+	}
+	return fd;
+}
+
+/*
+ * Parent: make the region holding [p, p + len) available to the child.
+ * Returns the region id and the offset of p, zero if not shareable.
+ */
+static uint32_t tlmu_parent_share(struct tlmu_remote *r, const void *p,
+				  uint64_t len, uint64_t *offset)
+{
+	struct tlmu_shm_region *reg;
+	struct tlmu_shm_hdr hdr;
+	uint32_t id = 0, idx;
+
+	pthread_mutex_lock(&shm_lock);
+	reg = tlmu_shm_find(p, len);
+	if (!reg) {
+		goto done;
+	}
+	*offset = (const uint8_t *) p - reg->ptr;
+	if (reg->id < r->first_unsent) {
+		id = reg->id;
+		goto done;
+	}
+	if (reg->fd < 0) {
+		goto done;
+	}
+
+	idx = reg->id - r->first_unsent;
+	if (idx >= r->nr_sent) {
+		uint32_t n = idx + 64;
+
+		r->sent = realloc(r->sent, n);
+		memset(r->sent + r->nr_sent, 0, n - r->nr_sent);
+		r->nr_sent = n;
+	}
+	if (!r->sent[idx]) {
+		hdr.id = reg->id;
+		hdr.size = reg->size;
+		if (tlmu_send_fd(r->sk, reg->fd, &hdr)) {
+			perror("sendmsg");
+			goto done;
+		}
+		r->sent[idx] = 1;
+	}
+	id = reg->id;
+done:
+	pthread_mutex_unlock(&shm_lock);
+	return id;
+}
+
+/* Child: map a region shared by the parent.  */
+static void *tlmu_child_shm_ptr(struct tlmu_remote *r, uint32_t id,
+				uint64_t offset)
+{
+	struct tlmu_shm_region *reg;
+	struct tlmu_shm_hdr hdr;
+	void *p;
+	int fd;
+
+	if (!id) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&shm_lock);
+	/* The parent sends the fd before the reply referring to it.  */
+	while (!(reg = tlmu_shm_find_id(id))) {
+		fd = tlmu_recv_fd(r->sk, &hdr);
+		if (fd < 0) {
+			break;
+		}
+		p = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			close(fd);
+			continue;
+		}
+		reg = calloc(1, sizeof *reg);
+		reg->id = hdr.id;
+		reg->fd = fd;
+		reg->ptr = p;
+		reg->size = hdr.size;
+		reg->next = shm_regions;
+		shm_regions = reg;
+	}
+	pthread_mutex_unlock(&shm_lock);
+	return reg ? reg->ptr + offset : NULL;
+}
+
+static void tlmu_futex_wait(uint32_t *addr, uint32_t val)
+{
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = TLMU_RING_TIMEOUT_NS;
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void tlmu_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Parent: notice if the child went away.  */
+static void tlmu_remote_check_alive(struct tlmu_remote *r)
+{
+	int status;
+
+	if (r->is_child || r->dead || r->pid <= 0) {
+		return;
+	}
+	if (waitpid(r->pid, &status, WNOHANG) == r->pid) {
+		r->dead = 1;
+		if (WIFSIGNALED(status)) {
+			fprintf(stderr, "TLMu instance %s killed by signal %d\n",
+				r->q->name, WTERMSIG(status));
+		} else {
+			fprintf(stderr, "TLMu instance %s exited with %d\n",
+				r->q->name, WEXITSTATUS(status));
+		}
+	}
+}
+
+static void tlmu_ring_push(struct tlmu_remote *r, const struct tlmu_msg *m)
+{
+	struct tlmu_ring *ring = r->tx;
+	uint32_t head, tail;
+
+	pthread_mutex_lock(&r->tx_lock);
+	head = ring->head;
+	for (;;) {
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - tail < TLMU_RING_SLOTS || r->dead) {
+			break;
+		}
+		/* Full, wait for the consumer.  */
+		__atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == tail) {
+			tlmu_futex_wait(&ring->tail, tail);
+		}
+		__atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+		tlmu_remote_check_alive(r);
+	}
+	if (!r->dead) {
+		ring->msg[head % TLMU_RING_SLOTS] = *m;
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_SEQ_CST)) {
+			tlmu_futex_wake(&ring->head);
+		}
+	}
+	pthread_mutex_unlock(&r->tx_lock);
+}
+
+/* Returns zero with a message in m, -1 if the other side is gone.  */
+static int tlmu_ring_pop(struct tlmu_remote *r, struct tlmu_msg *m)
+{
+	struct tlmu_ring *ring = r->rx;
+	uint32_t tail = ring->tail;
+	unsigned int spin = 0;
+
+	while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+		if (r->dead) {
+			return -1;
+		}
+		if (spin < TLMU_RING_SPIN) {
+			spin++;
+			continue;
+		}
+		__atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail) {
+			tlmu_futex_wait(&ring->head, tail);
+		}
+		__atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_RELAXED);
+		tlmu_remote_check_alive(r);
+	}
+
+	*m = ring->msg[tail % TLMU_RING_SLOTS];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST)) {
+		tlmu_futex_wake(&ring->tail);
+	}
+	return 0;
+}
+
+static void tlmu_remote_reply(struct tlmu_remote *r, struct tlmu_msg *m)
+{
+	if (m->tag) {
+		m->type = TLMU_MSG_REPLY;
+		tlmu_ring_push(r, m);
+	}
+}
+
+static void tlmu_remote_deliver(struct tlmu_remote *r,
+				const struct tlmu_msg *m)
+{
+	struct tlmu_call *c;
+
+	pthread_mutex_lock(&r->calls_lock);
+	for (c = r->calls; c; c = c->next) {
+		if (c->tag == m->tag) {
+			c->reply = *m;
+			c->done = 1;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&r->calls_cond);
+	pthread_mutex_unlock(&r->calls_lock);
+}
+
+static void tlmu_parent_dispatch(struct tlmu_remote *r, struct tlmu_msg *m);
+static void tlmu_child_dispatch(struct tlmu_remote *r, struct tlmu_msg *m);
+
+static int tlmu_remote_serve_one(struct tlmu_remote *r)
+{
+	struct tlmu_msg m;
+
+	if (tlmu_ring_pop(r, &m)) {
+		return -1;
+	}
+	if (m.type == TLMU_MSG_REPLY) {
+		tlmu_remote_deliver(r, &m);
+	} else if (r->is_child) {
+		tlmu_child_dispatch(r, &m);
+	} else {
+		tlmu_parent_dispatch(r, &m);
+	}
+	return 0;
+}
+
+/*
+ * Consume the rx ring until c is done, or until the other side is gone if
+ * c is NULL. Only one thread consumes at a time, it delivers the replies
+ * of the others. Calls made from the callbacks it serves consume the ring
+ * recursively. Returns -1 if the other side is gone.
+ */
+static int tlmu_remote_serve(struct tlmu_remote *r, struct tlmu_call *c)
+{
+	pthread_t self = pthread_self();
+	int nested, ret = 0;
+
+	pthread_mutex_lock(&r->calls_lock);
+	while (!(c && c->done)) {
+		if (r->rx_busy && !pthread_equal(r->rx_owner, self)) {
+			pthread_cond_wait(&r->calls_cond, &r->calls_lock);
+			continue;
+		}
+		nested = r->rx_busy;
+		r->rx_busy = 1;
+		r->rx_owner = self;
+		pthread_mutex_unlock(&r->calls_lock);
+
+		ret = tlmu_remote_serve_one(r);
+
+		pthread_mutex_lock(&r->calls_lock);
+		if (!nested) {
+			r->rx_busy = 0;
+			/* Let a waiter take over the ring.  */
+			pthread_cond_broadcast(&r->calls_cond);
+		}
+		if (ret) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&r->calls_lock);
+	return ret;
+}
+
+/*
+ * Send a request and wait for the reply, which replaces *m. Requests from
+ * the other side are served meanwhile. Returns -1 if the other side is
+ * gone.
+ */
+static int tlmu_remote_call(struct tlmu_remote *r, struct tlmu_msg *m)
+{
+	struct tlmu_call c, **cp;
+
+	memset(&c, 0, sizeof c);
+	pthread_mutex_lock(&r->calls_lock);
+	do {
+		c.tag = ++r->next_tag;
+	} while (!c.tag);
+	c.next = r->calls;
+	r->calls = &c;
+	pthread_mutex_unlock(&r->calls_lock);
+
+	m->tag = c.tag;
+	tlmu_ring_push(r, m);
+
+	if (r->is_child && !pthread_equal(pthread_self(), r->service)) {
+		/* The service thread hands us the reply.  */
+		pthread_mutex_lock(&r->calls_lock);
+		while (!c.done) {
+			pthread_cond_wait(&r->calls_cond, &r->calls_lock);
+		}
+		pthread_mutex_unlock(&r->calls_lock);
+	} else {
+		tlmu_remote_serve(r, &c);
+	}
+
+	pthread_mutex_lock(&r->calls_lock);
+	for (cp = &r->calls; *cp != &c; cp = &(*cp)->next) {
+		continue;
+	}
+	*cp = c.next;
+	pthread_mutex_unlock(&r->calls_lock);
+
+	if (!c.done) {
+		return -1;
+	}
+	*m = c.reply;
+	return 0;
+}
+
+static void tlmu_remote_put_dmi(struct tlmu_remote *r, struct tlmu_msg *m,
+				struct tlmu_dmi *dmi)
+{
+	uint64_t offset = 0;
+
+	m->arg[0] = 0;
+	if (dmi->ptr) {
+		m->arg[0] = tlmu_parent_share(r, dmi->ptr, dmi->size, &offset);
+		m->arg[1] = offset;
+		if (!m->arg[0]) {
+			/* Not in shared memory, stay on the bus.  */
+			dmi->prot = TLMU_DMI_PROT_NONE;
+		}
+	}
+	dmi->ptr = NULL;
+	memcpy(m->data, dmi, sizeof *dmi);
+}
+
+/* Parent: serve a request from the child.  */
+static void tlmu_parent_dispatch(struct tlmu_remote *r, struct tlmu_msg *m)
+{
+	struct tlmu *q = r->q;
+	void *o = *q->tlm_opaque;
+	struct tlmu_nb_proxy *p;
+	struct tlmu_dmi dmi;
+	uint64_t base, size, offset = 0;
+	uint64_t *code;
+
+	switch (m->type) {
+	case TLMU_MSG_BUS_ACCESS:
+		if (m->cpu != INT_MIN) {
+			m->ret = (*q->tlm_bus_access_cpu_cb)(o, m->clk, m->cpu,
+					m->access, m->rw, m->addr,
+					m->data, m->len);
+		} else {
+			m->ret = (*q->tlm_bus_access_cb)(o, m->clk,
+					m->rw, m->addr, m->data, m->len);
+		}
+		break;
+	case TLMU_MSG_BUS_ACCESS_DBG:
+		(*q->tlm_bus_access_dbg_cb)(o, m->clk, m->rw, m->addr,
+					    m->data, m->len);
+		break;
+	case TLMU_MSG_NB_ACCESS:
+		p = calloc(1, sizeof *p);
+		p->remote = m->arg[0];
+		p->txn.addr = m->addr;
+		p->txn.data = p->data;
+		p->txn.len = m->len;
+		p->txn.rw = m->rw;
+		p->txn.cpu = m->cpu;
+		p->txn.clk = m->clk;
+		memcpy(p->data, m->data, m->len);
+		m->ret = (*q->tlm_nb_access_cb)(o, &p->txn);
+		if (!m->ret) {
+			free(p);
+		}
+		break;
+	case TLMU_MSG_GET_DMI_PTR:
+		memcpy(&dmi, m->data, sizeof dmi);
+		dmi.ptr = NULL;
+		(*q->tlm_get_dmi_ptr_cb)(o, m->addr, &dmi);
+		tlmu_remote_put_dmi(r, m, &dmi);
+		break;
+	case TLMU_MSG_SYNC:
+		(*q->tlm_sync)(o, m->clk);
+		break;
+	case TLMU_MSG_DMI_PAGES_MAP:
+		base = m->addr;
+		size = m->arg[2];
+		code = (*q->tlm_dmi_pages_map)(*q->tlm_dmi_pages_opaque,
+					       &base, &size);
+		m->arg[0] = 0;
+		if (code) {
+			m->arg[0] = tlmu_parent_share(r, code,
+				((size + TLMU_DMI_PAGE_SIZE - 1)
+				 >> TLMU_DMI_PAGE_BITS) * sizeof *code,
+				&offset);
+		}
+		m->arg[1] = offset;
+		m->addr = base;
+		m->arg[2] = size;
+		break;
+	case TLMU_MSG_DMI_PAGES_WRITTEN:
+		(*q->tlm_dmi_pages_written)(*q->tlm_dmi_pages_opaque,
+					    m->addr, m->arg[0]);
+		break;
+	case TLMU_MSG_BITSTREAM:
+		(*q->tlm_bitstream_cb)(o, m->data, m->len);
+		break;
+	case TLMU_MSG_EXIT:
+		waitpid(r->pid, NULL, 0);
+		r->dead = 1;
+		break;
+	default:
+		fprintf(stderr, "%s: unknown message %d\n", __func__, m->type);
+		break;
+	}
+	tlmu_remote_reply(r, m);
+}
+
+/* Child: serve a request from the parent.  */
+static void tlmu_child_dispatch(struct tlmu_remote *r, struct tlmu_msg *m)
+{
+	struct tlmu *q = r->q;
+	struct tlmu_nb_txn *txn;
+	struct tlmu_irq irq;
+	struct tlmu_dmi dmi;
+
+	switch (m->type) {
+	case TLMU_MSG_NOTIFY:
+		switch (m->arg[0]) {
+		case TLMU_TLM_EVENT_IRQ:
+			memcpy(&irq, m->data, sizeof irq);
+			q->tlm_notify_event(m->arg[0], &irq);
+			break;
+		case TLMU_TLM_EVENT_INVALIDATE_DMI:
+		case TLMU_TLM_EVENT_INVALIDATE_CODE:
+			memcpy(&dmi, m->data, sizeof dmi);
+			q->tlm_notify_event(m->arg[0], &dmi);
+			break;
+		default:
+			q->tlm_notify_event(m->arg[0], NULL);
+			break;
+		}
+		break;
+	case TLMU_MSG_NB_DONE:
+		txn = (struct tlmu_nb_txn *) (uintptr_t) m->arg[0];
+		txn->status = m->ret;
+		if (!txn->rw) {
+			memcpy(txn->data, m->data, txn->len);
+		}
+		q->tlm_notify_event(TLMU_TLM_EVENT_NB_DONE, txn);
+		break;
+	case TLMU_MSG_BUS_ACCESS_IN:
+		m->ret = q->tlm_bus_access(m->rw, m->addr, m->data, m->len);
+		break;
+	case TLMU_MSG_BUS_ACCESS_IN_DBG:
+		q->tlm_bus_access_dbg(m->rw, m->addr, m->data, m->len);
+		break;
+	case TLMU_MSG_DIRTY_BITMAP:
+		memset(m->data, 0, sizeof m->data);
+		m->ret = q->tlm_get_dirty_bitmap(m->addr, m->arg[0],
+						 m->data, m->arg[1]);
+		break;
+	case TLMU_MSG_SHUTDOWN:
+		q->qemu_system_shutdown_request();
+		break;
+	default:
+		fprintf(stderr, "%s: unknown message %d\n", __func__, m->type);
+		break;
+	}
+	tlmu_remote_reply(r, m);
+}
+
+/* Child stubs, called by the emulator instead of the parent's callbacks.  */
+static int tlmu_child_access(struct tlmu *q, int type, int64_t clk, int cpu,
+			     int access, int rw, uint64_t addr,
+			     void *data, int len)
+{
+	struct tlmu_msg m;
+	uint8_t *d = data;
+	int ret = 0;
+	int l;
+
+	while (len > 0) {
+		l = len > TLMU_MSG_DATA ? TLMU_MSG_DATA : len;
+		memset(&m, 0, sizeof m);
+		m.type = type;
+		m.clk = clk;
+		m.cpu = cpu;
+		m.access = access;
+		m.rw = rw;
+		m.addr = addr;
+		m.len = l;
+		if (rw) {
+			memcpy(m.data, d, l);
+		}
+		if (tlmu_remote_call(q->remote, &m)) {
+			break;
+		}
+		if (!rw) {
+			memcpy(d, m.data, l);
+		}
+		ret = m.ret;
+		addr += l;
+		d += l;
+		len -= l;
+	}
+	return ret;
+}
+
+static int tlmu_child_bus_access(void *o, int64_t clk, int rw,
+				 uint64_t addr, void *data, int len)
+{
+	return tlmu_child_access(o, TLMU_MSG_BUS_ACCESS, clk, INT_MIN, 0,
+				 rw, addr, data, len);
+}
+
+static int tlmu_child_bus_access_cpu(void *o, int64_t clk, int cpu,
+				     int access, int rw, uint64_t addr,
+				     void *data, int len)
+{
+	return tlmu_child_access(o, TLMU_MSG_BUS_ACCESS, clk, cpu, access,
+				 rw, addr, data, len);
+}
+
+static void tlmu_child_bus_access_dbg(void *o, int64_t clk, int rw,
+				      uint64_t addr, void *data, int len)
+{
+	tlmu_child_access(o, TLMU_MSG_BUS_ACCESS_DBG, clk, INT_MIN, 0,
+			  rw, addr, data, len);
+}
+
+static void tlmu_child_bitstream(void *o, const void *data, int len)
+{
+	tlmu_child_access(o, TLMU_MSG_BITSTREAM, 0, INT_MIN, 0,
+			  1, 0, (void *) data, len);
+}
+
+static int tlmu_child_nb_access(void *o, struct tlmu_nb_txn *txn)
+{
+	struct tlmu *q = o;
+	struct tlmu_msg m;
+
+	/* Large transactions fall back to blocking accesses.  */
+	if (txn->len > TLMU_MSG_DATA) {
+		return 0;
+	}
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_NB_ACCESS;
+	m.arg[0] = (uintptr_t) txn;
+	m.addr = txn->addr;
+	m.len = txn->len;
+	m.rw = txn->rw;
+	m.cpu = txn->cpu;
+	m.clk = txn->clk;
+	if (txn->rw) {
+		memcpy(m.data, txn->data, txn->len);
+	}
+	if (tlmu_remote_call(q->remote, &m)) {
+		return 0;
+	}
+	return m.ret;
+}
+
+static void tlmu_child_get_dmi_ptr(void *o, uint64_t addr,
+				   struct tlmu_dmi *dmi)
+{
+	struct tlmu *q = o;
+	struct tlmu_msg m;
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_GET_DMI_PTR;
+	m.addr = addr;
+	memcpy(m.data, dmi, sizeof *dmi);
+	if (tlmu_remote_call(q->remote, &m)) {
+		return;
+	}
+	memcpy(dmi, m.data, sizeof *dmi);
+	dmi->ptr = tlmu_child_shm_ptr(q->remote, m.arg[0], m.arg[1]);
+	if (!dmi->ptr) {
+		dmi->prot = TLMU_DMI_PROT_NONE;
+	}
+}
+
+static void tlmu_child_sync(void *o, int64_t time_ns)
+{
+	struct tlmu *q = o;
+	struct tlmu_msg m;
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_SYNC;
+	m.clk = time_ns;
+	tlmu_remote_call(q->remote, &m);
+}
+
+static uint64_t *tlmu_child_dmi_pages_map(void *o, uint64_t *base,
+					  uint64_t *size)
+{
+	struct tlmu *q = o;
+	struct tlmu_msg m;
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_DMI_PAGES_MAP;
+	m.addr = *base;
+	m.arg[2] = *size;
+	if (tlmu_remote_call(q->remote, &m)) {
+		return NULL;
+	}
+	*base = m.addr;
+	*size = m.arg[2];
+	return tlmu_child_shm_ptr(q->remote, m.arg[0], m.arg[1]);
+}
+
+static void tlmu_child_dmi_pages_written(void *o, uint64_t addr,
+					 uint64_t len)
+{
+	struct tlmu *q = o;
+	struct tlmu_msg m;
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_DMI_PAGES_WRITTEN;
+	m.addr = addr;
+	m.arg[0] = len;
+	tlmu_ring_push(q->remote, &m);
+}
+
+static void *tlmu_child_service(void *opaque)
+{
+	struct tlmu_remote *r = opaque;
+
+	while (!tlmu_remote_serve_one(r)) {
+		continue;
+	}
+	return NULL;
+}
+
+static void tlmu_remote_init_locks(struct tlmu_remote *r)
+{
+	pthread_mutex_init(&r->tx_lock, NULL);
+	pthread_mutex_init(&r->calls_lock, NULL);
+	pthread_cond_init(&r->calls_cond, NULL);
+	r->calls = NULL;
+	r->rx_busy = 0;
+}
+
+static void tlmu_child_run(struct tlmu *q)
+{
+	struct tlmu_remote *r = q->remote;
+	struct tlmu_msg m;
+	sigset_t all, old;
+
+	/* Don't outlive the main emulator.  */
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	if (getppid() == 1) {
+		_exit(1);
+	}
+
+	/* Other threads of the parent may have held these at fork.  */
+	pthread_mutex_init(&shm_lock, NULL);
+	tlmu_remote_init_locks(r);
+	r->is_child = 1;
+	r->tx = &r->rings->up;
+	r->rx = &r->rings->down;
+	tlmu_timers_reinit(q);
+
+	*q->tlm_opaque = q;
+	if (*q->tlm_bus_access_cb) {
+		*q->tlm_bus_access_cb = tlmu_child_bus_access;
+	}
+	if (*q->tlm_bus_access_cpu_cb) {
+		*q->tlm_bus_access_cpu_cb = tlmu_child_bus_access_cpu;
+	}
+	if (*q->tlm_bus_access_dbg_cb) {
+		*q->tlm_bus_access_dbg_cb = tlmu_child_bus_access_dbg;
+	}
+	if (*q->tlm_nb_access_cb) {
+		*q->tlm_nb_access_cb = tlmu_child_nb_access;
+	}
+	if (*q->tlm_get_dmi_ptr_cb) {
+		*q->tlm_get_dmi_ptr_cb = tlmu_child_get_dmi_ptr;
+	}
+	if (*q->tlm_bitstream_cb) {
+		*q->tlm_bitstream_cb = tlmu_child_bitstream;
+	}
+	if (*q->tlm_sync) {
+		*q->tlm_sync = tlmu_child_sync;
+	}
+	if (*q->tlm_dmi_pages_map) {
+		*q->tlm_dmi_pages_opaque = q;
+		*q->tlm_dmi_pages_map = tlmu_child_dmi_pages_map;
+		*q->tlm_dmi_pages_written = tlmu_child_dmi_pages_written;
+	}
+
+	/* Signals, e.g the host timer, go to the emulator threads.  */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	if (pthread_create(&r->service, NULL, tlmu_child_service, r)) {
+		perror("pthread_create");
+		_exit(1);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	tlmu_run_local(q);
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_EXIT;
+	tlmu_ring_push(r, &m);
+	/* Skip the atexit handlers of the parent.  */
+	fflush(NULL);
+	_exit(0);
+}
+
+void tlmu_set_out_of_process(struct tlmu *q, int enable)
+{
+	if (!enable) {
+		free(q->remote);
+		q->remote = NULL;
+		return;
+	}
+	if (!q->remote) {
+		q->remote = calloc(1, sizeof *q->remote);
+		q->remote->q = q;
+		q->remote->sk = -1;
+	}
+}
+
+int tlmu_remote_active(struct tlmu *q)
+{
+	return q->remote && q->remote->pid > 0;
+}
+
+void tlmu_remote_run(struct tlmu *q)
+{
+	struct tlmu_remote *r = q->remote;
+	int sv[2];
+	pid_t pid;
+
+	/* Allocated before the fork, the child inherits the mapping.  */
+	r->rings = tlmu_shm_alloc(sizeof *r->rings);
+	if (!r->rings) {
+		return;
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) {
+		perror("socketpair");
+		return;
+	}
+	tlmu_remote_init_locks(r);
+
+	pthread_mutex_lock(&shm_lock);
+	r->first_unsent = shm_next_id;
+	pthread_mutex_unlock(&shm_lock);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		r->sk = sv[1];
+		tlmu_child_run(q);
+	}
+
+	close(sv[1]);
+	r->sk = sv[0];
+	r->tx = &r->rings->down;
+	r->rx = &r->rings->up;
+	r->pid = pid;
+	D(printf("%s: %s runs in pid %d\n", __func__, q->name, pid));
+
+	tlmu_remote_serve(r, NULL);
+	close(r->sk);
+	r->sk = -1;
+}
+
+void tlmu_remote_notify(struct tlmu *q, enum tlmu_event ev, void *d)
+{
+	struct tlmu_remote *r = q->remote;
+	struct tlmu_nb_proxy *p;
+	struct tlmu_msg m;
+
+	memset(&m, 0, sizeof m);
+	switch (ev) {
+	case TLMU_TLM_EVENT_NB_DONE:
+		/* May come from any thread, nobody waits for it.  */
+		p = d;
+		m.type = TLMU_MSG_NB_DONE;
+		m.arg[0] = p->remote;
+		m.ret = p->txn.status;
+		if (!p->txn.rw) {
+			memcpy(m.data, p->data, p->txn.len);
+		}
+		tlmu_ring_push(r, &m);
+		free(p);
+		return;
+	case TLMU_TLM_EVENT_IRQ:
+		memcpy(m.data, d, sizeof(struct tlmu_irq));
+		break;
+	case TLMU_TLM_EVENT_INVALIDATE_DMI:
+	case TLMU_TLM_EVENT_INVALIDATE_CODE:
+		memcpy(m.data, d, sizeof(struct tlmu_dmi));
+		break;
+	default:
+		break;
+	}
+
+	m.type = TLMU_MSG_NOTIFY;
+	m.arg[0] = ev;
+	if (ev == TLMU_TLM_EVENT_INVALIDATE_CODE) {
+		/* Queued by the emulator anyway.  */
+		tlmu_ring_push(r, &m);
+		return;
+	}
+	/* Like in process, the event has been handled when we return.  */
+	tlmu_remote_call(r, &m);
+}
+
+int tlmu_remote_bus_access(struct tlmu *q, int dbg, int rw,
+			   uint64_t addr, void *data, int len)
+{
+	struct tlmu_msg m;
+	uint8_t *d = data;
+	int ret = 0;
+	int l;
+
+	while (len > 0) {
+		l = len > TLMU_MSG_DATA ? TLMU_MSG_DATA : len;
+		memset(&m, 0, sizeof m);
+		m.type = dbg ? TLMU_MSG_BUS_ACCESS_IN_DBG : TLMU_MSG_BUS_ACCESS_IN;
+		m.rw = rw;
+		m.addr = addr;
+		m.len = l;
+		if (rw) {
+			memcpy(m.data, d, l);
+		}
+		if (tlmu_remote_call(q->remote, &m)) {
+			return 0;
+		}
+		if (!rw) {
+			memcpy(d, m.data, l);
+		}
+		ret = m.ret;
+		addr += l;
+		d += l;
+		len -= l;
+	}
+	return ret;
+}
+
+int tlmu_remote_get_dirty_bitmap(struct tlmu *q, uint64_t base,
+				 uint64_t size, uint8_t *bitmap, int clear)
+{
+	/* Every message carries the bits of TLMU_MSG_DATA * 8 pages.  */
+	const uint64_t chunk = (uint64_t) TLMU_MSG_DATA * 8 << TLMU_DMI_PAGE_BITS;
+	struct tlmu_msg m;
+	uint64_t off, len, nr_bytes, i;
+	int ret = 0;
+
+	for (off = 0; off < size; off += chunk) {
+		len = size - off < chunk ? size - off : chunk;
+		memset(&m, 0, sizeof m);
+		m.type = TLMU_MSG_DIRTY_BITMAP;
+		m.addr = base + off;
+		m.arg[0] = len;
+		m.arg[1] = clear;
+		if (tlmu_remote_call(q->remote, &m)) {
+			break;
+		}
+		nr_bytes = (((len + TLMU_DMI_PAGE_SIZE - 1) >> TLMU_DMI_PAGE_BITS)
+			    + 7) / 8;
+		for (i = 0; i < nr_bytes; i++) {
+			bitmap[off / chunk * TLMU_MSG_DATA + i] |= m.data[i];
+		}
+		ret += m.ret;
+	}
+	return ret;
+}
+
+void tlmu_remote_exit(struct tlmu *q)
+{
+	struct tlmu_msg m;
+
+	memset(&m, 0, sizeof m);
+	m.type = TLMU_MSG_SHUTDOWN;
+	tlmu_ring_push(q->remote, &m);
+}
@@ -0,0 +1,41 @@
+/*
+ * Out-of-process TLMu instances.
+ *
+ * Copyright (c) 2011 Edgar E. Iglesias.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Internal interface between tlmu.c and tlmu-remote.c.  */
+#ifndef TLMU_TLMU_REMOTE_H
+#define TLMU_TLMU_REMOTE_H
+
+int tlmu_remote_active(struct tlmu *q);
+void tlmu_remote_run(struct tlmu *q);
+void tlmu_remote_exit(struct tlmu *q);
+void tlmu_remote_notify(struct tlmu *q, enum tlmu_event ev, void *d);
+int tlmu_remote_bus_access(struct tlmu *q, int dbg, int rw,
+			   uint64_t addr, void *data, int len);
+int tlmu_remote_get_dirty_bitmap(struct tlmu *q, uint64_t base,
+				 uint64_t size, uint8_t *bitmap, int clear);
+
+/* Provided by tlmu.c.  */
+void tlmu_run_local(struct tlmu *q);
+void tlmu_timers_reinit(struct tlmu *q);
+#endif
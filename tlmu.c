@@ -45,6 +45,20 @@
 #include <dlfcn.h>
 
 #include "tlmu.h"
+#include "tlmu-remote.h"
+
+/* DMI windows with per page code ownership, shared by all instances.  */
+struct tlmu_dmi_window {
+	uint64_t base;
+	uint64_t size;
+	uint64_t *code;
+	struct tlmu_dmi_window *next;
+};
+
+static pthread_mutex_t dmi_windows_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct tlmu_dmi_window *dmi_windows = NULL;
+static struct tlmu *instances[TLMU_MAX_INSTANCES];
+static int nr_instances = 0; /* protected by timer mutex.  */
 
 static timer_t tlmu_hosttimer;
 pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -191,6 +205,7 @@ void tlmu_init(struct tlmu *t, const char *name)
 
 	memset(t, 0, sizeof *t);
 	t->name = name;
+	t->id = -1;
 
 	/* Setup the default args.  */
 	tlmu_append_arg(t, "TLMu");
@@ -211,9 +226,133 @@ void tlmu_init(struct tlmu *t, const char *name)
 
 	t->timer.next = timers;
 	timers = &t->timer;
+
+	if (nr_instances < TLMU_MAX_INSTANCES) {
+		t->id = nr_instances++;
+		instances[t->id] = t;
+	}
 	pthread_mutex_unlock(&timer_mutex);
 }
 
+/*
+ * In the child of an out-of-process instance, keep only the timer of q
+ * and recreate the host timer, timers are not inherited over fork. Timer
+ * callbacks registered by the parent can't run in the child, so we fall
+ * back to our own.
+ */
+void tlmu_timers_reinit(struct tlmu *q)
+{
+	pthread_mutex_init(&timer_mutex, NULL);
+	pthread_mutex_init(&dmi_windows_mutex, NULL);
+	q->timer.pending = 0;
+	q->timer.next = NULL;
+	timers = &q->timer;
+	tlmu_timers_init();
+	tlmu_hosttimer_unblock();
+	tlmu_set_timer_start_cb(q, q, tlmu_timer_start);
+}
+
+static struct tlmu_dmi_window *tlmu_dmi_window_find(uint64_t addr)
+{
+	struct tlmu_dmi_window *w;
+
+	for (w = dmi_windows; w; w = w->next) {
+		if (addr >= w->base && addr - w->base < w->size) {
+			return w;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Called by the emulators when they get a DMI pointer. Returns the per page
+ * code masks of the window containing base, creating it if needed. base
+ * and size are updated to reflect the window.
+ */
+static uint64_t *tlmu_dmi_pages_map(void *o, uint64_t *base, uint64_t *size)
+{
+	struct tlmu_dmi_window *w;
+	uint64_t nr_pages;
+
+	pthread_mutex_lock(&dmi_windows_mutex);
+	w = tlmu_dmi_window_find(*base);
+	if (!w) {
+		w = calloc(1, sizeof *w);
+		w->base = *base & ~(TLMU_DMI_PAGE_SIZE - 1);
+		w->size = *base + *size - w->base;
+		nr_pages = (w->size + TLMU_DMI_PAGE_SIZE - 1) >> TLMU_DMI_PAGE_BITS;
+		/* Shared, so out-of-process instances can map it.  */
+		w->code = tlmu_shm_alloc(nr_pages * sizeof *w->code);
+		w->next = dmi_windows;
+		dmi_windows = w;
+	}
+	*base = w->base;
+	*size = w->size;
+	pthread_mutex_unlock(&dmi_windows_mutex);
+	return w->code;
+}
+
+/*
+ * Ask every instance, except self, holding code from the modified pages
+ * to invalidate it.
+ */
+static void tlmu_dmi_pages_notify(uint64_t addr, uint64_t len, int self)
+{
+	struct tlmu_dmi_window *w;
+	struct tlmu_dmi dmi;
+	uint64_t owners = 0;
+	int i;
+
+	if (!len) {
+		return;
+	}
+
+	pthread_mutex_lock(&dmi_windows_mutex);
+	for (w = dmi_windows; w; w = w->next) {
+		uint64_t first, last, p;
+
+		if (addr + len <= w->base || addr >= w->base + w->size) {
+			continue;
+		}
+		first = addr > w->base ? addr - w->base : 0;
+		last = addr + len - w->base;
+		if (last > w->size) {
+			last = w->size;
+		}
+		for (p = first >> TLMU_DMI_PAGE_BITS;
+		     p <= (last - 1) >> TLMU_DMI_PAGE_BITS; p++) {
+			owners |= w->code[p];
+		}
+	}
+	pthread_mutex_unlock(&dmi_windows_mutex);
+
+	if (self >= 0) {
+		owners &= ~(1ULL << self);
+	}
+
+	dmi.base = addr;
+	dmi.size = len;
+	for (i = 0; owners; i++, owners >>= 1) {
+		if (owners & 1) {
+			tlmu_notify_event(instances[i],
+					TLMU_TLM_EVENT_INVALIDATE_CODE, &dmi);
+		}
+	}
+}
+
+/* Called by the emulators on writes to pages other instances run code from. */
+static void tlmu_dmi_pages_written(void *o, uint64_t addr, uint64_t len)
+{
+	struct tlmu *q = o;
+
+	tlmu_dmi_pages_notify(addr, len, q->id);
+}
+
+void tlmu_dmi_mark_dirty(uint64_t addr, uint64_t len)
+{
+	tlmu_dmi_pages_notify(addr, len, -1);
+}
+
 static void copylib(const char *path, const char *newpath)
 {
 	int s = -1, d = -1;
@@ -335,6 +474,7 @@ int tlmu_load(struct tlmu *q, const char *soname)
 	q->tlm_image_load_base = dlsym_wrap(q->dl_handle, "tlm_image_load_base");
 	q->tlm_image_load_size = dlsym_wrap(q->dl_handle, "tlm_image_load_size");
 	q->tlm_map_ram = dlsym_wrap(q->dl_handle, "tlm_map_ram");
+	q->tlm_map_region = dlsym_wrap(q->dl_handle, "tlm_map_region");
 	q->tlm_opaque = dlsym_wrap(q->dl_handle, "tlm_opaque");
 	q->tlm_notify_event = dlsym_wrap(q->dl_handle, "tlm_notify_event");
 	q->tlm_timer_opaque = dlsym_wrap(q->dl_handle, "tlm_timer_opaque");
@@ -344,14 +484,29 @@ int tlmu_load(struct tlmu *q, const char *soname)
 	q->tlm_boot_state = dlsym_wrap(q->dl_handle, "tlm_boot_state");
 	q->tlm_bus_access_cb = dlsym_wrap(q->dl_handle, "tlm_bus_access_cb");
 	q->tlm_bus_access_dbg_cb = dlsym_wrap(q->dl_handle, "tlm_bus_access_dbg_cb");
+	q->tlm_bus_access_cpu_cb = dlsym_wrap(q->dl_handle, "tlm_bus_access_cpu_cb");
+	q->tlm_nb_access_cb = dlsym_wrap(q->dl_handle, "tlm_nb_access_cb");
 	q->tlm_bus_access = dlsym_wrap(q->dl_handle, "tlm_bus_access");
 	q->tlm_bus_access_dbg = dlsym_wrap(q->dl_handle, "tlm_bus_access_dbg");
 	q->tlm_get_dmi_ptr_cb = dlsym_wrap(q->dl_handle, "tlm_get_dmi_ptr_cb");
 	q->tlm_get_dmi_ptr = dlsym_wrap(q->dl_handle, "tlm_get_dmi_ptr");
+	q->tlm_bitstream_cb = dlsym_wrap(q->dl_handle, "tlm_bitstream_cb");
+	q->tlm_set_profiling = dlsym_wrap(q->dl_handle, "tlm_set_profiling");
+	q->tlm_set_record_replay = dlsym_wrap(q->dl_handle,
+					"tlm_set_record_replay");
+	q->tlm_instance_id = dlsym_wrap(q->dl_handle, "tlm_instance_id");
+	q->tlm_dmi_pages_opaque = dlsym_wrap(q->dl_handle,
+					"tlm_dmi_pages_opaque");
+	q->tlm_dmi_pages_map = dlsym_wrap(q->dl_handle, "tlm_dmi_pages_map");
+	q->tlm_dmi_pages_written = dlsym_wrap(q->dl_handle,
+					"tlm_dmi_pages_written");
+	q->tlm_get_dirty_bitmap = dlsym_wrap(q->dl_handle,
+					"tlm_get_dirty_bitmap");
     q->qemu_system_shutdown_request = dlsym_wrap(q->dl_handle, "qemu_system_shutdown_request");
 	tlmu_set_timer_start_cb(q, q, tlmu_timer_start);
 	if (!q->main
 		|| !q->tlm_map_ram
+		|| !q->tlm_map_region
 		|| !q->tlm_set_log_filename
 		|| !q->tlm_image_load_base
 		|| !q->tlm_image_load_size
@@ -363,16 +518,34 @@ int tlmu_load(struct tlmu *q, const char *soname)
 		|| !q->tlm_boot_state
 		|| !q->tlm_bus_access_cb
 		|| !q->tlm_bus_access_dbg_cb
+		|| !q->tlm_bus_access_cpu_cb
+		|| !q->tlm_nb_access_cb
 		|| !q->tlm_bus_access
 		|| !q->tlm_bus_access_dbg
 		|| !q->tlm_get_dmi_ptr_cb
 		|| !q->tlm_get_dmi_ptr
+		|| !q->tlm_bitstream_cb
+		|| !q->tlm_set_profiling
+		|| !q->tlm_set_record_replay
+		|| !q->tlm_instance_id
+		|| !q->tlm_dmi_pages_opaque
+		|| !q->tlm_dmi_pages_map
+		|| !q->tlm_dmi_pages_written
+		|| !q->tlm_get_dirty_bitmap
         || !q->qemu_system_shutdown_request) {
 		dlclose(q->dl_handle);
 		free(socopy);
 		return 1;
 	}
 
+	/* Code tracking in shared DMI windows needs an instance id.  */
+	*q->tlm_instance_id = q->id;
+	if (q->id >= 0) {
+		*q->tlm_dmi_pages_opaque = q;
+		*q->tlm_dmi_pages_map = tlmu_dmi_pages_map;
+		*q->tlm_dmi_pages_written = tlmu_dmi_pages_written;
+	}
+
 	n = asprintf(&logname, ".tlmu/%s-%s.log", sobasename, q->name);
 	tlmu_set_log_filename(q, logname);
 	free(logname);
@@ -383,6 +556,10 @@ int tlmu_load(struct tlmu *q, const char *soname)
 
 void tlmu_notify_event(struct tlmu *q, enum tlmu_event ev, void *d)
 {
+	if (tlmu_remote_active(q)) {
+		tlmu_remote_notify(q, ev, d);
+		return;
+	}
 	q->tlm_notify_event(ev, d);
 }
 
@@ -397,6 +574,19 @@ void tlmu_set_bus_access_cb(struct tlmu *q,
 	*q->tlm_bus_access_cb = access;
 }
 
+void tlmu_set_bus_access_cpu_cb(struct tlmu *q,
+		int (*access)(void *, int64_t, int, int, int,
+				uint64_t, void *, int))
+{
+	*q->tlm_bus_access_cpu_cb = access;
+}
+
+void tlmu_set_nb_access_cb(struct tlmu *q,
+		int (*nb)(void *, struct tlmu_nb_txn *))
+{
+	*q->tlm_nb_access_cb = nb;
+}
+
 void tlmu_set_bus_access_dbg_cb(struct tlmu *q,
 		void (*access)(void *, int64_t, int, uint64_t, void *, int))
 {
@@ -409,6 +599,12 @@ void tlmu_set_bus_get_dmi_ptr_cb(struct tlmu *q,
 	*q->tlm_get_dmi_ptr_cb = dmi;
 }
 
+void tlmu_set_bitstream_cb(struct tlmu *q,
+		void (*cb)(void *, const void *, int))
+{
+	*q->tlm_bitstream_cb = cb;
+}
+
 void tlmu_set_sync_period_ns(struct tlmu *q, uint64_t period_ns)
 {
 	*q->tlm_sync_period_ns = period_ns;
@@ -433,17 +629,28 @@ void tlmu_set_timer_start_cb(struct tlmu *q, void *o,
 
 int tlmu_bus_access(struct tlmu *q, int rw, uint64_t addr, void *data, int len)
 {
+	if (tlmu_remote_active(q)) {
+		return tlmu_remote_bus_access(q, 0, rw, addr, data, len);
+	}
 	return q->tlm_bus_access(rw, addr, data, len);
 }
 
 void tlmu_bus_access_dbg(struct tlmu *q,
 			int rw, uint64_t addr, void *data, int len)
 {
+	if (tlmu_remote_active(q)) {
+		tlmu_remote_bus_access(q, 1, rw, addr, data, len);
+		return;
+	}
 	q->tlm_bus_access_dbg(rw, addr, data, len);
 }
 
 int tlmu_get_dmi_ptr(struct tlmu *q, struct tlmu_dmi *dmi)
 {
+	/* The RAM of out-of-process instances isn't in our address space.  */
+	if (tlmu_remote_active(q)) {
+		return 0;
+	}
 	return q->tlm_get_dmi_ptr(dmi);
 }
 
@@ -460,6 +667,12 @@ void tlmu_map_ram_nosync(struct tlmu *q, const char *name,
 	q->tlm_map_ram(name, addr, size, rw, 1);
 }
 
+void tlmu_map_region(struct tlmu *q, const char *name,
+		uint64_t addr, uint64_t size, uint32_t flags)
+{
+	q->tlm_map_region(name, addr, size, flags);
+}
+
 
 void tlmu_set_log_filename(struct tlmu *q, const char *f)
 {
@@ -472,6 +685,27 @@ void tlmu_set_image_load_params(struct tlmu *q, uint64_t base, uint64_t size)
 	*q->tlm_image_load_size = size;
 }
 
+void tlmu_set_profiling(struct tlmu *q, const char *filename,
+			uint64_t period_insns, int depth)
+{
+	q->tlm_set_profiling(filename, period_insns, depth);
+}
+
+void tlmu_set_record_replay(struct tlmu *q, enum tlmu_rr_mode mode,
+			    const char *filename)
+{
+	q->tlm_set_record_replay(mode, filename);
+}
+
+int tlmu_get_dirty_bitmap(struct tlmu *q, uint64_t base, uint64_t size,
+			  uint8_t *bitmap, int clear)
+{
+	if (tlmu_remote_active(q)) {
+		return tlmu_remote_get_dirty_bitmap(q, base, size, bitmap, clear);
+	}
+	return q->tlm_get_dirty_bitmap(base, size, bitmap, clear);
+}
+
 void tlmu_append_arg(struct tlmu *t, const char *arg)
 {
 	int i = 0;
@@ -487,7 +721,7 @@ void tlmu_append_arg(struct tlmu *t, const char *arg)
 	t->argv[i + 1] = NULL;
 }
 
-void tlmu_run(struct tlmu *t)
+void tlmu_run_local(struct tlmu *t)
 {
 	int argc = 0;
 
@@ -497,7 +731,20 @@ void tlmu_run(struct tlmu *t)
     t->main(0, 1, 1, argc, t->argv, NULL);
 }
 
+void tlmu_run(struct tlmu *t)
+{
+	if (t->remote) {
+		tlmu_remote_run(t);
+		return;
+	}
+	tlmu_run_local(t);
+}
+
 void tlmu_exit(struct tlmu *t)
 {
+	if (tlmu_remote_active(t)) {
+		tlmu_remote_exit(t);
+		return;
+	}
     (*(t->qemu_system_shutdown_request))();
 }
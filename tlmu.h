@@ -23,6 +23,7 @@
 #ifndef TLMU_TLMU_H
 #define TLMU_TLMU_H
 #include <setjmp.h>
+#include <stddef.h>
 
 #define TLMU_BASE_QEMU_MAJOR_VER 1
 #define TLMU_BASE_QEMU_MINOR_VER 4
@@ -48,6 +49,8 @@ struct tlmu_timer {
 struct tlmu
 {
 	const char *name;
+	/* Instance id, indexes the per page code masks of DMI windows.  */
+	int id;
 
 	/* We only need one timer per instance.  */
 	struct tlmu_timer timer;
@@ -62,6 +65,8 @@ struct tlmu
 
 	void (*tlm_map_ram)(const char *name,
 			    uint64_t addr, uint64_t size, int rw, int try_turbo_mode);
+	void (*tlm_map_region)(const char *name,
+			       uint64_t addr, uint64_t size, uint32_t flags);
 	void **tlm_opaque;
 	void **tlm_timer_opaque;
 	uint64_t *tlm_image_load_base;
@@ -78,6 +83,9 @@ struct tlmu
 				uint64_t addr, void *data, int len);
 	void (**tlm_bus_access_dbg_cb)(void *o, int64_t clk,
 			int rw, uint64_t addr, void *data, int len);
+	int (**tlm_bus_access_cpu_cb)(void *o, int64_t clk, int cpu,
+			int access, int rw, uint64_t addr, void *data, int len);
+	int (**tlm_nb_access_cb)(void *o, struct tlmu_nb_txn *txn);
 	int (*tlm_bus_access)(int rw, uint64_t addr, void *data, int len);
 	void (*tlm_bus_access_dbg)(int rw,
 				uint64_t addr, void *data, int len);
@@ -85,7 +93,20 @@ struct tlmu
 	void (**tlm_get_dmi_ptr_cb)(void *o, uint64_t addr,
 					struct tlmu_dmi *dmi);
 	int (*tlm_get_dmi_ptr)(struct tlmu_dmi *dmi);
+	void (**tlm_bitstream_cb)(void *o, const void *data, int len);
+	void (*tlm_set_profiling)(const char *filename,
+				  uint64_t period_insns, int depth);
+	void (*tlm_set_record_replay)(int mode, const char *filename);
+	int *tlm_instance_id;
+	void **tlm_dmi_pages_opaque;
+	uint64_t *(**tlm_dmi_pages_map)(void *o, uint64_t *base, uint64_t *size);
+	void (**tlm_dmi_pages_written)(void *o, uint64_t addr, uint64_t len);
+	int (*tlm_get_dirty_bitmap)(uint64_t base, uint64_t size,
+				    uint8_t *bitmap, int clear);
     void (*qemu_system_shutdown_request)(void);
+
+	/* Non-NULL for out-of-process instances.  */
+	struct tlmu_remote *remote;
 };
 
 /*
@@ -121,8 +142,9 @@ void tlmu_set_opaque(struct tlmu *t, void *o);
  *  o          - Is the registered instance pointer, see tlm_set_opaque().
  *  clk        - The current TLMu time. (-1 if invalid/unknown).
  *  rw         - 0 for reads, non-zero for write accesses.
- *  data       - Pointer to data
- *  len        - Requested transaction length
+ *  data       - Pointer to data, in the byte order of the TLMu target
+ *  len        - Requested transaction length, 1 to 8 bytes. Accesses
+ *               are not necessarily aligned to len
  *
  * The callback is expected to return 1 if the accessed unit supports DMI,
  * see tlmu_get_dmi_ptr for more info.
@@ -130,6 +152,17 @@ void tlmu_set_opaque(struct tlmu *t, void *o);
 void tlmu_set_bus_access_cb(struct tlmu *t,
 		int (*access)(void *o, int64_t clk,
 				int rw, uint64_t addr, void *data, int len));
+/*
+ * Same as tlmu_set_bus_access_cb but the callback also gets the index of
+ * the accessing CPU (-1 for accesses not made by a CPU) and the kind of
+ * access (enum tlmu_access). Accesses are classified by who made them:
+ * device DMA is TLMU_ACCESS_DMA even when it runs on behalf of a CPU
+ * instruction. Useful with -smp to give every core its own initiator.
+ * When registered, it is called instead of the bus_access callback.
+ */
+void tlmu_set_bus_access_cpu_cb(struct tlmu *t,
+		int (*access)(void *o, int64_t clk, int cpu, int access,
+				int rw, uint64_t addr, void *data, int len));
 /*
  * Register a callback for debug accesses. The callback works similarily as
  * the one for tlmu_set_bus_access_cb, but it doesn't have a return value.
@@ -139,12 +172,31 @@ void tlmu_set_bus_access_cb(struct tlmu *t,
  */
 void tlmu_set_bus_access_dbg_cb(struct tlmu *t,
 		void (*access)(void *, int64_t, int, uint64_t, void *, int));
+/*
+ * Register a callback for non-blocking accesses. TLMu uses it for posted
+ * CPU writes (see TLMU_REGION_POSTED) and device DMA, CPU loads always
+ * block. The callback returns 1 if it accepted the transaction, TLMu then
+ * waits for a TLMU_TLM_EVENT_NB_DONE event with txn as argument. If it
+ * returns 0, TLMu retries with a blocking access.
+ *
+ * Blocking accesses must not pass earlier non-blocking ones.
+ */
+void tlmu_set_nb_access_cb(struct tlmu *t,
+		int (*nb)(void *o, struct tlmu_nb_txn *txn));
 /*
  * Register a callback to be called when the TLMu emulator requests a
  * Direct Memory Interface (DMI) area.
  */
 void tlmu_set_bus_get_dmi_ptr_cb(struct tlmu *t,
 			void (*dmi)(void *, uint64_t, struct tlmu_dmi*));
+/*
+ * Register a callback that receives the FPGA bitstreams guest software
+ * loads through the emulated configuration interface (the PCAP of the
+ * Zynq devcfg). Data is passed on in the order it is written, in DMA sized
+ * pieces, and only lives for the duration of the call.
+ */
+void tlmu_set_bitstream_cb(struct tlmu *t,
+		void (*cb)(void *o, const void *data, int len));
 /*
  * Register a callback function to be called at sync points.
  */
@@ -168,6 +220,10 @@ void tlmu_bus_access_dbg(struct tlmu *t,
  * Return 1 if success.
  */
 int tlmu_get_dmi_ptr(struct tlmu *t, struct tlmu_dmi *dmi);
+/*
+ * Override how the instance arms its timers. Not used by out-of-process
+ * instances, their timers run in the child with the built-in host timer.
+ */
 void tlmu_set_timer_start_cb(struct tlmu *t, void *o,
 	void (*cb)(void *o, void *cb_o, void (*tcb)(void *o), int64_t d_ns));
 /*
@@ -193,6 +249,20 @@ void tlmu_map_ram(struct tlmu *t, const char *name,
 void tlmu_map_ram_nosync(struct tlmu *t, const char *name,
                 uint64_t addr, uint64_t size, int rw);
 
+/*
+ * Tell the TLMu instance about a target in the main emulators memory map.
+ * Every target gets its own region in TLMu, with its own access policy.
+ * Must be called before tlmu_run().
+ *
+ * t         - The TLMu instance
+ * name      - An name for the target
+ * addr      - Base address
+ * size      - Size of the target
+ * flags     - TLMU_REGION_* policy flags
+ */
+void tlmu_map_region(struct tlmu *t, const char *name,
+                uint64_t addr, uint64_t size, uint32_t flags);
+
 
 /*
  * Set the per TLMu instance log filename.
@@ -201,8 +271,86 @@ void tlmu_map_ram_nosync(struct tlmu *t, const char *name,
  * f         - Log filename
  */
 void tlmu_set_log_filename(struct tlmu *t, const char *f);
+
+/*
+ * Tell all TLMu instances that memory behind a DMI window was modified by
+ * someone else than a TLMu CPU (e.g a SystemC DMA master). Instances that
+ * have translated code from the modified pages will drop it.
+ *
+ * addr      - Physical address of the modification
+ * len       - Length of the modification
+ */
+void tlmu_dmi_mark_dirty(uint64_t addr, uint64_t len);
+
+/*
+ * Get the pages written by the TLMu instance through DMI windows and RAM
+ * maps. Must be called while the instance is stopped in a callback.
+ *
+ * t         - The TLMu instance
+ * base      - Physical address of the first page, TLMU_DMI_PAGE_SIZE aligned
+ * size      - Size of the range
+ * bitmap    - One bit per TLMU_DMI_PAGE_SIZE page, LSB of byte 0 first.
+ *             Dirty pages are ORed into it.
+ * clear     - Non-zero to clear the dirty state of the range
+ *
+ * Returns the number of pages marked in bitmap.
+ */
+int tlmu_get_dirty_bitmap(struct tlmu *t, uint64_t base, uint64_t size,
+			  uint8_t *bitmap, int clear);
+
 void tlmu_set_image_load_params(struct tlmu *t, uint64_t base, uint64_t size);
 
+/*
+ * Enable the statistical PC sampling profiler. Must be called before
+ * tlmu_run().
+ *
+ * t            - The TLMu instance
+ * filename     - Where to write the callgrind formated profile at exit
+ * period_insns - Number of guest instructions between samples (needs -icount)
+ * depth        - Max number of frame pointer walked callers per sample,
+ *                zero to only sample the PC.
+ */
+void tlmu_set_profiling(struct tlmu *t, const char *filename,
+			uint64_t period_insns, int depth);
+
+/*
+ * Record the responses of the main emulator or replay them from a previous
+ * recording. Must be called before tlmu_run().
+ *
+ * t         - The TLMu instance
+ * mode      - TLMU_RR_RECORD or TLMU_RR_REPLAY
+ * filename  - The log file
+ *
+ * When recording, all bus access results, DMI grants, sync points and
+ * notified events (e.g IRQs) are logged. When replaying, no callbacks nor
+ * RAM maps need to be registered, TLMu runs standalone on the logged
+ * responses and aborts if the guest makes a different sequence of bus
+ * accesses.
+ */
+void tlmu_set_record_replay(struct tlmu *t, enum tlmu_rr_mode mode,
+			    const char *filename);
+
+/*
+ * Run the instance in a child process. Must be called before tlmu_run(),
+ * which then forks. The callbacks are called in the calling process, with
+ * synchronous calls into the instance (e.g tlmu_bus_access) served on the
+ * thread making them. Only DMI pointers into memory from tlmu_shm_alloc()
+ * are granted to the instance and tlmu_get_dmi_ptr() always fails. The
+ * child replaces a callback set with tlmu_set_timer_start_cb() with the
+ * built-in host timer.
+ *
+ * t         - The TLMu instance
+ * enable    - Non-zero to run out-of-process
+ */
+void tlmu_set_out_of_process(struct tlmu *t, int enable);
+
+/*
+ * Allocate zeroed memory that can be shared with out-of-process instances,
+ * e.g to back RAM models handed out through DMI.
+ */
+void *tlmu_shm_alloc(size_t size);
+void tlmu_shm_free(void *p);
+
 void tlmu_run(struct tlmu *t);
 void tlmu_exit(struct tlmu *t);
 static inline void tlmu_delete(struct tlmu *t)